@@ -12,6 +12,7 @@
 
 #include "qemu/osdep.h"
 #include "exec/exec-all.h"
+#include "accel/tcg/perf.h"
 
 void tb_flush(CPUState *cpu)
 {
@@ -25,6 +26,18 @@ void tcg_flush_jmp_cache(CPUState *cpu)
 {
 }
 
+void perf_enable_perfmap(void)
+{
+}
+
+void perf_enable_jitdump(void)
+{
+}
+
+void perf_exit(void)
+{
+}
+
 int probe_access_flags(CPUArchState *env, target_ulong addr,
                        MMUAccessType access_type, int mmu_idx,
                        bool nonfault, void **phost, uintptr_t retaddr)
@@ -46,6 +46,7 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "superblock.h"
 
 /* -icount align implementation. */
 
@@ -884,6 +885,14 @@ static inline void cpu_loop_exec_tb(CPUState *cpu, TranslationBlock *tb,
         return;
     }
 
+    /*
+     * A TB that has become hot, see superblock_gen_exec_count().  Only
+     * TBs without CF_USE_ICOUNT count their executions.
+     */
+    if (superblock_threshold && !(tb_cflags(tb) & CF_USE_ICOUNT)) {
+        return;
+    }
+
     /* Instruction counter expired.  */
     assert(icount_enabled());
 #ifndef CONFIG_USER_ONLY
@@ -1013,6 +1022,19 @@ int cpu_exec(CPUState *cpu)
                 tb_jmp_cache_set(cpu->tb_jmp_cache, h, tb, pc);
             }
 
+            if (unlikely(qatomic_read(&tb->exec_count) < 0)) {
+                TranslationBlock *sb;
+
+                mmap_lock();
+                sb = superblock_gen(cpu, tb, pc);
+                mmap_unlock();
+                if (sb) {
+                    tb = sb;
+                    tb_jmp_cache_set(cpu->tb_jmp_cache,
+                                     tb_jmp_cache_hash_func(pc), tb, pc);
+                }
+            }
+
 #ifndef CONFIG_USER_ONLY
             /*
              * We don't take care of direct jumps when address mapping
@@ -99,6 +99,10 @@ static inline void assert_no_pages_locked(void) { }
 TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
                               target_ulong cs_base, uint32_t flags,
                               int cflags);
+typedef struct Superblock Superblock;
+TranslationBlock *tb_gen_superblock(CPUState *cpu, const Superblock *sb,
+                                    target_ulong cs_base, uint32_t flags,
+                                    int cflags);
 G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
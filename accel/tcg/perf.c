@@ -0,0 +1,245 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * The jitdump format is specified at
+ * https://git.kernel.org/pub/scm/linux/kernel/git/torvalds/linux.git/tree/tools/perf/Documentation/jitdump-specification.txt
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "elf.h"
+#include "perf.h"
+
+static FILE *perfmap;
+
+void perf_enable_perfmap(void)
+{
+    char map_file[32];
+
+    snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
+    perfmap = fopen(map_file, "w");
+    if (perfmap == NULL) {
+        warn_report("Could not open %s: %s, proceeding without perfmap",
+                    map_file, strerror(errno));
+    }
+}
+
+static void write_perfmap_entry(const char *name, const void *start,
+                                size_t size)
+{
+    /* A single fprintf() is atomic with respect to other threads */
+    fprintf(perfmap, "%" PRIxPTR " %zx %s\n", (uintptr_t)start, size, name);
+}
+
+#ifdef CONFIG_LINUX
+#define JITHEADER_MAGIC 0x4A695444
+#define JITHEADER_VERSION 1
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+enum jit_record_type {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    /* Followed by the NUL-terminated name and by the code itself */
+};
+
+static FILE *jitdump;
+static uint64_t jitdump_code_index; /* protected by the jitdump FILE lock */
+
+/* perf samples are timestamped with CLOCK_MONOTONIC by "perf record -k 1" */
+static uint64_t jitdump_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The ELF machine of the host, which perf uses to disassemble the code */
+static uint32_t get_e_machine(void)
+{
+    uint8_t ehdr[20];
+    uint16_t e_machine;
+    ssize_t n = 0;
+    int fd;
+
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd >= 0) {
+        n = read(fd, ehdr, sizeof(ehdr));
+        close(fd);
+    }
+    if (n != sizeof(ehdr) || memcmp(ehdr, ELFMAG, SELFMAG)) {
+        return EM_NONE;
+    }
+
+    /* e_machine follows e_ident and e_type in both ELFCLASS32 and 64 */
+    memcpy(&e_machine, &ehdr[18], sizeof(e_machine));
+    return e_machine;
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader header;
+    char jitdump_file[32];
+    size_t marker_size = qemu_real_host_page_size();
+    void *marker;
+    int fd;
+
+    snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
+    fd = open(jitdump_file, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd == -1) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        return;
+    }
+
+    /*
+     * perf finds the dump, and with it the pid and the path, through an
+     * executable mapping of the file, which must stay until the end.
+     */
+    marker = mmap(NULL, marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (marker == MAP_FAILED) {
+        warn_report("Could not map %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        close(fd);
+        return;
+    }
+
+    jitdump = fdopen(fd, "w+");
+    if (jitdump == NULL) {
+        warn_report("Could not open %s: %s, proceeding without jitdump",
+                    jitdump_file, strerror(errno));
+        munmap(marker, marker_size);
+        close(fd);
+        return;
+    }
+
+    header = (struct jitheader) {
+        .magic = JITHEADER_MAGIC,
+        .version = JITHEADER_VERSION,
+        .total_size = sizeof(header),
+        .elf_mach = get_e_machine(),
+        .pid = getpid(),
+        .timestamp = jitdump_timestamp(),
+    };
+    fwrite(&header, sizeof(header), 1, jitdump);
+}
+
+static void write_jr_code_load(const char *name, const void *start,
+                               size_t size)
+{
+    size_t name_size = strlen(name) + 1;
+    struct jr_code_load load = {
+        .p.id = JIT_CODE_LOAD,
+        .p.total_size = sizeof(load) + name_size + size,
+        .p.timestamp = jitdump_timestamp(),
+        .pid = getpid(),
+        .tid = qemu_get_thread_id(),
+        .vma = (uintptr_t)start,
+        .code_addr = (uintptr_t)start,
+        .code_size = size,
+    };
+
+    flockfile(jitdump);
+    load.code_index = jitdump_code_index++;
+    fwrite(&load, sizeof(load), 1, jitdump);
+    fwrite(name, name_size, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+    funlockfile(jitdump);
+}
+#else
+static FILE *jitdump;
+
+void perf_enable_jitdump(void)
+{
+    warn_report("jitdump is only supported on Linux hosts");
+}
+
+static void write_jr_code_load(const char *name, const void *start,
+                               size_t size)
+{
+    g_assert_not_reached();
+}
+#endif
+
+static void perf_report(const char *name, const void *start, size_t size)
+{
+    if (perfmap) {
+        write_perfmap_entry(name, start, size);
+    }
+    if (jitdump) {
+        write_jr_code_load(name, start, size);
+    }
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    if (perfmap || jitdump) {
+        perf_report("tcg-prologue", start, size);
+    }
+}
+
+void perf_report_code(uint64_t guest_pc, uint32_t guest_size,
+                      const void *start, size_t size)
+{
+    char name[48];
+
+    if (!perfmap && !jitdump) {
+        return;
+    }
+
+    snprintf(name, sizeof(name), "guest-0x%" PRIx64 "+0x%" PRIx32,
+             guest_pc, guest_size);
+    perf_report(name, start, size);
+}
+
+/*
+ * Other threads may still be translating, so the files stay open until
+ * the process exits.
+ */
+void perf_exit(void)
+{
+    if (perfmap) {
+        fflush(perfmap);
+    }
+
+#ifdef CONFIG_LINUX
+    if (jitdump) {
+        struct jr_prefix close_record = {
+            .id = JIT_CODE_CLOSE,
+            .total_size = sizeof(close_record),
+            .timestamp = jitdump_timestamp(),
+        };
+
+        fwrite(&close_record, sizeof(close_record), 1, jitdump);
+        fflush(jitdump);
+    }
+#endif
+}
@@ -0,0 +1,41 @@
+/*
+ * Linux perf perf-<pid>.map and jit-<pid>.dump integration.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_PERF_H
+#define ACCEL_TCG_PERF_H
+
+/*
+ * Both outputs let perf attribute samples in the code generation buffer
+ * to the guest code they were translated from.  Symbols are named after
+ * the guest range of each TranslationBlock, e.g. "guest-0x401000+0x1c".
+ *
+ * perf-<pid>.map is read by "perf report" directly, but cannot describe
+ * code that is overwritten after a tb_flush(): all TBs that ever lived at
+ * an address are listed for it.  jit-<pid>.dump records are timestamped,
+ * so that "perf inject --jit" attributes each sample to the TB that was
+ * live when it was taken; record with "perf record -k 1".
+ */
+
+/* Start writing /tmp/perf-<pid>.map. */
+void perf_enable_perfmap(void);
+
+/* Start writing ./jit-<pid>.dump. */
+void perf_enable_jitdump(void);
+
+/* Add the TCG prologue and epilogue, at @start and @size bytes long. */
+void perf_report_prologue(const void *start, size_t size);
+
+/*
+ * Add the @size bytes of host code at @start, translated from the
+ * @guest_size bytes of guest code at @guest_pc.
+ */
+void perf_report_code(uint64_t guest_pc, uint32_t guest_size,
+                      const void *start, size_t size);
+
+/* Flush the files; called at exit. */
+void perf_exit(void);
+
+#endif
@@ -91,6 +91,45 @@ void HELPER(plugin_vcpu_mem_cb)(unsigned int vcpu_index,
                                 void *userdata)
 { }
 
+/*
+ * Unlike the above, this one does the work: it compares the scoreboard
+ * entry at @entry against @imm, and calls @f if the comparison holds.
+ */
+void HELPER(plugin_vcpu_cond_udata_cb)(uint32_t cpu_index, void *entry,
+                                       uint32_t cond, uint64_t imm,
+                                       void *f, void *udata)
+{
+    uint64_t val = *(uint64_t *)entry;
+    bool hit;
+
+    switch (cond) {
+    case QEMU_PLUGIN_COND_EQ:
+        hit = val == imm;
+        break;
+    case QEMU_PLUGIN_COND_NE:
+        hit = val != imm;
+        break;
+    case QEMU_PLUGIN_COND_LT:
+        hit = val < imm;
+        break;
+    case QEMU_PLUGIN_COND_LE:
+        hit = val <= imm;
+        break;
+    case QEMU_PLUGIN_COND_GT:
+        hit = val > imm;
+        break;
+    case QEMU_PLUGIN_COND_GE:
+        hit = val >= imm;
+        break;
+    default:
+        /* ALWAYS and NEVER conditions are handled at registration */
+        g_assert_not_reached();
+    }
+    if (hit) {
+        ((qemu_plugin_vcpu_udata_cb_t)f)(cpu_index, udata);
+    }
+}
+
 static void do_gen_mem_cb(TCGv vaddr, uint32_t info)
 {
     TCGv_i32 cpu_index = tcg_temp_new_i32();
@@ -124,20 +163,12 @@ static void gen_empty_udata_cb(void)
 }
 
 /*
- * For now we only support addi_i64.
- * When we support more ops, we can generate one empty inline cb for each.
+ * Inline ops, and the conditional callbacks that go with them, are not
+ * copied from the empty callback but generated when injected, see
+ * gen_ops_after(); the empty callback only marks where they go.
  */
 static void gen_empty_inline_cb(void)
 {
-    TCGv_i64 val = tcg_temp_new_i64();
-    TCGv_ptr ptr = tcg_const_ptr(NULL); /* overwritten later */
-
-    tcg_gen_ld_i64(val, ptr, 0);
-    /* pass an immediate != 0 so that it doesn't get optimized away */
-    tcg_gen_addi_i64(val, val, 0xdeadface);
-    tcg_gen_st_i64(val, ptr, 0);
-    tcg_temp_free_ptr(ptr);
-    tcg_temp_free_i64(val);
 }
 
 static void gen_empty_mem_cb(TCGv addr, uint32_t info)
@@ -325,19 +356,6 @@ static TCGOp *copy_extu_tl_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_ld_i64(TCGOp **begin_op, TCGOp *op)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* 2x ld_i32 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-        op = copy_op(begin_op, op, INDEX_op_ld_i32);
-    } else {
-        /* ld_i64 */
-        op = copy_op(begin_op, op, INDEX_op_ld_i64);
-    }
-    return op;
-}
-
 static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
 {
     if (TCG_TARGET_REG_BITS == 32) {
@@ -351,21 +369,6 @@ static TCGOp *copy_st_i64(TCGOp **begin_op, TCGOp *op)
     return op;
 }
 
-static TCGOp *copy_add_i64(TCGOp **begin_op, TCGOp *op, uint64_t v)
-{
-    if (TCG_TARGET_REG_BITS == 32) {
-        /* all 32-bit backends must implement add2_i32 */
-        g_assert(TCG_TARGET_HAS_add2_i32);
-        op = copy_op(begin_op, op, INDEX_op_add2_i32);
-        op->args[4] = tcgv_i32_arg(tcg_constant_i32(v));
-        op->args[5] = tcgv_i32_arg(tcg_constant_i32(v >> 32));
-    } else {
-        op = copy_op(begin_op, op, INDEX_op_add_i64);
-        op->args[2] = tcgv_i64_arg(tcg_constant_i64(v));
-    }
-    return op;
-}
-
 static TCGOp *copy_st_ptr(TCGOp **begin_op, TCGOp *op)
 {
     if (UINTPTR_MAX == UINT32_MAX) {
@@ -438,23 +441,99 @@ static TCGOp *append_udata_cb(const struct qemu_plugin_dyn_cb *cb,
     return op;
 }
 
+/*
+ * Generate ops with gen(@cb) at the end of the op stream, then move them
+ * after @op.  Return the last op moved.
+ */
+static TCGOp *gen_ops_after(TCGOp *op,
+                            void (*gen)(const struct qemu_plugin_dyn_cb *),
+                            const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGOp *last = tcg_last_op();
+    TCGOp *next;
+
+    gen(cb);
+    if (op == last) {
+        return tcg_last_op();
+    }
+    while ((next = QTAILQ_NEXT(last, link)) != NULL) {
+        QTAILQ_REMOVE(&tcg_ctx->ops, next, link);
+        QTAILQ_INSERT_AFTER(&tcg_ctx->ops, op, next, link);
+        op = next;
+    }
+    return op;
+}
+
+/* Return the address of @entry for the running vCPU, or @ptr */
+static TCGv_ptr gen_plugin_u64_ptr(qemu_plugin_u64 entry, void *ptr)
+{
+    GArray *arr = entry.score ? entry.score->data : NULL;
+    TCGv_i32 cpu_index;
+    TCGv_ptr addr;
+
+    if (!arr) {
+        return tcg_constant_ptr(ptr);
+    }
+
+    cpu_index = tcg_temp_new_i32();
+    addr = tcg_temp_new_ptr();
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    tcg_gen_muli_i32(cpu_index, cpu_index, g_array_get_element_size(arr));
+    tcg_gen_ext_i32_ptr(addr, cpu_index);
+    tcg_gen_addi_ptr(addr, addr, (intptr_t)(arr->data + entry.offset));
+    tcg_temp_free_i32(cpu_index);
+    return addr;
+}
+
+static void gen_inline_op(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->inline_insn.entry, cb->userp);
+    TCGv_i64 val;
+
+    switch (cb->inline_insn.op) {
+    case QEMU_PLUGIN_INLINE_ADD_U64:
+        val = tcg_temp_new_i64();
+        tcg_gen_ld_i64(val, ptr, 0);
+        tcg_gen_addi_i64(val, val, cb->inline_insn.imm);
+        tcg_gen_st_i64(val, ptr, 0);
+        tcg_temp_free_i64(val);
+        break;
+    case QEMU_PLUGIN_INLINE_STORE_U64:
+        tcg_gen_st_i64(tcg_constant_i64(cb->inline_insn.imm), ptr, 0);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    tcg_temp_free_ptr(ptr);
+}
+
 static TCGOp *append_inline_cb(const struct qemu_plugin_dyn_cb *cb,
                                TCGOp *begin_op, TCGOp *op,
                                int *unused)
 {
-    /* const_ptr */
-    op = copy_const_ptr(&begin_op, op, cb->userp);
-
-    /* ld_i64 */
-    op = copy_ld_i64(&begin_op, op);
-
-    /* add_i64 */
-    op = copy_add_i64(&begin_op, op, cb->inline_insn.imm);
+    return gen_ops_after(op, gen_inline_op, cb);
+}
 
-    /* st_i64 */
-    op = copy_st_i64(&begin_op, op);
+/*
+ * The comparison is left to the helper: a branch would end the basic
+ * block, and insn callbacks are injected where the translator may still
+ * have live temps, e.g. the nullification condition of target/hppa.
+ */
+static void gen_cond_cb(const struct qemu_plugin_dyn_cb *cb)
+{
+    TCGv_ptr ptr = gen_plugin_u64_ptr(cb->cond.entry, NULL);
+    TCGv_i32 cpu_index = tcg_temp_new_i32();
 
-    return op;
+    tcg_gen_ld_i32(cpu_index, cpu_env,
+                   -offsetof(ArchCPU, env) + offsetof(CPUState, cpu_index));
+    gen_helper_plugin_vcpu_cond_udata_cb(cpu_index, ptr,
+                                         tcg_constant_i32(cb->cond.cond),
+                                         tcg_constant_i64(cb->cond.imm),
+                                         tcg_constant_ptr(cb->f.vcpu_udata),
+                                         tcg_constant_ptr(cb->userp));
+    tcg_temp_free_i32(cpu_index);
+    tcg_temp_free_ptr(ptr);
 }
 
 static TCGOp *append_mem_cb(const struct qemu_plugin_dyn_cb *cb,
@@ -554,6 +633,25 @@ inject_mem_cb(const GArray *cbs, TCGOp *begin_op)
     inject_cb_type(cbs, begin_op, append_mem_cb, op_rw);
 }
 
+/* conditional callbacks go after the regular ones, at the same place */
+static void inject_cond_cb(const GArray *cbs, TCGOp *begin_op)
+{
+    TCGOp *op;
+    int i;
+
+    if (!cbs || cbs->len == 0) {
+        return;
+    }
+
+    op = find_op(begin_op, INDEX_op_plugin_cb_end);
+    tcg_debug_assert(op);
+
+    for (i = 0; i < cbs->len; i++) {
+        op = gen_ops_after(op, gen_cond_cb,
+                           &g_array_index(cbs, struct qemu_plugin_dyn_cb, i));
+    }
+}
+
 /* we could change the ops in place, but we can reuse more code by copying */
 static void inject_mem_helper(TCGOp *begin_op, GArray *arr)
 {
@@ -646,6 +744,7 @@ void plugin_gen_disable_mem_helpers(void)
 static void plugin_gen_tb_udata(const struct qemu_plugin_tb *ptb,
                                 TCGOp *begin_op)
 {
+    inject_cond_cb(ptb->cbs[PLUGIN_CB_COND], begin_op);
     inject_udata_cb(ptb->cbs[PLUGIN_CB_REGULAR], begin_op);
 }
 
@@ -660,6 +759,7 @@ static void plugin_gen_insn_udata(const struct qemu_plugin_tb *ptb,
 {
     struct qemu_plugin_insn *insn = g_ptr_array_index(ptb->insns, insn_idx);
 
+    inject_cond_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_COND], begin_op);
     inject_udata_cb(insn->cbs[PLUGIN_CB_INSN][PLUGIN_CB_REGULAR], begin_op);
 }
 
@@ -763,6 +863,14 @@ static void plugin_gen_inject(const struct qemu_plugin_tb *plugin_tb)
 
     pr_ops();
 
+    /*
+     * Inline ops and conditional callbacks allocate their temps now, see
+     * gen_ops_after().  A temp that the translator freed at the end of
+     * the TB may still be live where they are injected, so only use new
+     * temps, and those freed by the injected ops themselves.
+     */
+    memset(tcg_ctx->free_temps, 0, sizeof(tcg_ctx->free_temps));
+
     QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
         switch (op->opc) {
         case INDEX_op_insn_start:
@@ -0,0 +1,329 @@
+/*
+ * Superblocks: hot chains of TBs retranslated as a single TB.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/plugin.h"
+#include "exec/exec-all.h"
+#include "exec/translator.h"
+#include "tcg/tcg.h"
+#include "tcg/tcg-op.h"
+#include "internal.h"
+#include "superblock.h"
+
+int32_t superblock_threshold;
+
+void superblock_gen_exec_count(TranslationBlock *tb)
+{
+    TCGOp *last = tcg_last_op();
+    TCGOp *op, *prev;
+    TCGLabel *hot, *done;
+    TCGv_ptr ptr;
+    TCGv_i32 count;
+
+    /*
+     * The hot exit is taken before the first instruction, like the exit
+     * requests checked in gen_tb_start(), so TBs that must not exit there
+     * are not counted.
+     */
+    if (!superblock_threshold ||
+        (tb_cflags(tb) & (CF_NOIRQ | CF_USE_ICOUNT)) ||
+        tb_page_addr0(tb) == -1 || tb_page_addr1(tb) != -1) {
+        tb->exec_count = SUPERBLOCK_NOT_COUNTED;
+        return;
+    }
+    tb->exec_count = superblock_threshold;
+
+    /*
+     * The ops are generated at the end, then moved to the start.  This
+     * way they work the same for TBs loaded from tb-cache.c.  Once the
+     * TB has been considered by superblock_gen(), it is no longer
+     * counted, and must not take the hot exit again.  The count is used
+     * after a branch, so it must be a local temp.
+     */
+    hot = gen_new_label();
+    done = gen_new_label();
+    ptr = tcg_constant_host_ptr(&tb->exec_count);
+    count = tcg_temp_local_new_i32();
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_EQ, count, SUPERBLOCK_NOT_COUNTED, done);
+    tcg_gen_subi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, hot);
+    gen_set_label(done);
+    tcg_temp_free_i32(count);
+
+    for (op = tcg_last_op(); op != last; op = prev) {
+        prev = QTAILQ_PREV(op, link);
+        QTAILQ_REMOVE(&tcg_ctx->ops, op, link);
+        QTAILQ_INSERT_HEAD(&tcg_ctx->ops, op, link);
+    }
+
+    /* See cpu_loop_exec_tb() */
+    gen_set_label(hot);
+    tcg_gen_exit_tb(tb, TB_EXIT_REQUESTED);
+}
+
+bool superblock_gen_ops(CPUState *cpu, TranslationBlock *tb,
+                        const Superblock *sb, void *host_pc)
+{
+    void *host_page = host_pc - (sb->pc & ~TARGET_PAGE_MASK);
+    TCGLabel *labels[SUPERBLOCK_MAX_SEGS] = { };
+    uint32_t cflags = tb->cflags;
+    int i;
+
+    for (i = 0; i < sb->nb_segs; i++) {
+        const SuperblockSeg *seg = &sb->segs[i];
+        int succ = i + 1 < sb->nb_segs ? i + 1 : sb->cycle ? 0 : -1;
+        TCGOp *goto_op = NULL, *exit_op = NULL;
+        TCGOp *op, *next;
+
+        if (i == 0 && sb->cycle) {
+            labels[0] = gen_new_label();
+        }
+        if (labels[i]) {
+            gen_set_label(labels[i]);
+        }
+        op = tcg_last_op();
+
+        /*
+         * Only the first segment checks for exit requests, since they
+         * return to the start of the superblock.  Every cycle goes
+         * through that check.
+         */
+        tb->cflags = i ? cflags | CF_NOIRQ : cflags;
+#ifdef CONFIG_DEBUG_TCG
+        tcg_ctx->goto_tb_issue_mask = 0;
+#endif
+        gen_intermediate_code(cpu, tb, seg->icount, seg->pc,
+                              host_page + (seg->pc & ~TARGET_PAGE_MASK));
+        tb->cflags = cflags;
+
+        if (tb->size != seg->size || tb->icount != seg->icount ||
+            tb_page_addr1(tb) != -1) {
+            return false;
+        }
+
+        for (op = op ? QTAILQ_NEXT(op, link) : QTAILQ_FIRST(&tcg_ctx->ops);
+             op; op = next) {
+            uintptr_t val;
+
+            next = QTAILQ_NEXT(op, link);
+            switch (op->opc) {
+            case INDEX_op_goto_tb:
+                if (succ >= 0 && op->args[0] == seg->slot) {
+                    goto_op = op;
+                } else if (i > 0) {
+                    /* The jump slots belong to the first segment */
+                    tcg_op_remove(tcg_ctx, op);
+                }
+                break;
+            case INDEX_op_exit_tb:
+                val = op->args[0];
+                if (val == 0) {
+                    break;
+                }
+                if (succ >= 0 && (val & TB_EXIT_MASK) == seg->slot) {
+                    exit_op = op;
+                } else if (i > 0) {
+                    /* Exits other than goto_tb ones would sync the pc */
+                    if ((val & TB_EXIT_MASK) > TB_EXIT_IDX1) {
+                        return false;
+                    }
+                    op->args[0] = 0;
+                }
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (succ < 0) {
+            continue;
+        }
+        if (!goto_op || !exit_op) {
+            return false;
+        }
+
+        /*
+         * What runs between goto_tb and exit_tb is what the unchained
+         * path does before the next TB, so keep it.
+         */
+        tcg_op_remove(tcg_ctx, goto_op);
+        if (succ == i + 1 && exit_op == tcg_last_op()) {
+            tcg_op_remove(tcg_ctx, exit_op);
+        } else {
+            if (!labels[succ]) {
+                labels[succ] = gen_new_label();
+            }
+            exit_op->opc = INDEX_op_br;
+            exit_op->args[0] = label_arg(labels[succ]);
+            labels[succ]->refs++;
+        }
+    }
+
+    tb->size = sb->size;
+    tb->icount = sb->icount;
+    return true;
+}
+
+/*
+ * Return the hottest TB that @tb jumps to, that can follow it in a
+ * superblock starting at @hot, and in @slot the jump to it.
+ */
+static TranslationBlock *superblock_next(TranslationBlock *tb,
+                                         TranslationBlock *hot, int *slot)
+{
+    TranslationBlock *best = NULL;
+    int n;
+
+    for (n = 0; n < 2; n++) {
+        uintptr_t dest = qatomic_read(&tb->jmp_dest[n]);
+        TranslationBlock *next = (TranslationBlock *)(dest & ~1);
+
+        if (!next || (dest & 1) ||
+            tb_cflags(next) != tb_cflags(hot) ||
+            next->cs_base != hot->cs_base || next->flags != hot->flags ||
+            next->trace_vcpu_dstate != hot->trace_vcpu_dstate ||
+            (next != hot &&
+             qatomic_read(&next->exec_count) == SUPERBLOCK_NOT_COUNTED) ||
+            ((tb_page_addr0(next) ^ tb_page_addr0(hot)) & TARGET_PAGE_MASK) ||
+            tb_page_addr1(next) != -1) {
+            continue;
+        }
+        if (!best ||
+            qatomic_read(&next->exec_count) < qatomic_read(&best->exec_count)) {
+            best = next;
+            *slot = n;
+        }
+    }
+    return best;
+}
+
+TranslationBlock *superblock_gen(CPUState *cpu, TranslationBlock *hot,
+                                 target_ulong pc)
+{
+    target_ulong page = pc & TARGET_PAGE_MASK;
+    TranslationBlock *tbs[SUPERBLOCK_MAX_SEGS];
+    SuperblockSeg segs[SUPERBLOCK_MAX_SEGS];
+    TranslationBlock *tb, *head, *sb_tb;
+    Superblock sb = { };
+    target_ulong end = 0;
+    uint32_t cflags;
+    int i, n, first, slot;
+
+    assert_memory_lock();
+
+    /*
+     * Whatever the outcome, @hot is not considered again.  Another vCPU
+     * may have seen it hot first.
+     */
+    if (qatomic_xchg(&hot->exec_count, SUPERBLOCK_NOT_COUNTED) >= 0) {
+        return NULL;
+    }
+    cflags = tb_cflags(hot);
+    if (cflags & CF_INVALID) {
+        return NULL;
+    }
+#ifdef CONFIG_PLUGIN
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return NULL;
+    }
+#endif
+
+    /* Follow the hottest jumps until back to @hot, or a dead end */
+    for (n = 0, tb = hot; ; n++) {
+        TranslationBlock *next;
+
+        tbs[n] = tb;
+        segs[n] = (SuperblockSeg) {
+            .pc = page | (tb_page_addr0(tb) & ~TARGET_PAGE_MASK),
+            .size = tb->size,
+            .icount = tb->icount,
+            .slot = -1,
+        };
+        if (n + 1 == SUPERBLOCK_MAX_SEGS) {
+            break;
+        }
+
+        next = superblock_next(tb, hot, &slot);
+        if (next == hot) {
+            segs[n].slot = slot;
+            sb.cycle = true;
+            break;
+        }
+        for (i = 0; i <= n && next; i++) {
+            if (next == tbs[i]) {
+                next = NULL;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        segs[n].slot = slot;
+        tb = next;
+    }
+    n++;
+
+    if (sb.cycle) {
+        /* Start the superblock at the lowest address, see tb->size */
+        first = 0;
+        for (i = 1; i < n; i++) {
+            if (segs[i].pc < segs[first].pc) {
+                first = i;
+            }
+        }
+    } else {
+        /* Only keep what follows @hot in memory */
+        first = 0;
+        for (i = 1; i < n; i++) {
+            if (segs[i].pc < segs[0].pc) {
+                segs[i - 1].slot = -1;
+                n = i;
+                break;
+            }
+        }
+        if (n == 1) {
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        const SuperblockSeg *seg = &segs[(first + i) % n];
+
+        if (sb.icount + seg->icount > TCG_MAX_INSNS) {
+            if (sb.cycle) {
+                return NULL;
+            }
+            break;
+        }
+        sb.segs[i] = *seg;
+        sb.icount += seg->icount;
+        end = MAX(end, seg->pc + seg->size);
+    }
+    sb.nb_segs = i;
+    if (!sb.cycle) {
+        if (sb.nb_segs == 1) {
+            return NULL;
+        }
+        sb.segs[sb.nb_segs - 1].slot = -1;
+    }
+    sb.pc = sb.segs[0].pc;
+    if (end - sb.pc > UINT16_MAX) {
+        return NULL;
+    }
+    sb.size = end - sb.pc;
+
+    /* The superblock takes the place of its first TB */
+    head = tbs[first];
+    tb_phys_invalidate(head, -1);
+
+    qemu_log_mask(CPU_LOG_EXEC, "Superblock at " TARGET_FMT_lx
+                  " of %d TBs%s\n", sb.pc, sb.nb_segs,
+                  sb.cycle ? ", looping" : "");
+    sb_tb = tb_gen_superblock(cpu, &sb, hot->cs_base, hot->flags, cflags);
+    return head == hot ? sb_tb : NULL;
+}
@@ -0,0 +1,83 @@
+/*
+ * Superblocks: hot chains of TBs retranslated as a single TB.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_SUPERBLOCK_H
+#define ACCEL_TCG_SUPERBLOCK_H
+
+#include "exec/exec-all.h"
+#include "internal.h"
+
+/*
+ * When superblock_threshold is non-zero, every TB counts its executions
+ * and exits to the main loop once it has run that many times.  The main
+ * loop then follows the goto_tb links from it (tb->jmp_dest[]) to the
+ * hottest successors, and translates the chain again as one TB, the
+ * superblock, which replaces the first TB of the chain.  Within it, the
+ * former goto_tb exits are plain branches, or fall through to the next
+ * TB of the chain, so the optimizer and the register allocator see
+ * across them and the globals need not be synced at every boundary.
+ *
+ * All TBs of a superblock are on the same page, so that it is
+ * invalidated with any of them.
+ */
+
+#define SUPERBLOCK_MAX_SEGS     8
+
+/*
+ * tb->exec_count of TBs that do not count their executions: superblocks,
+ * TBs that cannot be counted, and TBs already considered as the head of
+ * a superblock.  The counter ops skip the decrement for it, so such a
+ * TB never takes the hot exit.
+ */
+#define SUPERBLOCK_NOT_COUNTED  INT32_MAX
+
+typedef struct SuperblockSeg {
+    target_ulong pc;
+    uint16_t size;
+    uint16_t icount;
+    int slot;           /* goto_tb to the next segment, or -1 */
+} SuperblockSeg;
+
+struct Superblock {
+    target_ulong pc;
+    uint16_t size;
+    uint16_t icount;
+    bool cycle;         /* the last segment jumps back to the first */
+    int nb_segs;
+    SuperblockSeg segs[SUPERBLOCK_MAX_SEGS];
+};
+
+/*
+ * Executions that make a TB hot, or 0 to disable superblocks.  At most
+ * SUPERBLOCK_NOT_COUNTED - 1.
+ */
+extern int32_t superblock_threshold;
+
+/*
+ * Add the execution counter to @tb, after its ops are generated.
+ * Sets tb->exec_count to the number of executions left before it is
+ * hot, or SUPERBLOCK_NOT_COUNTED if @tb is not counted.
+ */
+void superblock_gen_exec_count(TranslationBlock *tb);
+
+/*
+ * Generate the ops of superblock @tb, from @sb, in place of
+ * gen_intermediate_code().  Return false if the segments did not
+ * translate as before, in which case tcg_func_start() must be called
+ * again before translating.
+ */
+bool superblock_gen_ops(CPUState *cpu, TranslationBlock *tb,
+                        const Superblock *sb, void *host_pc);
+
+/*
+ * Form a superblock from the TBs that run after @hot, found at @pc,
+ * which has become hot.  Return the superblock if it starts at @pc.
+ * user-mode: call with mmap_lock held.
+ */
+TranslationBlock *superblock_gen(CPUState *cpu, TranslationBlock *hot,
+                                 target_ulong pc);
+
+#endif
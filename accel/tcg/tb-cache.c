@@ -0,0 +1,375 @@
+/*
+ * Persistent translation cache for user-mode emulation.
+ *
+ * The cache is a file of records appended by any number of processes,
+ * each with a single write(2) so that they do not interleave.  Records
+ * are indexed when the file is opened and checksummed when used, so a
+ * record torn by a crash or a full disk is merely skipped.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/crc32c.h"
+#include "qemu/error-report.h"
+#include "qemu/log.h"
+#include "qemu/plugin.h"
+#include "qemu/xxhash.h"
+#include "exec/exec-all.h"
+#include "exec/cpu_ldst.h"
+#include "exec/translate-all.h"
+#include "tcg/tcg.h"
+#include "tb-cache.h"
+#include "trace.h"
+
+#define TB_CACHE_MAGIC          0x31434254      /* "TBC1" */
+
+/* Stop adding TBs past this size; remove the file to start over */
+#define TB_CACHE_MAX_SIZE       (1 * GiB)
+
+/* Write out the TBs added by this process in chunks of this size */
+#define TB_CACHE_FLUSH_SIZE     (1 * MiB)
+
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t max_insns;
+    uint32_t pad;
+} TBCacheKey;
+
+typedef struct TBCacheHeader {
+    uint32_t magic;
+    uint32_t size;          /* of the whole record */
+    uint32_t crc;           /* crc32c of the record after this field */
+    uint32_t guest_size;    /* of the guest code that follows */
+    TBCacheKey key;
+    uint32_t ops_size;      /* of the ops that follow the guest code */
+    uint16_t icount;
+    uint8_t two_pages;      /* the TB uses the page after pc's */
+    uint8_t pad;
+} TBCacheHeader;
+
+typedef struct TBCacheEntry {
+    TBCacheKey key;
+    const uint8_t *record;          /* possibly unaligned */
+    struct TBCacheEntry *next;      /* older record with the same key */
+} TBCacheEntry;
+
+static struct {
+    char *path;
+    const uint8_t *map;
+    size_t map_size;
+    GHashTable *entries;            /* TBCacheKey -> newest TBCacheEntry */
+    bool writable;
+    size_t size;                    /* of the file, including pending */
+    GByteArray *pending;            /* records not written yet */
+    pid_t pending_pid;              /* the process that added them */
+} tb_cache;
+
+static guint tb_cache_key_hash(gconstpointer p)
+{
+    const TBCacheKey *k = p;
+
+    return qemu_xxhash7(k->pc, k->cs_base, k->flags, k->cflags, k->max_insns);
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheKey *ka = a, *kb = b;
+
+    return ka->pc == kb->pc && ka->cs_base == kb->cs_base &&
+           ka->flags == kb->flags && ka->cflags == kb->cflags &&
+           ka->max_insns == kb->max_insns;
+}
+
+static void tb_cache_insert(const uint8_t *record, const TBCacheKey *key)
+{
+    TBCacheEntry *e = g_new(TBCacheEntry, 1);
+
+    e->key = *key;
+    e->record = record;
+    e->next = g_hash_table_lookup(tb_cache.entries, &e->key);
+    g_hash_table_replace(tb_cache.entries, &e->key, e);
+}
+
+static void tb_cache_index(void)
+{
+    size_t off = 0;
+
+    while (tb_cache.map_size - off >= sizeof(TBCacheHeader)) {
+        TBCacheHeader hdr;
+
+        memcpy(&hdr, tb_cache.map + off, sizeof(hdr));
+        if (hdr.magic != TB_CACHE_MAGIC || hdr.size < sizeof(hdr) ||
+            hdr.size > tb_cache.map_size - off ||
+            (uint64_t)hdr.guest_size + hdr.ops_size != hdr.size - sizeof(hdr)) {
+            /* Resynchronize after a torn record */
+            off++;
+            continue;
+        }
+        tb_cache_insert(tb_cache.map + off, &hdr.key);
+        off += hdr.size;
+    }
+}
+
+void tb_cache_init(const char *dir, const char *cpu_model)
+{
+    g_autofree char *id = NULL;
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    const char *checksum;
+    struct stat st;
+    int fd;
+
+    /*
+     * The ops refer to helpers and to CPUArchState fields, and depend on
+     * the CPU features, so the file is specific to the QEMU binary, as
+     * identified by its inode and modification time, and to the CPU.
+     * They also depend on what the host supports, which may differ
+     * between hosts that share a cache directory.
+     */
+    if (stat("/proc/self/exe", &st) < 0) {
+        warn_report("Could not identify the QEMU binary: %s, "
+                    "proceeding without translation cache", strerror(errno));
+        return;
+    }
+    id = g_strdup_printf("%s %" PRIu64 " %" PRIu64 " %" PRId64 " %" PRId64
+                         ".%09ld %s", TARGET_NAME,
+                         (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                         (int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec,
+                         st.st_mtim.tv_nsec, cpu_model);
+    g_checksum_update(sum, (guchar *)id, -1);
+    tcg_host_features_checksum(sum);
+    checksum = g_checksum_get_string(sum);
+
+    if (g_mkdir_with_parents(dir, 0777) < 0) {
+        warn_report("Could not create %s: %s, "
+                    "proceeding without translation cache",
+                    dir, strerror(errno));
+        return;
+    }
+    tb_cache.path = g_strdup_printf("%s/qemu-%s-%.16s.tbc",
+                                    dir, TARGET_NAME, checksum);
+
+    /* A read-only cache, e.g. one shared by CI runners, is still used */
+    fd = open(tb_cache.path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd >= 0) {
+        tb_cache.writable = true;
+    } else {
+        fd = open(tb_cache.path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        warn_report("Could not open %s: %s, "
+                    "proceeding without translation cache",
+                    tb_cache.path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    tb_cache.entries = g_hash_table_new(tb_cache_key_hash, tb_cache_key_equal);
+    tb_cache.size = st.st_size;
+    if (st.st_size) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (map == MAP_FAILED) {
+            warn_report("Could not map %s: %s, "
+                        "proceeding with an empty translation cache",
+                        tb_cache.path, strerror(errno));
+        } else {
+            tb_cache.map = map;
+            tb_cache.map_size = st.st_size;
+            tb_cache_index();
+        }
+    }
+
+    /*
+     * The guest may close or reuse any file descriptor, so the file is
+     * only opened again for the duration of tb_cache_flush().
+     */
+    close(fd);
+
+    if (tb_cache.size >= TB_CACHE_MAX_SIZE) {
+        tb_cache.writable = false;
+    }
+    tb_cache.pending = g_byte_array_new();
+}
+
+/* Check @e against the guest code and load it into @tb. */
+static bool tb_cache_load_entry(TBCacheEntry *e, TranslationBlock *tb,
+                                target_ulong pc)
+{
+    const size_t crc_offset = offsetof(TBCacheHeader, guest_size);
+    target_ulong page1 = (pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+    const uint8_t *code = e->record + sizeof(TBCacheHeader);
+    TBCacheHeader hdr;
+
+    memcpy(&hdr, e->record, sizeof(hdr));
+
+    if (hdr.guest_size == 0 ||
+        (!hdr.two_pages && pc + hdr.guest_size - 1 >= page1) ||
+        page_check_range(pc, hdr.guest_size, PAGE_EXEC) < 0 ||
+        (hdr.two_pages && page_check_range(page1, 1, PAGE_EXEC) < 0)) {
+        return false;
+    }
+
+    /* As in translator_loop(), catch writes before reading the code */
+    page_protect(pc);
+    if (hdr.two_pages) {
+        page_protect(page1);
+    }
+
+    if (memcmp(g2h_untagged(pc), code, hdr.guest_size) ||
+        crc32c(0xffffffff, e->record + crc_offset, hdr.size - crc_offset)
+        != hdr.crc) {
+        return false;
+    }
+
+    if (!tcg_ops_load(tcg_ctx, tb, code + hdr.guest_size, hdr.ops_size)) {
+        tcg_func_start(tcg_ctx);
+        return false;
+    }
+
+    tb->size = hdr.guest_size;
+    tb->icount = hdr.icount;
+    if (hdr.two_pages) {
+        tb_set_page_addr1(tb, page1);
+    }
+    return true;
+}
+
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, target_ulong pc,
+                   int max_insns)
+{
+    TBCacheKey key = {
+        .pc = pc,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb->cflags,
+        .max_insns = max_insns,
+    };
+    TBCacheEntry *e;
+
+    if (!tb_cache.entries) {
+        return false;
+    }
+
+    /* The front end must run to log the guest code or to call plugins */
+    if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
+        return false;
+    }
+#ifdef CONFIG_PLUGIN
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return false;
+    }
+#endif
+
+    for (e = g_hash_table_lookup(tb_cache.entries, &key); e; e = e->next) {
+        if (tb_cache_load_entry(e, tb, pc)) {
+            trace_tb_cache_hit(pc);
+            return true;
+        }
+    }
+    trace_tb_cache_miss(pc);
+    return false;
+}
+
+void tb_cache_store(TranslationBlock *tb, target_ulong pc, int max_insns)
+{
+    const size_t crc_offset = offsetof(TBCacheHeader, guest_size);
+    GByteArray *buf;
+    TBCacheHeader hdr = {
+        .magic = TB_CACHE_MAGIC,
+        .guest_size = tb->size,
+        .key = {
+            .pc = pc,
+            .cs_base = tb->cs_base,
+            .flags = tb->flags,
+            .cflags = tb->cflags,
+            .max_insns = max_insns,
+        },
+        .icount = tb->icount,
+        .two_pages = tb_page_addr1(tb) != -1,
+    };
+    uint8_t *record;
+
+    if (!tb_cache.writable) {
+        return;
+    }
+
+    buf = g_byte_array_sized_new(4096);
+    g_byte_array_append(buf, (guint8 *)&hdr, sizeof(hdr));
+    g_byte_array_append(buf, g2h_untagged(pc), tb->size);
+    if (!tcg_ops_save(tcg_ctx, tb, buf)) {
+        g_byte_array_free(buf, true);
+        return;
+    }
+
+    hdr.size = buf->len;
+    hdr.ops_size = buf->len - sizeof(hdr) - tb->size;
+    memcpy(buf->data, &hdr, sizeof(hdr));
+    hdr.crc = crc32c(0xffffffff, buf->data + crc_offset,
+                     buf->len - crc_offset);
+    memcpy(buf->data, &hdr, sizeof(hdr));
+
+    if (tb_cache.size + buf->len > TB_CACHE_MAX_SIZE) {
+        tb_cache.writable = false;
+        g_byte_array_free(buf, true);
+        return;
+    }
+    tb_cache.size += buf->len;
+
+    /* Records inherited across fork() belong to the parent */
+    if (tb_cache.pending_pid != getpid()) {
+        g_byte_array_set_size(tb_cache.pending, 0);
+        tb_cache.pending_pid = getpid();
+    }
+    g_byte_array_append(tb_cache.pending, buf->data, buf->len);
+
+    /* Let this process find the TB again, e.g. after a tb_flush() */
+    record = g_byte_array_free(buf, false);
+    tb_cache_insert(record, &hdr.key);
+
+    if (tb_cache.pending->len >= TB_CACHE_FLUSH_SIZE) {
+        tb_cache_flush();
+    }
+}
+
+void tb_cache_flush(void)
+{
+    ssize_t ret;
+    int fd;
+
+    if (!tb_cache.pending) {
+        return;
+    }
+
+    mmap_lock();
+    if (tb_cache.pending_pid != getpid() || tb_cache.pending->len == 0) {
+        goto out;
+    }
+
+    fd = open(tb_cache.path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        warn_report("Could not open %s: %s", tb_cache.path, strerror(errno));
+        tb_cache.writable = false;
+        goto out;
+    }
+
+    /* A single write, so that records from other processes do not mix */
+    do {
+        ret = write(fd, tb_cache.pending->data, tb_cache.pending->len);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != tb_cache.pending->len) {
+        warn_report("Could not write to %s: %s", tb_cache.path,
+                    ret < 0 ? strerror(errno) : "short write");
+        tb_cache.writable = false;
+    }
+    close(fd);
+
+out:
+    g_byte_array_set_size(tb_cache.pending, 0);
+    mmap_unlock();
+}
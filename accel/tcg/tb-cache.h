@@ -0,0 +1,48 @@
+/*
+ * Persistent translation cache for user-mode emulation.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_CACHE_H
+#define ACCEL_TCG_TB_CACHE_H
+
+/*
+ * The cache keeps the TCG ops generated by the front end for each TB,
+ * across runs of the same QEMU binary with the same CPU model and host
+ * CPU features.  A TB is found by pc, cs_base, flags, cflags and the
+ * maximum number of guest instructions, and is only used if the guest
+ * code is unchanged; its ops then replace gen_intermediate_code(), while
+ * optimization and code generation run as usual.
+ */
+
+#ifdef CONFIG_USER_ONLY
+/* Use a cache in @dir for @cpu_model.  Called after tcg_prologue_init(). */
+void tb_cache_init(const char *dir, const char *cpu_model);
+
+/*
+ * Fill @tb, right after tcg_func_start(), from the cache.  Return false
+ * if @tb must be translated instead.
+ */
+bool tb_cache_load(CPUState *cpu, TranslationBlock *tb, target_ulong pc,
+                   int max_insns);
+
+/* Add @tb, right after gen_intermediate_code(), to the cache. */
+void tb_cache_store(TranslationBlock *tb, target_ulong pc, int max_insns);
+
+/* Write out the TBs added by this process; called at exit and execve. */
+void tb_cache_flush(void);
+#else
+static inline bool tb_cache_load(CPUState *cpu, TranslationBlock *tb,
+                                 target_ulong pc, int max_insns)
+{
+    return false;
+}
+
+static inline void tb_cache_store(TranslationBlock *tb, target_ulong pc,
+                                  int max_insns)
+{
+}
+#endif
+
+#endif
@@ -37,6 +37,7 @@
 #include "hw/boards.h"
 #endif
 #include "internal.h"
+#include "superblock.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -44,6 +45,8 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t superblock_threshold;
+    bool cse_enabled;
 };
 typedef struct TCGState TCGState;
 
@@ -121,6 +124,9 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    superblock_threshold = MIN(s->superblock_threshold,
+                               SUPERBLOCK_NOT_COUNTED - 1);
+    tcg_optimize_cse = s->cse_enabled;
 
     page_init();
     tb_htable_init();
@@ -196,6 +202,42 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->superblock_threshold = value;
+}
+
+static bool tcg_get_cse(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->cse_enabled;
+}
+
+static void tcg_set_cse(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->cse_enabled = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -241,6 +283,17 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "superblock-threshold", "uint32",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions that make a TB the head of a superblock (0: off)");
+
+    object_class_property_add_bool(oc, "cse",
+        tcg_get_cse, tcg_set_cse);
+    object_class_property_set_description(oc, "cse",
+        "Eliminate redundant TCG ops and dead stores to the CPU state");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
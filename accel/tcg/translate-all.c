@@ -62,6 +62,9 @@
 #include "tb-hash.h"
 #include "tb-context.h"
 #include "internal.h"
+#include "perf.h"
+#include "tb-cache.h"
+#include "superblock.h"
 
 /* make various TB consistency checks */
 
@@ -742,10 +745,14 @@ void page_collection_unlock(struct page_collection *set)
 
 #endif /* !CONFIG_USER_ONLY */
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              uint32_t flags, int cflags)
+/*
+ * Translate the TB at @pc, or superblock @sb if not NULL.
+ * Called with mmap_lock held for user mode emulation.
+ */
+static TranslationBlock *tb_gen_code_common(CPUState *cpu, target_ulong pc,
+                                            target_ulong cs_base,
+                                            uint32_t flags, int cflags,
+                                            const Superblock *sb)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb, *existing_tb;
@@ -813,7 +820,20 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tcg_func_start(tcg_ctx);
 
     tcg_ctx->cpu = env_cpu(env);
-    gen_intermediate_code(cpu, tb, max_insns, pc, host_pc);
+    if (sb && !superblock_gen_ops(cpu, tb, sb, host_pc)) {
+        /* The guest code changed under us; translate the first TB alone */
+        tcg_func_start(tcg_ctx);
+        sb = NULL;
+    }
+    if (sb) {
+        tb->exec_count = SUPERBLOCK_NOT_COUNTED;
+    } else {
+        if (!tb_cache_load(cpu, tb, pc, max_insns)) {
+            gen_intermediate_code(cpu, tb, max_insns, pc, host_pc);
+            tb_cache_store(tb, pc, max_insns);
+        }
+        superblock_gen_exec_count(tb);
+    }
     assert(tb->size != 0);
     tcg_ctx->cpu = NULL;
     max_insns = tb->icount;
@@ -867,7 +887,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
              *
              * Try again with half as many insns as we attempted this time.
              * If a single insn overflows, there's a bug somewhere...
+             * A superblock is abandoned for its first TB instead.
              */
+            if (sb) {
+                sb = NULL;
+                max_insns = cflags & CF_COUNT_MASK;
+                if (max_insns == 0) {
+                    max_insns = TCG_MAX_INSNS;
+                }
+                goto tb_overflow;
+            }
             assert(max_insns > 1);
             max_insns /= 2;
             qemu_log_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT,
@@ -994,6 +1023,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      * before attempting to link to other TBs or add to the lookup table.
      */
     if (tb_page_addr0(tb) == -1) {
+        perf_report_code(pc, tb->size, tb->tc.ptr, tb->tc.size);
         return tb;
     }
 
@@ -1018,9 +1048,26 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+    perf_report_code(pc, tb->size, tb->tc.ptr, tb->tc.size);
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              uint32_t flags, int cflags)
+{
+    return tb_gen_code_common(cpu, pc, cs_base, flags, cflags, NULL);
+}
+
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_superblock(CPUState *cpu, const Superblock *sb,
+                                    target_ulong cs_base, uint32_t flags,
+                                    int cflags)
+{
+    return tb_gen_code_common(cpu, sb->pc, cs_base, flags, cflags, sb);
+}
+
 /* user-mode: call with mmap_lock held */
 void tb_check_watchpoint(CPUState *cpu, uintptr_t retaddr)
 {
@@ -425,6 +425,7 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_mutex_init(&bs->bsc_modify_lock);
     bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    qemu_mutex_init(&bs->alloc_status_cache.lock);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -1441,6 +1442,7 @@ static void bdrv_child_cb_attach(BdrvChild *child)
 
     assert_bdrv_graph_writable(bs);
     QLIST_INSERT_HEAD(&bs->children, child, next);
+    bdrv_asc_clear(bs);
     if (bs->drv->is_filter || (child->role & BDRV_CHILD_FILTERED)) {
         /*
          * Here we handle filters and block/raw-format.c when it behave like
@@ -1491,6 +1493,7 @@ static void bdrv_child_cb_detach(BdrvChild *child)
 
     assert_bdrv_graph_writable(bs);
     QLIST_REMOVE(child, next);
+    bdrv_asc_clear(bs);
     if (child == bs->backing) {
         assert(child != bs->file);
         bs->backing = NULL;
@@ -4925,6 +4928,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->full_open_options = NULL;
     g_free(bs->block_status_cache);
     bs->block_status_cache = NULL;
+    bdrv_asc_clear(bs);
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -5290,6 +5294,7 @@ static void bdrv_delete(BlockDriverState *bs)
 
     bdrv_close(bs);
 
+    qemu_mutex_destroy(&bs->alloc_status_cache.lock);
     g_free(bs);
 }
 
@@ -6273,6 +6278,24 @@ int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return 0;
 }
 
+/*
+ * Return the host file descriptor holding the data of @bs, as described
+ * for BlockDriver.bdrv_get_host_fd, or a negative errno value.  Filters
+ * are not skipped, because reading the file directly would bypass them.
+ */
+int bdrv_get_host_fd(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+    IO_CODE();
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    if (!drv->bdrv_get_host_fd) {
+        return -ENOTSUP;
+    }
+    return drv->bdrv_get_host_fd(bs);
+}
+
 ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs,
                                           Error **errp)
 {
@@ -6579,6 +6602,7 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
 
     assert(!(bs->open_flags & BDRV_O_INACTIVE));
 
+    bdrv_asc_clear(bs);
     if (bs->drv->bdrv_co_invalidate_cache) {
         bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
         if (local_err) {
@@ -7921,6 +7945,7 @@ int bdrv_make_empty(BdrvChild *c, Error **errp)
     }
 
     ret = drv->bdrv_make_empty(c->bs);
+    bdrv_asc_clear(c->bs);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Failed to empty %s",
                          c->bs->filename);
@@ -8165,3 +8190,115 @@ void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
         g_free_rcu(old_bsc, rcu);
     }
 }
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+bool bdrv_asc_lookup(BlockDriverState *bs, int64_t offset, int *status,
+                     int64_t *pnum, int64_t *map, BlockDriverState **file)
+{
+    BdrvAllocStatusCache *asc = &bs->alloc_status_cache;
+    int i;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&asc->lock);
+
+    for (i = 0; i < BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        BdrvAllocStatusExtent *e = &asc->extents[i];
+
+        if (e->bytes && offset >= e->offset &&
+            offset - e->offset < e->bytes) {
+            *status = e->status;
+            *pnum = e->offset + e->bytes - offset;
+            *map = e->map;
+            if (e->status & BDRV_BLOCK_OFFSET_VALID) {
+                *map += offset - e->offset;
+            }
+            *file = e->file;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void bdrv_asc_invalidate_range_locked(BdrvAllocStatusCache *asc,
+                                             int64_t offset, int64_t bytes)
+{
+    int i;
+
+    for (i = 0; i < BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        BdrvAllocStatusExtent *e = &asc->extents[i];
+
+        if (e->bytes && ranges_overlap(offset, bytes, e->offset, e->bytes)) {
+            e->bytes = 0;
+        }
+    }
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_asc_fill(BlockDriverState *bs, unsigned int write_gen,
+                   int64_t offset, int64_t bytes, int status, int64_t map,
+                   BlockDriverState *file)
+{
+    BdrvAllocStatusCache *asc = &bs->alloc_status_cache;
+    BdrvAllocStatusExtent *e = NULL;
+    int i;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&asc->lock);
+
+    /* A write completed while the driver was looking up the status */
+    if (qatomic_read(&bs->write_gen) != write_gen) {
+        return;
+    }
+
+    bdrv_asc_invalidate_range_locked(asc, offset, bytes);
+    for (i = 0; i < BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        if (!asc->extents[i].bytes) {
+            e = &asc->extents[i];
+            break;
+        }
+    }
+    if (!e) {
+        e = &asc->extents[asc->next];
+        asc->next = (asc->next + 1) % BDRV_ALLOC_STATUS_CACHE_EXTENTS;
+    }
+
+    *e = (BdrvAllocStatusExtent) {
+        .offset = offset,
+        .bytes = bytes,
+        .status = status,
+        .map = map,
+        .file = file,
+    };
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_asc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes)
+{
+    BdrvAllocStatusCache *asc = &bs->alloc_status_cache;
+    IO_CODE();
+
+    QEMU_LOCK_GUARD(&asc->lock);
+    bdrv_asc_invalidate_range_locked(asc, offset, bytes);
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_asc_clear(BlockDriverState *bs)
+{
+    BdrvAllocStatusCache *asc = &bs->alloc_status_cache;
+    int i;
+
+    QEMU_LOCK_GUARD(&asc->lock);
+    for (i = 0; i < BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        asc->extents[i].bytes = 0;
+    }
+}
@@ -0,0 +1,1325 @@
+/*
+ * Block cache filter driver
+ *
+ * Keeps the data of recently used clusters of its child in a bounded
+ * cache, either in host memory or on a local "store" node, so that hot
+ * data does not have to be read again from slow (typically remote)
+ * storage.  In write-back mode, writes are absorbed by the cache too and
+ * reach the child on flush, or when their cluster is evicted.
+ *
+ * The contents of the store node are not preserved across opens; which
+ * clusters are cached is only known while the filter node is open.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/range.h"
+#include "qemu/units.h"
+#include "block/aio_task.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define BLKCACHE_MAX_WORKERS 8
+
+#define BLKCACHE_OPT_SIZE "size"
+#define BLKCACHE_OPT_CLUSTER_SIZE "cluster-size"
+#define BLKCACHE_OPT_WRITE_BACK "write-back"
+
+typedef struct BlkcacheEntry {
+    int64_t offset;     /* guest offset of the cluster, hash table key */
+    int64_t slot;       /* index of the cache slot that holds the data */
+
+    /*
+     * The slot is being filled, either from the child or by a write
+     * that covers the whole cluster.  Nobody else may access the slot.
+     */
+    bool loading;
+
+    /*
+     * The data is outdated or about to be: drop the entry as soon as it
+     * becomes idle, and do not hand it to new users.
+     */
+    bool stale;
+
+    /* The data is newer than the child's, only in write-back mode */
+    bool dirty;
+
+    /* The data is being written to the child, the slot must not change */
+    bool writing_back;
+
+    /* Number of requests reading from or writing to the slot */
+    int users;
+
+    QTAILQ_ENTRY(BlkcacheEntry) lru;
+} BlkcacheEntry;
+
+/* A request that modifies the child's data without going through the cache */
+typedef struct BlkcacheWrite {
+    int64_t offset;
+    int64_t bytes;
+    QLIST_ENTRY(BlkcacheWrite) next;
+} BlkcacheWrite;
+
+typedef struct BDRVBlkcacheState {
+    BdrvChild *store;       /* NULL if the cache is in host memory */
+    uint8_t *buf;           /* the cache in host memory, if !store */
+    int64_t cluster_size;
+    int64_t nr_slots;
+    bool write_back;
+
+    /* Protects everything below */
+    CoMutex lock;
+
+    /* Woken up whenever an entry becomes idle or is dropped */
+    CoQueue queue;
+
+    GHashTable *entries;    /* cluster offset -> BlkcacheEntry */
+    QTAILQ_HEAD(, BlkcacheEntry) lru; /* most recently used first */
+    unsigned long *used_slots;
+    int64_t nr_used;
+    int64_t nr_dirty;
+    QLIST_HEAD(, BlkcacheWrite) writes;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t write_backs;
+} BDRVBlkcacheState;
+
+static QemuOptsList runtime_opts = {
+    .name = "blkcache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = BLKCACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "size of the cache, default 64M, or the size of the "
+                "store node",
+        },
+        {
+            .name = BLKCACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "unit of caching, default 64k",
+        },
+        {
+            .name = BLKCACHE_OPT_WRITE_BACK,
+            .type = QEMU_OPT_BOOL,
+            .help = "keep written data in the cache until flush, "
+                "default off",
+        },
+        { /* end of list */ }
+    },
+};
+
+static int blkcache_open(BlockDriverState *bs, QDict *options, int flags,
+                         Error **errp)
+{
+    ERRP_GUARD();
+    BDRVBlkcacheState *s = bs->opaque;
+    BdrvChildRole file_role;
+    QemuOpts *opts;
+    uint64_t size;
+    int64_t store_size;
+    int ret;
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    s->cluster_size = qemu_opt_get_size(opts, BLKCACHE_OPT_CLUSTER_SIZE,
+                                        64 * KiB);
+    s->write_back = qemu_opt_get_bool(opts, BLKCACHE_OPT_WRITE_BACK, false);
+    size = qemu_opt_get_size(opts, BLKCACHE_OPT_SIZE, 0);
+
+    /*
+     * In write-through mode, the child always has the same data as this
+     * node, like with a filter.  In write-back mode, it does not, and
+     * skipping this node, e.g. to query the allocation status, would miss
+     * the dirty clusters.  As with raw, only the role of the child tells
+     * them apart, since the driver is not a filter.
+     */
+    if (s->write_back) {
+        file_role = BDRV_CHILD_DATA | BDRV_CHILD_PRIMARY;
+    } else {
+        file_role = BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY;
+    }
+
+    bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
+                    file_role, false, errp);
+    if (!bs->file) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    s->store = bdrv_open_child(NULL, options, "store", bs, &child_of_bds,
+                               BDRV_CHILD_DATA, true, errp);
+    if (*errp) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (s->cluster_size < BDRV_SECTOR_SIZE || s->cluster_size > 2 * MiB ||
+        !is_power_of_2(s->cluster_size)) {
+        error_setg(errp, "cluster-size must be a power of two between %llu "
+                   "and 2M", BDRV_SECTOR_SIZE);
+        ret = -EINVAL;
+        goto out;
+    }
+
+    store_size = 0;
+    if (s->store) {
+        if (bdrv_is_read_only(s->store->bs)) {
+            error_setg(errp, "The store node of the blkcache filter must be "
+                       "writable");
+            ret = -EINVAL;
+            goto out;
+        }
+        store_size = bdrv_getlength(s->store->bs);
+        if (store_size < 0) {
+            error_setg_errno(errp, -store_size,
+                             "Could not get the size of the store node");
+            ret = store_size;
+            goto out;
+        }
+    }
+    if (!size) {
+        size = s->store ? store_size : 64 * MiB;
+    }
+
+    s->nr_slots = size / s->cluster_size;
+    if (!s->nr_slots || s->nr_slots > INT_MAX) {
+        error_setg(errp, "The cache must have between 1 and %d clusters",
+                   INT_MAX);
+        ret = -EINVAL;
+        goto out;
+    }
+    if (s->store && store_size < s->nr_slots * s->cluster_size) {
+        error_setg(errp, "The store node is smaller than the cache size");
+        ret = -EINVAL;
+        goto out;
+    }
+
+    if (!s->store) {
+        s->buf = qemu_try_blockalign(bs->file->bs,
+                                     s->nr_slots * s->cluster_size);
+        if (!s->buf) {
+            error_setg(errp, "Could not allocate %" PRId64 " bytes for the "
+                       "cache", s->nr_slots * s->cluster_size);
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+
+    s->used_slots = bitmap_new(s->nr_slots);
+    s->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                       NULL, g_free);
+    QTAILQ_INIT(&s->lru);
+    QLIST_INIT(&s->writes);
+    qemu_co_mutex_init(&s->lock);
+    qemu_co_queue_init(&s->queue);
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    ret = 0;
+out:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void blkcache_close(BlockDriverState *bs)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+
+    /* bdrv_close() has flushed the node, unless writing back failed */
+    if (s->nr_dirty) {
+        error_report("blkcache: %" PRId64 " dirty clusters of '%s' were not "
+                     "written back", s->nr_dirty,
+                     bdrv_get_device_or_node_name(bs));
+    }
+
+    g_hash_table_destroy(s->entries);
+    g_free(s->used_slots);
+    qemu_vfree(s->buf);
+}
+
+/*
+ * Options cannot be changed, but reopening must work for the nodes
+ * around the filter; bdrv_reopen_prepare() rejects new values.
+ */
+static int blkcache_reopen_prepare(BDRVReopenState *reopen_state,
+                                   BlockReopenQueue *queue, Error **errp)
+{
+    return 0;
+}
+
+static int64_t blkcache_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static bool blkcache_entry_idle(BlkcacheEntry *e)
+{
+    return !e->loading && !e->writing_back && !e->users;
+}
+
+static BlkcacheEntry *blkcache_find_entry(BDRVBlkcacheState *s,
+                                          int64_t cluster)
+{
+    return g_hash_table_lookup(s->entries, &cluster);
+}
+
+static void blkcache_drop_entry(BDRVBlkcacheState *s, BlkcacheEntry *e)
+{
+    assert(blkcache_entry_idle(e));
+
+    if (e->dirty) {
+        s->nr_dirty--;
+    }
+    clear_bit(e->slot, s->used_slots);
+    s->nr_used--;
+    QTAILQ_REMOVE(&s->lru, e, lru);
+    g_hash_table_remove(s->entries, &e->offset);
+}
+
+/* Drop @e if it is stale and nobody uses it anymore */
+static void blkcache_release_entry(BDRVBlkcacheState *s, BlkcacheEntry *e)
+{
+    if (e->stale && blkcache_entry_idle(e)) {
+        blkcache_drop_entry(s, e);
+    }
+    qemu_co_queue_restart_all(&s->queue);
+}
+
+static void blkcache_put_entry(BDRVBlkcacheState *s, BlkcacheEntry *e)
+{
+    assert(e->users > 0);
+    e->users--;
+    blkcache_release_entry(s, e);
+}
+
+static bool blkcache_write_in_flight(BDRVBlkcacheState *s,
+                                     int64_t offset, int64_t bytes)
+{
+    BlkcacheWrite *w;
+
+    QLIST_FOREACH(w, &s->writes, next) {
+        if (ranges_overlap(offset, bytes, w->offset, w->bytes)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Return the entries that overlap [offset, offset + bytes) and are not
+ * stale.  The result is only valid until s->lock is dropped.
+ */
+static GPtrArray *blkcache_overlapping_entries(BDRVBlkcacheState *s,
+                                              int64_t offset, int64_t bytes)
+{
+    GPtrArray *entries = g_ptr_array_new();
+    BlkcacheEntry *e;
+    int64_t cluster;
+
+    if (bytes / s->cluster_size < g_hash_table_size(s->entries)) {
+        for (cluster = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+             cluster < offset + bytes;
+             cluster += s->cluster_size)
+        {
+            e = blkcache_find_entry(s, cluster);
+            if (e && !e->stale) {
+                g_ptr_array_add(entries, e);
+            }
+        }
+    } else {
+        QTAILQ_FOREACH(e, &s->lru, lru) {
+            if (!e->stale &&
+                ranges_overlap(offset, bytes, e->offset, s->cluster_size)) {
+                g_ptr_array_add(entries, e);
+            }
+        }
+    }
+
+    return entries;
+}
+
+/*
+ * Add an entry for the cluster at @cluster, evicting the least recently
+ * used clean and idle entry if all slots are used.  Return NULL if there
+ * is no such entry.
+ */
+static BlkcacheEntry *blkcache_new_entry(BlockDriverState *bs,
+                                         int64_t cluster)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheEntry *e;
+    int64_t slot;
+
+    if (s->nr_used < s->nr_slots) {
+        slot = find_first_zero_bit(s->used_slots, s->nr_slots);
+    } else {
+        QTAILQ_FOREACH_REVERSE(e, &s->lru, lru) {
+            if (blkcache_entry_idle(e) && !e->dirty) {
+                break;
+            }
+        }
+        if (!e) {
+            return NULL;
+        }
+
+        trace_blkcache_evict(bs, e->offset, e->slot);
+        slot = e->slot;
+        blkcache_drop_entry(s, e);
+        s->evictions++;
+    }
+
+    set_bit(slot, s->used_slots);
+    s->nr_used++;
+
+    e = g_new0(BlkcacheEntry, 1);
+    e->offset = cluster;
+    e->slot = slot;
+    g_hash_table_insert(s->entries, &e->offset, e);
+    QTAILQ_INSERT_HEAD(&s->lru, e, lru);
+
+    return e;
+}
+
+/* Return the least recently used dirty entry that can be written back */
+static BlkcacheEntry *blkcache_dirty_victim(BDRVBlkcacheState *s)
+{
+    BlkcacheEntry *e;
+
+    QTAILQ_FOREACH_REVERSE(e, &s->lru, lru) {
+        if (e->dirty && blkcache_entry_idle(e)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static uint8_t *blkcache_slot_ptr(BDRVBlkcacheState *s, BlkcacheEntry *e)
+{
+    return s->buf + e->slot * s->cluster_size;
+}
+
+/* Copy @bytes at @offset in the cluster of @e into @qiov */
+static int coroutine_fn blkcache_co_slot_read(BDRVBlkcacheState *s,
+                                              BlkcacheEntry *e,
+                                              int64_t offset, int64_t bytes,
+                                              QEMUIOVector *qiov,
+                                              size_t qiov_offset)
+{
+    if (!s->store) {
+        qemu_iovec_from_buf(qiov, qiov_offset,
+                            blkcache_slot_ptr(s, e) + offset, bytes);
+        return 0;
+    }
+
+    return bdrv_co_preadv_part(s->store, e->slot * s->cluster_size + offset,
+                               bytes, qiov, qiov_offset, 0);
+}
+
+/* Copy @bytes of @qiov to @offset in the cluster of @e */
+static int coroutine_fn blkcache_co_slot_write(BDRVBlkcacheState *s,
+                                               BlkcacheEntry *e,
+                                               int64_t offset, int64_t bytes,
+                                               QEMUIOVector *qiov,
+                                               size_t qiov_offset)
+{
+    if (!s->store) {
+        qemu_iovec_to_buf(qiov, qiov_offset,
+                          blkcache_slot_ptr(s, e) + offset, bytes);
+        return 0;
+    }
+
+    return bdrv_co_pwritev_part(s->store, e->slot * s->cluster_size + offset,
+                                bytes, qiov, qiov_offset, 0);
+}
+
+/* Return the number of bytes of the image in the cluster of @e */
+static int64_t blkcache_entry_bytes(BlockDriverState *bs, BlkcacheEntry *e)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    int64_t len = bdrv_getlength(bs->file->bs);
+
+    if (len < 0) {
+        return len;
+    }
+    if (len <= e->offset) {
+        return -EIO;
+    }
+    return MIN(len - e->offset, s->cluster_size);
+}
+
+/*
+ * Read the cluster of @e from the child.  Called with s->lock held, which
+ * is dropped during I/O.  @e is dropped on failure, or if a write to the
+ * child raced with loading it.
+ */
+static int coroutine_fn blkcache_co_load(BlockDriverState *bs,
+                                         BlkcacheEntry *e)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    QEMUIOVector qiov;
+    int64_t bytes;
+    void *buf = NULL;
+    int ret;
+
+    assert(e->loading);
+    e->stale = blkcache_write_in_flight(s, e->offset, s->cluster_size);
+    qemu_co_mutex_unlock(&s->lock);
+
+    bytes = blkcache_entry_bytes(bs, e);
+    if (bytes < 0) {
+        ret = bytes;
+        goto out;
+    }
+
+    if (s->store) {
+        buf = qemu_try_blockalign(s->store->bs, bytes);
+        if (!buf) {
+            ret = -ENOMEM;
+            goto out;
+        }
+    } else {
+        buf = blkcache_slot_ptr(s, e);
+    }
+
+    qemu_iovec_init_buf(&qiov, buf, bytes);
+    ret = bdrv_co_preadv(bs->file, e->offset, bytes, &qiov, 0);
+    if (ret >= 0 && s->store) {
+        ret = bdrv_co_pwritev(s->store, e->slot * s->cluster_size, bytes,
+                              &qiov, 0);
+    }
+
+out:
+    if (s->store) {
+        qemu_vfree(buf);
+    }
+    trace_blkcache_load(bs, e->offset, e->slot, ret);
+
+    qemu_co_mutex_lock(&s->lock);
+    e->loading = false;
+    if (ret < 0) {
+        e->stale = true;
+    } else if (e->stale) {
+        ret = -EAGAIN;
+    }
+    blkcache_release_entry(s, e);
+
+    return ret;
+}
+
+/*
+ * Write the cluster of the dirty entry @e to the child.  Called with
+ * s->lock held, which is dropped during I/O.
+ */
+static int coroutine_fn blkcache_co_write_back(BlockDriverState *bs,
+                                               BlkcacheEntry *e)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    QEMUIOVector qiov;
+    int64_t bytes;
+    void *buf = NULL;
+    int ret;
+
+    assert(e->dirty && blkcache_entry_idle(e));
+    e->writing_back = true;
+    qemu_co_mutex_unlock(&s->lock);
+
+    bytes = blkcache_entry_bytes(bs, e);
+    if (bytes < 0) {
+        ret = bytes;
+        goto out;
+    }
+
+    if (s->store) {
+        buf = qemu_try_blockalign(s->store->bs, bytes);
+        if (!buf) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        qemu_iovec_init_buf(&qiov, buf, bytes);
+        ret = bdrv_co_preadv(s->store, e->slot * s->cluster_size, bytes,
+                             &qiov, 0);
+        if (ret < 0) {
+            goto out;
+        }
+    } else {
+        qemu_iovec_init_buf(&qiov, blkcache_slot_ptr(s, e), bytes);
+    }
+
+    ret = bdrv_co_pwritev(bs->file, e->offset, bytes, &qiov, 0);
+
+out:
+    if (s->store) {
+        qemu_vfree(buf);
+    }
+    trace_blkcache_write_back(bs, e->offset, e->slot, ret);
+
+    qemu_co_mutex_lock(&s->lock);
+    e->writing_back = false;
+    if (ret >= 0) {
+        e->dirty = false;
+        s->nr_dirty--;
+        s->write_backs++;
+    }
+    blkcache_release_entry(s, e);
+
+    return ret;
+}
+
+/*
+ * Return the entry for the cluster at @cluster, with a reference taken.
+ * If @write is true, the caller is going to modify the slot, so wait until
+ * the entry is not being written back.
+ *
+ * A missing entry is loaded from the child, unless the caller is going to
+ * overwrite the whole cluster: then it is returned with @loading set, and
+ * the caller must clear it once the slot is filled.
+ *
+ * Return NULL if the request must bypass the cache because all slots are
+ * busy, or because loading the cluster failed.
+ *
+ * Called with s->lock held, which may be dropped.
+ */
+static BlkcacheEntry * coroutine_fn
+blkcache_co_get_entry(BlockDriverState *bs, int64_t cluster, bool write,
+                      bool overwrite)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheEntry *e;
+
+    assert(write || !overwrite);
+
+    for (;;) {
+        e = blkcache_find_entry(s, cluster);
+        if (e && (e->loading || e->stale || (write && e->writing_back))) {
+            qemu_co_queue_wait(&s->queue, &s->lock);
+            continue;
+        }
+        if (e) {
+            s->hits++;
+            QTAILQ_REMOVE(&s->lru, e, lru);
+            QTAILQ_INSERT_HEAD(&s->lru, e, lru);
+            e->users++;
+            return e;
+        }
+
+        e = blkcache_new_entry(bs, cluster);
+        if (e) {
+            s->misses++;
+            e->loading = true;
+            if (overwrite) {
+                e->users++;
+                return e;
+            }
+            if (blkcache_co_load(bs, e) < 0) {
+                return NULL;
+            }
+            e->users++;
+            return e;
+        }
+
+        /* Every slot is busy or dirty, make room by writing one back */
+        e = blkcache_dirty_victim(s);
+        if (!e || blkcache_co_write_back(bs, e) < 0) {
+            s->misses++;
+            return NULL;
+        }
+    }
+}
+
+/* Read [offset, offset + bytes), which does not cross a cluster boundary */
+static int coroutine_fn blkcache_co_read_cluster(BlockDriverState *bs,
+                                                 int64_t offset,
+                                                 int64_t bytes,
+                                                 QEMUIOVector *qiov,
+                                                 size_t qiov_offset)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    int64_t cluster = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    BlkcacheEntry *e;
+    int ret;
+
+    qemu_co_mutex_lock(&s->lock);
+    e = blkcache_co_get_entry(bs, cluster, false, false);
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (!e) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    ret = blkcache_co_slot_read(s, e, offset - cluster, bytes,
+                                qiov, qiov_offset);
+
+    qemu_co_mutex_lock(&s->lock);
+    blkcache_put_entry(s, e);
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+typedef struct BlkcacheAioTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    int64_t offset;
+    int64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+} BlkcacheAioTask;
+
+static coroutine_fn int blkcache_co_read_task_entry(AioTask *task)
+{
+    BlkcacheAioTask *t = container_of(task, BlkcacheAioTask, task);
+
+    return blkcache_co_read_cluster(t->bs, t->offset, t->bytes,
+                                    t->qiov, t->qiov_offset);
+}
+
+static coroutine_fn int blkcache_add_read_task(BlockDriverState *bs,
+                                               AioTaskPool *pool,
+                                               int64_t offset, int64_t bytes,
+                                               QEMUIOVector *qiov,
+                                               size_t qiov_offset)
+{
+    BlkcacheAioTask local_task;
+    BlkcacheAioTask *task = pool ? g_new(BlkcacheAioTask, 1) : &local_task;
+
+    *task = (BlkcacheAioTask) {
+        .task.func = blkcache_co_read_task_entry,
+        .bs = bs,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+    };
+
+    if (!pool) {
+        return blkcache_co_read_task_entry(&task->task);
+    }
+
+    aio_task_pool_start_task(pool, &task->task);
+
+    return 0;
+}
+
+static int coroutine_fn blkcache_co_preadv_part(BlockDriverState *bs,
+                                                int64_t offset, int64_t bytes,
+                                                QEMUIOVector *qiov,
+                                                size_t qiov_offset,
+                                                BdrvRequestFlags flags)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    AioTaskPool *aio = NULL;
+    int64_t cur_bytes;
+    int ret = 0;
+
+    /* Misses of a multi-cluster request are loaded in parallel */
+    while (bytes && aio_task_pool_status(aio) == 0) {
+        cur_bytes = MIN(bytes, s->cluster_size - offset % s->cluster_size);
+
+        if (!aio && cur_bytes != bytes) {
+            aio = aio_task_pool_new(BLKCACHE_MAX_WORKERS);
+        }
+        ret = blkcache_add_read_task(bs, aio, offset, cur_bytes,
+                                     qiov, qiov_offset);
+        if (ret < 0) {
+            break;
+        }
+
+        bytes -= cur_bytes;
+        offset += cur_bytes;
+        qiov_offset += cur_bytes;
+    }
+
+    if (aio) {
+        aio_task_pool_wait_all(aio);
+        if (ret == 0) {
+            ret = aio_task_pool_status(aio);
+        }
+        g_free(aio);
+    }
+
+    return ret;
+}
+
+/*
+ * Write to the child, then update the cached clusters that overlap the
+ * request.  Loads that overlap it are dropped, because they may have read
+ * the old data.
+ */
+static int coroutine_fn blkcache_co_write_through(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  QEMUIOVector *qiov,
+                                                  size_t qiov_offset,
+                                                  BdrvRequestFlags flags)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheWrite w = { .offset = offset, .bytes = bytes };
+    g_autoptr(GPtrArray) entries = NULL;
+    BlkcacheEntry *e;
+    int ret, i;
+
+    qemu_co_mutex_lock(&s->lock);
+    for (;;) {
+        entries = blkcache_overlapping_entries(s, offset, bytes);
+        for (i = 0; i < entries->len; i++) {
+            e = g_ptr_array_index(entries, i);
+            if (e->writing_back) {
+                break;
+            }
+        }
+        if (i == entries->len) {
+            break;
+        }
+        /* Do not let a write back revert the child to older data */
+        g_clear_pointer(&entries, g_ptr_array_unref);
+        qemu_co_queue_wait(&s->queue, &s->lock);
+    }
+
+    QLIST_INSERT_HEAD(&s->writes, &w, next);
+    for (i = 0; i < entries->len; i++) {
+        e = g_ptr_array_index(entries, i);
+        if (e->loading) {
+            e->stale = true;
+            g_ptr_array_remove_index_fast(entries, i--);
+        } else {
+            e->users++;
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+
+    for (i = 0; ret >= 0 && i < entries->len; i++) {
+        int64_t start, end;
+        int slot_ret;
+
+        e = g_ptr_array_index(entries, i);
+        start = MAX(offset, e->offset);
+        end = MIN(offset + bytes, e->offset + s->cluster_size);
+        slot_ret = blkcache_co_slot_write(s, e, start - e->offset,
+                                          end - start, qiov,
+                                          qiov_offset + start - offset);
+        if (slot_ret < 0) {
+            /*
+             * The slot is older than the child now, and writing it back
+             * would revert the child, so drop it.  If it was dirty, the
+             * rest of its data is lost: report it.
+             */
+            e->stale = true;
+            if (e->dirty) {
+                ret = slot_ret;
+            }
+        }
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    QLIST_REMOVE(&w, next);
+    for (i = 0; i < entries->len; i++) {
+        e = g_ptr_array_index(entries, i);
+        if (ret < 0 && !e->dirty) {
+            e->stale = true;
+        }
+        blkcache_put_entry(s, e);
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+/*
+ * Write [offset, offset + bytes), which does not cross a cluster boundary,
+ * into the cache.
+ */
+static int coroutine_fn blkcache_co_write_cluster(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  QEMUIOVector *qiov,
+                                                  size_t qiov_offset)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    int64_t cluster = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    bool overwrite = false;
+    BlkcacheEntry *e;
+    int ret;
+
+    if (offset == cluster) {
+        int64_t len = bdrv_getlength(bs->file->bs);
+
+        overwrite = bytes == s->cluster_size ||
+                    (len >= 0 && offset + bytes == len);
+    }
+
+    qemu_co_mutex_lock(&s->lock);
+    e = blkcache_co_get_entry(bs, cluster, true, overwrite);
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (!e) {
+        return blkcache_co_write_through(bs, offset, bytes, qiov, qiov_offset,
+                                         0);
+    }
+
+    ret = blkcache_co_slot_write(s, e, offset - cluster, bytes,
+                                 qiov, qiov_offset);
+
+    qemu_co_mutex_lock(&s->lock);
+    if (e->loading) {
+        e->loading = false;
+        if (ret < 0) {
+            e->stale = true;
+        }
+    }
+    if (ret >= 0 && !e->dirty) {
+        e->dirty = true;
+        s->nr_dirty++;
+    }
+    blkcache_put_entry(s, e);
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static int coroutine_fn blkcache_co_pwritev_part(BlockDriverState *bs,
+                                                 int64_t offset,
+                                                 int64_t bytes,
+                                                 QEMUIOVector *qiov,
+                                                 size_t qiov_offset,
+                                                 BdrvRequestFlags flags)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    int64_t cur_bytes;
+    int ret;
+
+    if (!s->write_back || (flags & BDRV_REQ_FUA)) {
+        return blkcache_co_write_through(bs, offset, bytes, qiov, qiov_offset,
+                                         flags);
+    }
+
+    while (bytes) {
+        cur_bytes = MIN(bytes, s->cluster_size - offset % s->cluster_size);
+
+        ret = blkcache_co_write_cluster(bs, offset, cur_bytes,
+                                        qiov, qiov_offset);
+        if (ret < 0) {
+            return ret;
+        }
+
+        bytes -= cur_bytes;
+        offset += cur_bytes;
+        qiov_offset += cur_bytes;
+    }
+
+    return 0;
+}
+
+/*
+ * Prepare for a request that changes [offset, offset + bytes) in the child
+ * without providing the new data: drop the cached clusters in the range,
+ * after writing back the dirty ones that the range does not cover fully.
+ * Dirty clusters that it covers fully are dropped too, unless
+ * @keep_dirty is true, in which case they are written back first.
+ *
+ * On success, @w is registered until blkcache_end_invalidate().
+ */
+static int coroutine_fn blkcache_co_begin_invalidate(BlockDriverState *bs,
+                                                     BlkcacheWrite *w,
+                                                     int64_t offset,
+                                                     int64_t bytes,
+                                                     bool keep_dirty)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheEntry *e;
+    bool retry;
+    int ret = 0;
+    int i;
+
+    *w = (BlkcacheWrite) { .offset = offset, .bytes = bytes };
+
+    qemu_co_mutex_lock(&s->lock);
+    QLIST_INSERT_HEAD(&s->writes, w, next);
+
+    do {
+        g_autoptr(GPtrArray) entries =
+            blkcache_overlapping_entries(s, offset, bytes);
+
+        retry = false;
+        for (i = 0; i < entries->len && !retry; i++) {
+            bool covered;
+
+            e = g_ptr_array_index(entries, i);
+            covered = offset <= e->offset &&
+                      e->offset + s->cluster_size <= offset + bytes;
+
+            if (e->loading) {
+                e->stale = true;
+            } else if (e->dirty && (keep_dirty || !covered)) {
+                if (!blkcache_entry_idle(e)) {
+                    qemu_co_queue_wait(&s->queue, &s->lock);
+                } else {
+                    ret = blkcache_co_write_back(bs, e);
+                    if (ret < 0) {
+                        QLIST_REMOVE(w, next);
+                        qemu_co_queue_restart_all(&s->queue);
+                        goto out;
+                    }
+                }
+                /* s->lock was dropped, look again */
+                retry = true;
+            } else if (e->writing_back) {
+                qemu_co_queue_wait(&s->queue, &s->lock);
+                retry = true;
+            } else {
+                e->stale = true;
+                blkcache_release_entry(s, e);
+            }
+        }
+    } while (retry);
+
+out:
+    qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
+
+static void coroutine_fn blkcache_co_end_invalidate(BlockDriverState *bs,
+                                                    BlkcacheWrite *w)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+
+    qemu_co_mutex_lock(&s->lock);
+    QLIST_REMOVE(w, next);
+    qemu_co_queue_restart_all(&s->queue);
+    qemu_co_mutex_unlock(&s->lock);
+}
+
+static int coroutine_fn blkcache_co_pwrite_zeroes(BlockDriverState *bs,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  BdrvRequestFlags flags)
+{
+    BlkcacheWrite w;
+    int ret;
+
+    ret = blkcache_co_begin_invalidate(bs, &w, offset, bytes, false);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+
+    blkcache_co_end_invalidate(bs, &w);
+    return ret;
+}
+
+static int coroutine_fn blkcache_co_pdiscard(BlockDriverState *bs,
+                                             int64_t offset, int64_t bytes)
+{
+    BlkcacheWrite w;
+    int ret;
+
+    ret = blkcache_co_begin_invalidate(bs, &w, offset, bytes, false);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+
+    blkcache_co_end_invalidate(bs, &w);
+    return ret;
+}
+
+static int coroutine_fn
+blkcache_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                     PreallocMode prealloc, BdrvRequestFlags flags,
+                     Error **errp)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheWrite w;
+    int64_t old_len, start;
+    int ret;
+
+    old_len = bdrv_getlength(bs->file->bs);
+    if (old_len < 0) {
+        error_setg_errno(errp, -old_len, "Failed to get file length");
+        return old_len;
+    }
+
+    /*
+     * The last cluster of the old size is only partially cached, and the
+     * clusters after the new size go away.
+     */
+    start = QEMU_ALIGN_DOWN(MIN(old_len, offset), s->cluster_size);
+    ret = blkcache_co_begin_invalidate(bs, &w, start, INT64_MAX - start,
+                                       true);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to write back cached data");
+        return ret;
+    }
+
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+
+    blkcache_co_end_invalidate(bs, &w);
+    return ret;
+}
+
+/* Write all dirty clusters to the child */
+static int coroutine_fn blkcache_co_write_back_all(BlockDriverState *bs)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheEntry *e;
+    int ret = 0;
+
+    qemu_co_mutex_lock(&s->lock);
+    while (s->nr_dirty) {
+        QTAILQ_FOREACH_REVERSE(e, &s->lru, lru) {
+            if (e->dirty) {
+                break;
+            }
+        }
+        assert(e);
+
+        if (!blkcache_entry_idle(e)) {
+            qemu_co_queue_wait(&s->queue, &s->lock);
+            continue;
+        }
+
+        ret = blkcache_co_write_back(bs, e);
+        if (ret < 0) {
+            break;
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+static int coroutine_fn blkcache_co_flush(BlockDriverState *bs)
+{
+    int ret;
+
+    ret = blkcache_co_write_back_all(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    return bdrv_co_flush(bs->file->bs);
+}
+
+/*
+ * Dirty clusters are data that the child does not have yet; everything
+ * else is the child's business.
+ */
+static int coroutine_fn blkcache_co_block_status(BlockDriverState *bs,
+                                                 bool want_zero,
+                                                 int64_t offset,
+                                                 int64_t bytes,
+                                                 int64_t *pnum,
+                                                 int64_t *map,
+                                                 BlockDriverState **file)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    int64_t dirty_start = offset + bytes;
+    int64_t dirty_end = offset;
+    BlkcacheEntry *e;
+    int i;
+
+    qemu_co_mutex_lock(&s->lock);
+    if (s->nr_dirty) {
+        g_autoptr(GPtrArray) entries =
+            blkcache_overlapping_entries(s, offset, bytes);
+
+        for (i = 0; i < entries->len; i++) {
+            e = g_ptr_array_index(entries, i);
+            if (!e->dirty) {
+                continue;
+            }
+            if (e->offset <= offset) {
+                dirty_end = e->offset + s->cluster_size;
+            } else {
+                dirty_start = MIN(dirty_start, e->offset);
+            }
+        }
+    }
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (dirty_end > offset) {
+        *pnum = MIN(dirty_end, offset + bytes) - offset;
+        return BDRV_BLOCK_DATA;
+    }
+
+    *pnum = dirty_start - offset;
+    *map = offset;
+    *file = bs->file->bs;
+    return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID;
+}
+
+/*
+ * The node was inactive and the child may have been changed by someone
+ * else, e.g. the source of a migration.
+ */
+static void coroutine_fn blkcache_co_invalidate_cache(BlockDriverState *bs,
+                                                      Error **errp)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+    BlkcacheEntry *e, *next;
+
+    qemu_co_mutex_lock(&s->lock);
+    if (s->nr_dirty) {
+        /* Writing them back failed when the node was inactivated */
+        error_setg(errp, "%" PRId64 " dirty clusters of '%s' were not "
+                   "written back", s->nr_dirty,
+                   bdrv_get_device_or_node_name(bs));
+        qemu_co_mutex_unlock(&s->lock);
+        return;
+    }
+    QTAILQ_FOREACH_SAFE(e, &s->lru, lru, next) {
+        e->stale = true;
+        blkcache_release_entry(s, e);
+    }
+    qemu_co_mutex_unlock(&s->lock);
+}
+
+/*
+ * Write back dirty clusters before the permissions on the child go away,
+ * e.g. at the end of a migration.
+ */
+static int blkcache_inactivate(BlockDriverState *bs)
+{
+    return bdrv_flush(bs);
+}
+
+static int blkcache_check_perm(BlockDriverState *bs, uint64_t perm,
+                               uint64_t shared, Error **errp)
+{
+    BDRVBlkcacheState *s = bs->opaque;
+
+    /*
+     * Without the write permission, the child's would be gone and dirty
+     * clusters could not be written back anymore.  Permission changes
+     * must not do I/O, so the data must have been flushed before, as
+     * bdrv_reopen() and blkcache_inactivate() do.
+     */
+    if (s->nr_dirty && !(perm & BLK_PERM_WRITE)) {
+        error_setg(errp, "The blkcache filter '%s' has %" PRId64 " dirty "
+                   "clusters, flush it before dropping write access",
+                   bdrv_get_device_or_node_name(bs), s->nr_dirty);
+        return -EPERM;
+    }
+
+    return 0;
+}
+
+static void blkcache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                BdrvChildRole role,
+                                BlockReopenQueue *reopen_queue,
+                                uint64_t perm, uint64_t shared,
+                                uint64_t *nperm, uint64_t *nshared)
+{
+    if (!(role & BDRV_CHILD_PRIMARY)) {
+        /* The store node is only ours */
+        *nperm = 0;
+        if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+            *nperm = BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE;
+        }
+        *nshared = BLK_PERM_WRITE_UNCHANGED;
+        return;
+    }
+
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared,
+                       nperm, nshared);
+
+    /* Writes that bypass the filter would not be seen by the cache */
+    *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+}
+
+static BlockStatsSpecific *blkcache_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    BDRVBlkcacheState *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_BLKCACHE;
+    stats->u.blkcache = (BlockStatsSpecificBlkcache) {
+        .hits = s->hits,
+        .misses = s->misses,
+        .evictions = s->evictions,
+        .write_backs = s->write_backs,
+        .cached_clusters = s->nr_used,
+        .dirty_clusters = s->nr_dirty,
+    };
+
+    return stats;
+}
+
+static const char *const blkcache_strong_runtime_opts[] = {
+    BLKCACHE_OPT_SIZE,
+    BLKCACHE_OPT_CLUSTER_SIZE,
+    BLKCACHE_OPT_WRITE_BACK,
+
+    NULL
+};
+
+BlockDriver bdrv_blkcache = {
+    .format_name = "blkcache",
+    .instance_size = sizeof(BDRVBlkcacheState),
+
+    .bdrv_open = blkcache_open,
+    .bdrv_close = blkcache_close,
+    .bdrv_reopen_prepare = blkcache_reopen_prepare,
+    .bdrv_getlength = blkcache_getlength,
+
+    .bdrv_co_preadv_part = blkcache_co_preadv_part,
+    .bdrv_co_pwritev_part = blkcache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes = blkcache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard = blkcache_co_pdiscard,
+    .bdrv_co_truncate = blkcache_co_truncate,
+    .bdrv_co_flush = blkcache_co_flush,
+    .bdrv_co_block_status = blkcache_co_block_status,
+    .bdrv_co_invalidate_cache = blkcache_co_invalidate_cache,
+    .bdrv_inactivate = blkcache_inactivate,
+
+    .bdrv_check_perm = blkcache_check_perm,
+    .bdrv_child_perm = blkcache_child_perm,
+
+    .bdrv_get_specific_stats = blkcache_get_specific_stats,
+
+    .has_variable_length = true,
+    .strong_runtime_opts = blkcache_strong_runtime_opts,
+};
+
+static void bdrv_blkcache_init(void)
+{
+    bdrv_register(&bdrv_blkcache);
+}
+
+block_init(bdrv_blkcache_init);
@@ -1450,6 +1450,28 @@ void blk_dec_in_flight(BlockBackend *blk)
     aio_wait_kick();
 }
 
+/*
+ * Apply the I/O limits of @blk to a request of @bytes that accesses the
+ * data of its root node without going through @blk.
+ */
+void coroutine_fn blk_co_io_limits_intercept(BlockBackend *blk, int64_t bytes,
+                                             bool is_write)
+{
+    ThrottleGroupMember *tgm = &blk->public.throttle_group_member;
+    IO_CODE();
+
+    if (tgm->throttle_state) {
+        throttle_group_co_io_limits_intercept(tgm, bytes, is_write);
+    }
+}
+
+/* Return whether requests on @blk are subject to I/O limits */
+bool blk_io_limits_enabled(BlockBackend *blk)
+{
+    IO_CODE();
+    return blk->public.throttle_group_member.throttle_state != NULL;
+}
+
 static void error_callback_bh(void *opaque)
 {
     struct BlockBackendAIOCB *acb = opaque;
@@ -19,6 +19,7 @@
 #include "qom/object_interfaces.h"
 #include "util/block-helpers.h"
 #include "virtio-blk-handler.h"
+#include "trace/trace-block.h"
 
 enum {
     VHOST_USER_BLK_NUM_QUEUES_DEFAULT = 1,
@@ -28,6 +29,14 @@ typedef struct VuBlkReq {
     VuVirtqElement elem;
     VuServer *server;
     struct VuVirtq *vq;
+#ifdef CONFIG_LINUX_IO_URING
+    /* Only used by requests taken by vu_blk_uring_submit() */
+    AioUringCqeHandler cqe_handler;
+    BlockAcctCookie acct;
+    QEMUIOVector qiov;
+    int64_t offset;
+    bool is_write;
+#endif
 } VuBlkReq;
 
 /* vhost user block device */
@@ -37,6 +46,24 @@ typedef struct {
     VirtioBlkHandler handler;
     QIOChannelSocket *sioc;
     struct virtio_blk_config blkcfg;
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * Where the data of the export lives in its host file, if it has one,
+     * for vu_blk_uring_submit().  The graph only changes and nodes are only
+     * reopened in drained sections, so the mapping is dropped when the
+     * export is drained and looked up again by the next request that goes
+     * through the block layer.
+     */
+    bool uring_mapped;
+    bool uring_checked;
+    unsigned uring_quiesce_counter;
+    unsigned uring_gen;
+    int uring_fd;
+    BlockDriverState *uring_file;
+    int64_t uring_host_offset;
+    uint32_t uring_align;
+    size_t uring_mem_align;
+#endif
 } VuBlkExport;
 
 static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
@@ -49,6 +76,268 @@ static void vu_blk_req_complete(VuBlkReq *req, size_t in_len)
     free(req);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Reads and writes of an export whose data sits in a host file at a fixed
+ * offset, i.e. raw or file-posix without filters, are passed directly to the
+ * io_uring of the export's AioContext.  They are submitted and completed by
+ * the same io_uring_enter(2) call that waits for virtqueue kicks, without a
+ * coroutine or a trip through the BlockBackend.  Everything else, including
+ * requests that do not meet the alignment requirements of the host file,
+ * takes the slow path through virtio_blk_process_req().  Both paths account
+ * reads and writes on the export's BlockBackend, but only the slow path
+ * applies its I/O limits, so the fast path is not used while it has any.
+ */
+
+static void vu_blk_drained_begin(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+
+    vexp->uring_quiesce_counter++;
+    vexp->uring_gen++;
+    vexp->uring_mapped = false;
+    vexp->uring_checked = false;
+}
+
+static void vu_blk_drained_end(void *opaque)
+{
+    VuBlkExport *vexp = opaque;
+
+    assert(vexp->uring_quiesce_counter > 0);
+    vexp->uring_quiesce_counter--;
+}
+
+static const BlockDevOps vu_blk_dev_ops = {
+    .drained_begin = vu_blk_drained_begin,
+    .drained_end   = vu_blk_drained_end,
+};
+
+/* Look up where the export lives in its host file, if it has one */
+static void coroutine_fn vu_blk_uring_map(VuBlkExport *vexp)
+{
+    BlockBackend *blk = vexp->export.blk;
+    BlockDriverState *bs = blk_bs(blk);
+    BlockDriverState *file = NULL;
+    unsigned gen = vexp->uring_gen;
+    uint32_t align;
+    int64_t pnum, map;
+    int fd, ret;
+
+    vexp->uring_checked = true;
+    if (!bs || vexp->uring_quiesce_counter) {
+        return;
+    }
+
+    fd = bdrv_get_host_fd(bs);
+    if (fd < 0) {
+        return;
+    }
+
+    /*
+     * Requests are only taken if they are aligned for the host file, and
+     * all of them must be: the block layer would not serialize a
+     * read-modify-write cycle against writes that it does not see.
+     */
+    align = blk_get_request_alignment(blk);
+    if (vexp->handler.logical_block_size % align) {
+        return;
+    }
+
+    ret = bdrv_block_status(bs, 0, 1, &pnum, &map, &file);
+    if (ret < 0 || !(ret & BDRV_BLOCK_OFFSET_VALID) || !file ||
+        bdrv_get_host_fd(file) != fd || map % align) {
+        return;
+    }
+
+    /* Drained while we were looking? */
+    if (gen != vexp->uring_gen) {
+        return;
+    }
+
+    vexp->uring_fd = fd;
+    vexp->uring_file = file;
+    vexp->uring_host_offset = map;
+    vexp->uring_align = align;
+    vexp->uring_mem_align = bdrv_min_mem_align(bs);
+    vexp->uring_mapped = true;
+}
+
+static bool vu_blk_uring_iov_aligned(VuBlkExport *vexp, struct iovec *iov,
+                                     unsigned niov)
+{
+    unsigned i;
+
+    for (i = 0; i < niov; i++) {
+        if ((uintptr_t)iov[i].iov_base % vexp->uring_mem_align ||
+            iov[i].iov_len % vexp->uring_mem_align) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void vu_blk_uring_req_done(VuBlkReq *req, uint8_t status)
+{
+    VuServer *server = req->server;
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
+    BlockAcctStats *stats = blk_get_stats(vexp->export.blk);
+    VuVirtqElement *elem = &req->elem;
+
+    if (status == VIRTIO_BLK_S_OK) {
+        block_acct_done(stats, &req->acct);
+    } else {
+        block_acct_failed(stats, &req->acct);
+    }
+
+    *(uint8_t *)elem->in_sg[elem->in_num - 1].iov_base = status;
+    vu_blk_req_complete(req, iov_size(elem->in_sg, elem->in_num));
+    vhost_user_server_unref(server);
+}
+
+/* Resubmit a request that did not fully complete through the block layer */
+static void coroutine_fn vu_blk_uring_retry(void *opaque)
+{
+    VuBlkReq *req = opaque;
+    VuBlkExport *vexp = container_of(req->server, VuBlkExport, vu_server);
+    BlockBackend *blk = vexp->export.blk;
+    int ret;
+
+    if (req->is_write) {
+        ret = blk_co_pwritev(blk, req->offset, req->qiov.size, &req->qiov, 0);
+    } else {
+        ret = blk_co_preadv(blk, req->offset, req->qiov.size, &req->qiov, 0);
+    }
+
+    vu_blk_uring_req_done(req, ret < 0 ? VIRTIO_BLK_S_IOERR : VIRTIO_BLK_S_OK);
+}
+
+static void vu_blk_uring_complete(AioUringCqeHandler *handler)
+{
+    VuBlkReq *req = container_of(handler, VuBlkReq, cqe_handler);
+    VuBlkExport *vexp = container_of(req->server, VuBlkExport, vu_server);
+    BlockBackend *blk = vexp->export.blk;
+    BlockDriverState *bs = blk_bs(blk);
+    BlockDriverState *file = vexp->uring_file;
+    int64_t bytes = req->qiov.size;
+
+    if (handler->cqe_res == bytes && req->is_write) {
+        bdrv_host_fd_write_end(bs, req->offset, bytes);
+        if (file != bs) {
+            bdrv_host_fd_write_end(file, vexp->uring_host_offset + req->offset,
+                                   bytes);
+        }
+    }
+
+    /*
+     * Drop the in-flight reference before a retry, which would wait for a
+     * drained section that itself waits for this request.
+     */
+    blk_dec_in_flight(blk);
+
+    if (handler->cqe_res != bytes) {
+        /*
+         * Errors, and short transfers at the end of a file whose size is not
+         * sector aligned, are left to the block layer.
+         */
+        Coroutine *co = qemu_coroutine_create(vu_blk_uring_retry, req);
+
+        trace_vu_blk_uring_retry(vexp, req->offset, bytes, handler->cqe_res);
+        qemu_coroutine_enter(co);
+        return;
+    }
+
+    vu_blk_uring_req_done(req, VIRTIO_BLK_S_OK);
+}
+
+/*
+ * Submit @req directly to the host file if possible.  Returns false if the
+ * request must go through virtio_blk_process_req() instead, in which case
+ * its iovecs are unchanged.
+ */
+static bool vu_blk_uring_submit(VuBlkReq *req)
+{
+    VuServer *server = req->server;
+    VuBlkExport *vexp = container_of(server, VuBlkExport, vu_server);
+    VuVirtqElement *elem = &req->elem;
+    BlockBackend *blk = vexp->export.blk;
+    BlockDriverState *bs = blk_bs(blk);
+    BlockDriverState *file = vexp->uring_file;
+    struct virtio_blk_outhdr out;
+    struct io_uring_sqe sqe = {};
+    struct iovec *iov;
+    unsigned niov;
+    int64_t host_offset;
+    uint64_t sector_num;
+    uint32_t type;
+
+    if (!vexp->uring_mapped || blk_io_limits_enabled(blk)) {
+        return false;
+    }
+
+    /*
+     * Only take requests whose headers and status byte have descriptors of
+     * their own, which is what drivers do in practice, so that the data
+     * descriptors can be used as they are.
+     */
+    if (elem->out_num < 1 || elem->in_num < 1 ||
+        elem->out_sg[0].iov_len != sizeof(out) ||
+        elem->in_sg[elem->in_num - 1].iov_len != 1) {
+        return false;
+    }
+    memcpy(&out, elem->out_sg[0].iov_base, sizeof(out));
+
+    type = le32_to_cpu(out.type) & ~VIRTIO_BLK_T_BARRIER;
+    if (type == VIRTIO_BLK_T_IN) {
+        iov = elem->in_sg;
+        niov = elem->in_num - 1;
+        req->is_write = false;
+    } else if (type == VIRTIO_BLK_T_OUT && vexp->handler.writable &&
+               blk_enable_write_cache(blk)) {
+        iov = elem->out_sg + 1;
+        niov = elem->out_num - 1;
+        req->is_write = true;
+    } else {
+        return false;
+    }
+
+    qemu_iovec_init_external(&req->qiov, iov, niov);
+    sector_num = le64_to_cpu(out.sector);
+    if (req->qiov.size == 0 || req->qiov.size % vexp->uring_align ||
+        !virtio_blk_sect_range_ok(blk, vexp->handler.logical_block_size,
+                                  sector_num, req->qiov.size) ||
+        !vu_blk_uring_iov_aligned(vexp, iov, niov)) {
+        return false;
+    }
+
+    req->offset = sector_num << VIRTIO_BLK_SECTOR_BITS;
+    host_offset = vexp->uring_host_offset + req->offset;
+
+    if (req->is_write) {
+        if (!bdrv_host_fd_write_begin(bs, req->offset, req->qiov.size) ||
+            (file != bs &&
+             !bdrv_host_fd_write_begin(file, host_offset, req->qiov.size))) {
+            return false;
+        }
+        io_uring_prep_writev(&sqe, vexp->uring_fd, iov, niov, host_offset);
+    } else {
+        io_uring_prep_readv(&sqe, vexp->uring_fd, iov, niov, host_offset);
+    }
+
+    block_acct_start(blk_get_stats(blk), &req->acct, req->qiov.size,
+                     req->is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+    req->cqe_handler.cb = vu_blk_uring_complete;
+    if (!aio_io_uring_add_sqe(vexp->export.ctx, &sqe, &req->cqe_handler)) {
+        return false;
+    }
+
+    blk_inc_in_flight(blk);
+    vhost_user_server_ref(server);
+    trace_vu_blk_uring_submit(vexp, req->offset, req->qiov.size,
+                              req->is_write);
+    return true;
+}
+#endif /* CONFIG_LINUX_IO_URING */
+
 /* Called with server refcount increased, must decrease before returning */
 static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
 {
@@ -63,6 +352,12 @@ static void coroutine_fn vu_blk_virtio_process_req(void *opaque)
     unsigned out_num = elem->out_num;
     int in_len;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (!vexp->uring_checked) {
+        vu_blk_uring_map(vexp);
+    }
+#endif
+
     in_len = virtio_blk_process_req(handler, in_iov, out_iov,
                                     in_num, out_num);
     if (in_len < 0) {
@@ -91,6 +386,12 @@ static void vu_blk_process_vq(VuDev *vu_dev, int idx)
         req->server = server;
         req->vq = vq;
 
+#ifdef CONFIG_LINUX_IO_URING
+        if (vu_blk_uring_submit(req)) {
+            continue;
+        }
+#endif
+
         Coroutine *co =
             qemu_coroutine_create(vu_blk_virtio_process_req, req);
 
@@ -292,8 +593,15 @@ static int vu_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
     blk_add_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                  vexp);
 
+#ifdef CONFIG_LINUX_IO_URING
+    blk_set_dev_ops(exp->blk, &vu_blk_dev_ops, vexp);
+#endif
+
     if (!vhost_user_server_start(&vexp->vu_server, vu_opts->addr, exp->ctx,
                                  num_queues, &vu_blk_iface, errp)) {
+#ifdef CONFIG_LINUX_IO_URING
+        blk_set_dev_ops(exp->blk, NULL, NULL);
+#endif
         blk_remove_aio_context_notifier(exp->blk, blk_aio_attached,
                                         blk_aio_detach, vexp);
         g_free(vexp->handler.serial);
@@ -309,6 +617,9 @@ static void vu_blk_exp_delete(BlockExport *exp)
 
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vexp);
+#ifdef CONFIG_LINUX_IO_URING
+    blk_set_dev_ops(exp->blk, NULL, NULL);
+#endif
     g_free(vexp->handler.serial);
 }
 
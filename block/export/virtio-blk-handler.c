@@ -22,8 +22,8 @@ struct virtio_blk_inhdr {
     unsigned char status;
 };
 
-static bool virtio_blk_sect_range_ok(BlockBackend *blk, uint32_t block_size,
-                                     uint64_t sector, size_t size)
+bool virtio_blk_sect_range_ok(BlockBackend *blk, uint32_t block_size,
+                              uint64_t sector, size_t size)
 {
     uint64_t nb_sectors;
     uint64_t total_sectors;
@@ -170,9 +170,12 @@ int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
     case VIRTIO_BLK_T_IN:
     case VIRTIO_BLK_T_OUT: {
         QEMUIOVector qiov;
+        BlockAcctCookie acct;
         int64_t offset;
         ssize_t ret = 0;
         bool is_write = type & VIRTIO_BLK_T_OUT;
+        enum BlockAcctType acct_type = is_write ? BLOCK_ACCT_WRITE :
+                                                  BLOCK_ACCT_READ;
         int64_t sector_num = le64_to_cpu(out.sector);
 
         if (is_write && !handler->writable) {
@@ -189,20 +192,24 @@ int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
         if (unlikely(!virtio_blk_sect_range_ok(blk,
                                                handler->logical_block_size,
                                                sector_num, qiov.size))) {
+            block_acct_invalid(blk_get_stats(blk), acct_type);
             in->status = VIRTIO_BLK_S_IOERR;
             break;
         }
 
         offset = sector_num << VIRTIO_BLK_SECTOR_BITS;
 
+        block_acct_start(blk_get_stats(blk), &acct, qiov.size, acct_type);
         if (is_write) {
             ret = blk_co_pwritev(blk, offset, qiov.size, &qiov, 0);
         } else {
             ret = blk_co_preadv(blk, offset, qiov.size, &qiov, 0);
         }
         if (ret >= 0) {
+            block_acct_done(blk_get_stats(blk), &acct);
             in->status = VIRTIO_BLK_S_OK;
         } else {
+            block_acct_failed(blk_get_stats(blk), &acct);
             in->status = VIRTIO_BLK_S_IOERR;
         }
         break;
@@ -28,6 +28,9 @@ typedef struct {
     bool writable;
 } VirtioBlkHandler;
 
+bool virtio_blk_sect_range_ok(BlockBackend *blk, uint32_t block_size,
+                              uint64_t sector, size_t size);
+
 int coroutine_fn virtio_blk_process_req(VirtioBlkHandler *handler,
                                         struct iovec *in_iov,
                                         struct iovec *out_iov,
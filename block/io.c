@@ -744,10 +744,24 @@ static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
     QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->overlap_node, &req->bs->tracked_requests_tree);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
 
+/*
+ * The interval tree only needs to find candidates for
+ * tracked_request_overlaps(), so the node covers one more byte than the
+ * overlap range.  This way requests of zero bytes still get a valid
+ * interval.
+ */
+static void tracked_request_insert_overlap(BdrvTrackedRequest *req)
+{
+    req->overlap_node.start = req->overlap_offset;
+    req->overlap_node.last = req->overlap_offset + req->overlap_bytes;
+    interval_tree_insert(&req->overlap_node, &req->bs->tracked_requests_tree);
+}
+
 /**
  * Add an active request to the tracked requests list
  */
@@ -774,6 +788,7 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
 
     qemu_co_mutex_lock(&bs->reqs_lock);
     QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    tracked_request_insert_overlap(req);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
@@ -797,9 +812,18 @@ static bool tracked_request_overlaps(BdrvTrackedRequest *req,
 static coroutine_fn BdrvTrackedRequest *
 bdrv_find_conflicting_request(BdrvTrackedRequest *self)
 {
-    BdrvTrackedRequest *req;
+    IntervalTreeNode *node;
+    uint64_t start = self->overlap_offset;
+    uint64_t last = self->overlap_offset + self->overlap_bytes;
+
+    for (node = interval_tree_iter_first(&self->bs->tracked_requests_tree,
+                                         start, last);
+         node;
+         node = interval_tree_iter_next(node, start, last))
+    {
+        BdrvTrackedRequest *req =
+            container_of(node, BdrvTrackedRequest, overlap_node);
 
-    QLIST_FOREACH(req, &self->bs->tracked_requests, list) {
         if (req == self || (!req->serialising && !self->serialising)) {
             continue;
         }
@@ -855,8 +879,16 @@ static void tracked_request_set_serialising(BdrvTrackedRequest *req,
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    overlap_offset = MIN(req->overlap_offset, overlap_offset);
+    overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset != req->overlap_offset ||
+        overlap_bytes != req->overlap_bytes) {
+        interval_tree_remove(&req->overlap_node,
+                             &req->bs->tracked_requests_tree);
+        req->overlap_offset = overlap_offset;
+        req->overlap_bytes = overlap_bytes;
+        tracked_request_insert_overlap(req);
+    }
 }
 
 /**
@@ -1436,6 +1468,13 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
                 goto err;
             }
 
+            /*
+             * The cluster is allocated now.  A racing block status query
+             * may still cache it as unallocated, which is harmless because
+             * the backing file has the same data.
+             */
+            bdrv_asc_invalidate_range(bs, cluster_offset, pnum);
+
             if (!(flags & BDRV_REQ_PREFETCH)) {
                 qemu_iovec_from_buf(qiov, qiov_offset + progress,
                                     bounce_buffer + skip_bytes,
@@ -2015,6 +2054,12 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
 
     qatomic_inc(&bs->write_gen);
 
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_asc_clear(bs);
+    } else {
+        bdrv_asc_invalidate_range(bs, offset, bytes);
+    }
+
     /*
      * Discard cannot extend the image, but in error handling cases, such as
      * when reverting a qcow2 cluster allocation, the discarded range can pass
@@ -2044,6 +2089,42 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
     }
 }
 
+/*
+ * A write that the caller submits directly to the host file descriptor of
+ * @bs (see bdrv_get_host_fd()) skips bdrv_co_write_req_prepare() and
+ * bdrv_co_write_req_finish().  Bracket it with these two functions so
+ * that write thresholds, dirty bitmaps and flushes still see it.  The
+ * offsets are those of @bs; the caller also needs to call them for the
+ * node that owns the file descriptor, if it is not @bs.
+ *
+ * bdrv_host_fd_write_begin() returns false if the write must go through
+ * the block layer instead.
+ */
+bool bdrv_host_fd_write_begin(BlockDriverState *bs, int64_t offset,
+                              int64_t bytes)
+{
+    IO_CODE();
+
+    if (bs->detect_zeroes != BLOCKDEV_DETECT_ZEROES_OPTIONS_OFF ||
+        offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
+        return false;
+    }
+
+    bdrv_write_threshold_check_write(bs, offset, bytes);
+    return true;
+}
+
+void bdrv_host_fd_write_end(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes)
+{
+    IO_CODE();
+
+    qatomic_inc(&bs->write_gen);
+    bdrv_asc_invalidate_range(bs, offset, bytes);
+    stat64_max(&bs->wr_highest_offset, offset + bytes);
+    bdrv_set_dirty(bs, offset, bytes);
+}
+
 /*
  * Forwards an already correctly aligned write request to the BlockDriver,
  * after possibly fragmenting it.
@@ -2469,11 +2550,30 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
             ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
             local_file = bs;
             local_map = aligned_offset;
+        } else if (!want_zero && bs->drv->supports_backing &&
+                   bdrv_asc_lookup(bs, aligned_offset, &ret, pnum,
+                                   &local_map, &local_file))
+        {
+            /* Allocation status cached by an earlier query, see below */
         } else {
+            unsigned int write_gen = qatomic_read(&bs->write_gen);
+
             ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
                                                 aligned_bytes, pnum, &local_map,
                                                 &local_file);
 
+            /*
+             * Backing chain walks ask the lower layers about allocation only,
+             * and they ask again for every extent of the layers above, so
+             * cache what format drivers report for want_zero == false.  The
+             * whole driver result is cached, not only the requested part;
+             * the caller asks for large ranges to make the extents useful.
+             */
+            if (!want_zero && ret >= 0 && bs->drv->supports_backing) {
+                bdrv_asc_fill(bs, write_gen, aligned_offset, *pnum, ret,
+                              local_map, local_file);
+            }
+
             /*
              * Note that checking QLIST_EMPTY(&bs->children) is also done when
              * the cache is queried above.  Technically, we do not need to check
@@ -2622,6 +2722,7 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
     int ret;
     BlockDriverState *p;
     int64_t eof = 0;
+    int64_t request_bytes = bytes;
     int dummy;
     IO_CODE();
 
@@ -2653,8 +2754,26 @@ bdrv_co_common_block_status_above(BlockDriverState *bs,
     for (p = bdrv_filter_or_cow_bs(bs); include_base || p != base;
          p = bdrv_filter_or_cow_bs(p))
     {
-        ret = bdrv_co_block_status(p, want_zero, offset, bytes, pnum, map,
+        /*
+         * Only the layer that ends the walk needs to report more than
+         * allocation, so ask with want_zero == false first, which may be
+         * answered from the allocation status cache.  Ask for the whole
+         * request so that the extent cached for this layer also serves
+         * the queries for the following extents of the layers above.
+         */
+        ret = bdrv_co_block_status(p, false, offset, request_bytes, pnum, map,
                                    file);
+        if (ret >= 0 && *pnum > bytes) {
+            *pnum = bytes;
+            ret &= ~BDRV_BLOCK_EOF;
+        }
+        if (want_zero && ret >= 0 && *pnum &&
+            (ret & BDRV_BLOCK_ALLOCATED || p == base ||
+             (!include_base && bdrv_filter_or_cow_bs(p) == base)))
+        {
+            ret = bdrv_co_block_status(p, true, offset, *pnum, pnum, map,
+                                       file);
+        }
         ++*depth;
         if (ret < 0) {
             return ret;
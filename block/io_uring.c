@@ -23,6 +23,7 @@
 
 typedef struct LuringAIOCB {
     Coroutine *co;
+    struct LuringState *s;
     struct io_uring_sqe sqeq;
     ssize_t ret;
     QEMUIOVector *qiov;
@@ -35,6 +36,9 @@ typedef struct LuringAIOCB {
      */
     int total_read;
     QEMUIOVector resubmit_qiov;
+
+    /* Used when submitted on the AioContext's ring, see ioq_submit() */
+    AioUringCqeHandler cqe_handler;
 } LuringAIOCB;
 
 typedef struct LuringQueue {
@@ -105,6 +109,81 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luring_resubmit(s, luringcb);
 }
 
+/**
+ * luring_process_cqe:
+ * @s: AIO state
+ * @luringcb: the request that completed
+ * @ret: the cqe's result
+ *
+ * Completes a request or resubmits it.  The caller must ensure that
+ * ioq_submit() is called later so that resubmitted requests are started.
+ */
+static void luring_process_cqe(LuringState *s, LuringAIOCB *luringcb, int ret)
+{
+    int total_bytes;
+
+    /* Change counters one-by-one because we can be nested. */
+    s->io_q.in_flight--;
+    trace_luring_process_completion(s, luringcb, ret);
+
+    /* total_read is non-zero only for resubmitted read requests */
+    total_bytes = ret + luringcb->total_read;
+
+    if (ret < 0) {
+        /*
+         * Only writev/readv/fsync requests on regular files or host block
+         * devices are submitted. Therefore -EAGAIN is not expected but it's
+         * known to happen sometimes with Linux SCSI. Submit again and hope
+         * the request completes successfully.
+         *
+         * For more information, see:
+         * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
+         *
+         * If the code is changed to submit other types of requests in the
+         * future, then this workaround may need to be extended to deal with
+         * genuine -EAGAIN results that should not be resubmitted
+         * immediately.
+         */
+        if (ret == -EINTR || ret == -EAGAIN) {
+            luring_resubmit(s, luringcb);
+            return;
+        }
+    } else if (!luringcb->qiov) {
+        goto end;
+    } else if (total_bytes == luringcb->qiov->size) {
+        ret = 0;
+    /* Only read/write */
+    } else {
+        /* Short Read/Write */
+        if (luringcb->is_read) {
+            if (ret > 0) {
+                luring_resubmit_short_read(s, luringcb, ret);
+                return;
+            } else {
+                /* Pad with zeroes */
+                qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
+                                  luringcb->qiov->size - total_bytes);
+                ret = 0;
+            }
+        } else {
+            ret = -ENOSPC;
+        }
+    }
+end:
+    luringcb->ret = ret;
+    qemu_iovec_destroy(&luringcb->resubmit_qiov);
+
+    /*
+     * If the coroutine is already entered it must be in ioq_submit()
+     * and will notice luringcb->ret has been filled in when it
+     * eventually runs later. Coroutines cannot be entered recursively
+     * so avoid doing that!
+     */
+    if (!qemu_coroutine_entered(luringcb->co)) {
+        aio_co_wake(luringcb->co);
+    }
+}
+
 /**
  * luring_process_completions:
  * @s: AIO state
@@ -121,7 +200,6 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 static void luring_process_completions(LuringState *s)
 {
     struct io_uring_cqe *cqes;
-    int total_bytes;
     /*
      * Request completion callbacks can run the nested event loop.
      * Schedule ourselves so the nested event loop will "see" remaining
@@ -152,66 +230,7 @@ static void luring_process_completions(LuringState *s)
         io_uring_cqe_seen(&s->ring, cqes);
         cqes = NULL;
 
-        /* Change counters one-by-one because we can be nested. */
-        s->io_q.in_flight--;
-        trace_luring_process_completion(s, luringcb, ret);
-
-        /* total_read is non-zero only for resubmitted read requests */
-        total_bytes = ret + luringcb->total_read;
-
-        if (ret < 0) {
-            /*
-             * Only writev/readv/fsync requests on regular files or host block
-             * devices are submitted. Therefore -EAGAIN is not expected but it's
-             * known to happen sometimes with Linux SCSI. Submit again and hope
-             * the request completes successfully.
-             *
-             * For more information, see:
-             * https://lore.kernel.org/io-uring/20210727165811.284510-3-axboe@kernel.dk/T/#u
-             *
-             * If the code is changed to submit other types of requests in the
-             * future, then this workaround may need to be extended to deal with
-             * genuine -EAGAIN results that should not be resubmitted
-             * immediately.
-             */
-            if (ret == -EINTR || ret == -EAGAIN) {
-                luring_resubmit(s, luringcb);
-                continue;
-            }
-        } else if (!luringcb->qiov) {
-            goto end;
-        } else if (total_bytes == luringcb->qiov->size) {
-            ret = 0;
-        /* Only read/write */
-        } else {
-            /* Short Read/Write */
-            if (luringcb->is_read) {
-                if (ret > 0) {
-                    luring_resubmit_short_read(s, luringcb, ret);
-                    continue;
-                } else {
-                    /* Pad with zeroes */
-                    qemu_iovec_memset(luringcb->qiov, total_bytes, 0,
-                                      luringcb->qiov->size - total_bytes);
-                    ret = 0;
-                }
-            } else {
-                ret = -ENOSPC;
-            }
-        }
-end:
-        luringcb->ret = ret;
-        qemu_iovec_destroy(&luringcb->resubmit_qiov);
-
-        /*
-         * If the coroutine is already entered it must be in ioq_submit()
-         * and will notice luringcb->ret has been filled in when it
-         * eventually runs later. Coroutines cannot be entered recursively
-         * so avoid doing that!
-         */
-        if (!qemu_coroutine_entered(luringcb->co)) {
-            aio_co_wake(luringcb->co);
-        }
+        luring_process_cqe(s, luringcb, ret);
     }
     qemu_bh_cancel(s->completion_bh);
 }
@@ -221,6 +240,22 @@ static int ioq_submit(LuringState *s)
     int ret = 0;
     LuringAIOCB *luringcb, *luringcb_next;
 
+    /*
+     * Prefer the AioContext's own ring, which aio_poll() submits together
+     * with waiting for events.  This is only possible from the AioContext's
+     * home thread; otherwise fall back to our private ring.
+     */
+    while ((luringcb = QSIMPLEQ_FIRST(&s->io_q.submit_queue))) {
+        if (!aio_io_uring_add_sqe(s->aio_context, &luringcb->sqeq,
+                                  &luringcb->cqe_handler)) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.submit_queue, next);
+        s->io_q.in_flight++;
+        s->io_q.in_queue--;
+        ret++;
+    }
+
     while (s->io_q.in_queue > 0) {
         /*
          * Try to fetch sqes from the ring for requests waiting in
@@ -271,6 +306,21 @@ static void luring_process_completions_and_submit(LuringState *s)
     aio_context_release(s->aio_context);
 }
 
+/* Completion of a request that was submitted with aio_io_uring_add_sqe() */
+static void luring_cqe_handler_cb(AioUringCqeHandler *handler)
+{
+    LuringAIOCB *luringcb = container_of(handler, LuringAIOCB, cqe_handler);
+    LuringState *s = luringcb->s;
+
+    aio_context_acquire(s->aio_context);
+    luring_process_cqe(s, luringcb, handler->cqe_res);
+
+    if (!s->io_q.plugged && s->io_q.in_queue > 0) {
+        ioq_submit(s);
+    }
+    aio_context_release(s->aio_context);
+}
+
 static void qemu_luring_completion_bh(void *opaque)
 {
     LuringState *s = opaque;
@@ -379,9 +429,11 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, LuringState *s, int fd,
     int ret;
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
+        .s          = s,
         .ret        = -EINPROGRESS,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
+        .cqe_handler.cb = luring_cqe_handler_cb,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
@@ -25,9 +25,15 @@
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
 
-#define MAX_IN_FLIGHT 16
+#define DEFAULT_IN_FLIGHT 16
+#define DEFAULT_MAX_IN_FLIGHT 64
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
-#define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+#define DEFAULT_MIRROR_BUF_SIZE (DEFAULT_IN_FLIGHT * MAX_IO_BYTES)
+
+/* Completed operations are evaluated in windows of at least this length... */
+#define MIRROR_ADAPT_WINDOW_NS (100 * SCALE_MS)
+/* ...and at least this many operations */
+#define MIRROR_ADAPT_MIN_OPS 8
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -74,6 +80,25 @@ typedef struct MirrorBlockJob {
     uint64_t last_pause_ns;
     unsigned long *in_flight_bitmap;
     unsigned in_flight;
+    /*
+     * Current limits for background operations.  in_flight_limit is
+     * adapted between min_in_flight and max_in_flight: it grows by one
+     * per window while throughput does not suffer and is halved when
+     * throughput drops as latency rises.  chunk_size splits buf_size
+     * among the operations in flight.  Both are read by query-block-jobs.
+     */
+    unsigned in_flight_limit;
+    unsigned min_in_flight, max_in_flight;
+    size_t chunk_size;
+    /* Statistics for the current adaptation window */
+    int64_t adapt_start_ns;
+    uint64_t adapt_ops;
+    uint64_t adapt_bytes;
+    uint64_t adapt_latency_ns;
+    /* Whether operations had to wait for a free slot during the window */
+    bool adapt_limited;
+    uint64_t last_throughput;
+    uint64_t last_latency_ns;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
@@ -105,6 +130,8 @@ struct MirrorOp {
     bool is_pseudo_op;
     bool is_active_write;
     bool is_in_flight;
+    /* Time at which the operation started doing I/O */
+    int64_t start_ns;
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
@@ -184,6 +211,82 @@ static void coroutine_fn mirror_wait_on_conflicts(MirrorOp *self,
     }
 }
 
+/*
+ * As before the limit was adaptive, chunks do not shrink below
+ * MAX_IO_BYTES: with a high limit, operations then wait for free buffer
+ * space instead of splitting the copy into many small requests.
+ */
+static void mirror_set_in_flight_limit(MirrorBlockJob *s, unsigned limit)
+{
+    size_t chunk_size;
+
+    chunk_size = QEMU_ALIGN_DOWN(s->buf_size / limit, s->granularity);
+    chunk_size = MAX(chunk_size, MAX_IO_BYTES);
+    qatomic_set(&s->in_flight_limit, limit);
+    qatomic_set(&s->chunk_size, MAX(chunk_size, s->granularity));
+}
+
+static void mirror_adapt_reset(MirrorBlockJob *s, int64_t now)
+{
+    s->adapt_start_ns = now;
+    s->adapt_ops = 0;
+    s->adapt_bytes = 0;
+    s->adapt_latency_ns = 0;
+    s->adapt_limited = false;
+}
+
+/*
+ * Account a completed background operation and, at the end of a window,
+ * adapt the number of operations in flight.  Only windows in which
+ * operations had to wait for a free slot tell anything about the target,
+ * so the limit is left alone otherwise.
+ */
+static void mirror_adapt(MirrorBlockJob *s, MirrorOp *op)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    uint64_t throughput, latency_ns;
+    unsigned limit = s->in_flight_limit;
+    int64_t elapsed;
+
+    if (s->min_in_flight == s->max_in_flight) {
+        return;
+    }
+
+    s->adapt_ops++;
+    s->adapt_bytes += op->bytes;
+    s->adapt_latency_ns += now - op->start_ns;
+
+    elapsed = now - s->adapt_start_ns;
+    if (elapsed < MIRROR_ADAPT_WINDOW_NS ||
+        s->adapt_ops < MIRROR_ADAPT_MIN_OPS) {
+        return;
+    }
+    if (!s->adapt_limited || elapsed > 10 * MIRROR_ADAPT_WINDOW_NS) {
+        /* Idle or paused for a while, the numbers are meaningless */
+        mirror_adapt_reset(s, now);
+        return;
+    }
+
+    throughput = s->adapt_bytes * NANOSECONDS_PER_SECOND / elapsed;
+    latency_ns = s->adapt_latency_ns / s->adapt_ops;
+
+    if (s->last_throughput && throughput * 10 < s->last_throughput * 9 &&
+        latency_ns > s->last_latency_ns) {
+        /* The extra requests only queue up somewhere, back off */
+        limit = MAX(limit / 2, s->min_in_flight);
+    } else {
+        limit = MIN(limit + 1, s->max_in_flight);
+    }
+
+    trace_mirror_adapt(s, throughput, latency_ns, limit);
+    if (limit != s->in_flight_limit) {
+        mirror_set_in_flight_limit(s, limit);
+    }
+    s->last_throughput = throughput;
+    s->last_latency_ns = latency_ns;
+    mirror_adapt_reset(s, now);
+}
+
 static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
@@ -213,6 +316,7 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
         }
         if (!s->initial_zeroing_ongoing) {
             job_progress_update(&s->common.job, op->bytes);
+            mirror_adapt(s, op);
         }
     }
     qemu_iovec_destroy(&op->qiov);
@@ -371,6 +475,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
 
     while (s->buf_free_count < nb_chunks) {
         trace_mirror_yield_in_flight(s, op->offset, s->in_flight);
+        s->adapt_limited = true;
         mirror_wait_for_free_in_flight_slot(s);
     }
 
@@ -391,6 +496,7 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->in_flight++;
     s->bytes_in_flight += op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
     ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
@@ -407,6 +513,7 @@ static void coroutine_fn mirror_co_zero(void *opaque)
     op->s->bytes_in_flight += op->bytes;
     *op->bytes_handled = op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     ret = blk_co_pwrite_zeroes(op->s->target, op->offset, op->bytes,
                                op->s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
@@ -422,6 +529,7 @@ static void coroutine_fn mirror_co_discard(void *opaque)
     op->s->bytes_in_flight += op->bytes;
     *op->bytes_handled = op->bytes;
     op->is_in_flight = true;
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     ret = blk_co_pdiscard(op->s->target, op->offset, op->bytes);
     mirror_write_complete(op, ret);
@@ -482,7 +590,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes = s->chunk_size;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -579,8 +687,9 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->in_flight_limit) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
+            s->adapt_limited = true;
             mirror_wait_for_free_in_flight_slot(s);
         }
 
@@ -832,7 +941,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->in_flight_limit) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -974,6 +1083,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     mirror_free_init(s);
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    mirror_adapt_reset(s, s->last_pause_ns);
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || job_is_cancelled(&s->common.job)) {
@@ -1022,9 +1132,12 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->in_flight_limit || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
+                if (cnt != 0) {
+                    s->adapt_limited = true;
+                }
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
             } else if (cnt != 0) {
@@ -1189,6 +1302,16 @@ static bool mirror_drained_poll(BlockJob *job)
     return !!s->in_flight;
 }
 
+static void mirror_query(BlockJob *job, BlockJobInfo *info)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+
+    info->has_mirror = true;
+    info->mirror = g_new0(BlockJobInfoMirror, 1);
+    info->mirror->in_flight_limit = qatomic_read(&s->in_flight_limit);
+    info->mirror->chunk_size = qatomic_read(&s->chunk_size);
+}
+
 static bool mirror_cancel(Job *job, bool force)
 {
     MirrorBlockJob *s = container_of(job, MirrorBlockJob, common.job);
@@ -1226,6 +1349,7 @@ static const BlockJobDriver mirror_job_driver = {
         .cancel                 = mirror_cancel,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = mirror_query,
 };
 
 static const BlockJobDriver commit_active_job_driver = {
@@ -1242,6 +1366,7 @@ static const BlockJobDriver commit_active_job_driver = {
         .cancel                 = commit_active_cancel,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = mirror_query,
 };
 
 static void coroutine_fn
@@ -1597,6 +1722,7 @@ static BlockJob *mirror_start_job(
                              int creation_flags, BlockDriverState *target,
                              const char *replaces, int64_t speed,
                              uint32_t granularity, int64_t buf_size,
+                             int64_t min_in_flight, int64_t max_in_flight,
                              BlockMirrorBackingMode backing_mode,
                              bool zero_target,
                              BlockdevOnError on_source_error,
@@ -1632,6 +1758,20 @@ static BlockJob *mirror_start_job(
         buf_size = DEFAULT_MIRROR_BUF_SIZE;
     }
 
+    if (min_in_flight == 0) {
+        min_in_flight = 1;
+    }
+    if (max_in_flight == 0) {
+        max_in_flight = MAX(DEFAULT_MAX_IN_FLIGHT, min_in_flight);
+    }
+    assert(min_in_flight <= MIRROR_MAX_IN_FLIGHT &&
+           max_in_flight <= MIRROR_MAX_IN_FLIGHT);
+    if (min_in_flight > max_in_flight) {
+        error_setg(errp, "Parameter 'min-in-flight' must not exceed "
+                   "'max-in-flight'");
+        return NULL;
+    }
+
     if (bdrv_skip_filters(bs) == bdrv_skip_filters(target)) {
         error_setg(errp, "Can't mirror node into itself");
         return NULL;
@@ -1760,6 +1900,10 @@ static BlockJob *mirror_start_job(
     s->base_overlay = bdrv_find_overlay(bs, base);
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->min_in_flight = min_in_flight;
+    s->max_in_flight = max_in_flight;
+    mirror_set_in_flight_limit(s, MIN(MAX(DEFAULT_IN_FLIGHT, min_in_flight),
+                                      max_in_flight));
     s->unmap = unmap;
     if (auto_complete) {
         s->should_complete = true;
@@ -1867,6 +2011,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
                   uint32_t granularity, int64_t buf_size,
+                  int64_t min_in_flight, int64_t max_in_flight,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   bool zero_target,
                   BlockdevOnError on_source_error,
@@ -1888,7 +2033,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
     is_none_mode = mode == MIRROR_SYNC_MODE_NONE;
     base = mode == MIRROR_SYNC_MODE_TOP ? bdrv_backing_chain_next(bs) : NULL;
     mirror_start_job(job_id, bs, creation_flags, target, replaces,
-                     speed, granularity, buf_size, backing_mode, zero_target,
+                     speed, granularity, buf_size, min_in_flight,
+                     max_in_flight, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
                      filter_node_name, true, copy_mode, errp);
@@ -1915,7 +2061,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
     }
 
     job = mirror_start_job(
-                     job_id, bs, creation_flags, base, NULL, speed, 0, 0,
+                     job_id, bs, creation_flags, base, NULL, speed, 0, 0, 0, 0,
                      MIRROR_LEAVE_BACKING_CHAIN, false,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
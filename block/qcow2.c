@@ -80,6 +80,7 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t bytes,
                            QEMUIOVector *qiov,
                            size_t qiov_offset);
+static void qcow2_dcache_clear(BlockDriverState *bs);
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -807,6 +808,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_COMPRESSED_READ_AHEAD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of compressed clusters to decompress ahead of "
+                    "sequential reads (read-only images only)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -968,6 +975,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    uint64_t compressed_read_ahead;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1069,6 +1077,23 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    /*
+     * Compressed cluster read-ahead. Decompressed clusters are cached by
+     * their host offset, which is only safe as long as nobody can write to
+     * the image, so silently ignore the option for writable images.
+     */
+    r->compressed_read_ahead =
+        qemu_opt_get_number(opts, QCOW2_OPT_COMPRESSED_READ_AHEAD, 0);
+    if (r->compressed_read_ahead > QCOW2_MAX_COMPRESSED_READ_AHEAD) {
+        error_setg(errp, QCOW2_OPT_COMPRESSED_READ_AHEAD " must not exceed %d",
+                   QCOW2_MAX_COMPRESSED_READ_AHEAD);
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (flags & BDRV_O_RDWR) {
+        r->compressed_read_ahead = 0;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1224,6 +1249,10 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /* The node is drained, so no cache entry can be in use */
+    qcow2_dcache_clear(bs);
+    s->compressed_read_ahead = r->compressed_read_ahead;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1590,6 +1619,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         }
     }
 
+    QTAILQ_INIT(&s->dcache);
+
     /* Parse driver-specific options */
     ret = qcow2_update_options(bs, options, flags, errp);
     if (ret < 0) {
@@ -2743,6 +2774,7 @@ static void qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_dcache_clear(bs);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4724,29 +4756,20 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/* Read the compressed cluster at @coffset and decompress it into @out_buf */
 static int coroutine_fn
-qcow2_co_preadv_compressed(BlockDriverState *bs,
-                           uint64_t l2_entry,
-                           uint64_t offset,
-                           uint64_t bytes,
-                           QEMUIOVector *qiov,
-                           size_t qiov_offset)
+qcow2_co_read_compressed_cluster(BlockDriverState *bs, uint64_t coffset,
+                                 int csize, uint8_t *out_buf)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret = 0, csize;
-    uint64_t coffset;
-    uint8_t *buf, *out_buf;
-    int offset_in_cluster = offset_into_cluster(s, offset);
-
-    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+    uint8_t *buf;
+    int ret;
 
     buf = g_try_malloc(csize);
     if (!buf) {
         return -ENOMEM;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
     BLKDBG_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
     ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
     if (ret < 0) {
@@ -4758,12 +4781,249 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
-    qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
-
 fail:
-    qemu_vfree(out_buf);
     g_free(buf);
+    return ret;
+}
+
+static void qcow2_dcache_free_entry(BlockDriverState *bs,
+                                    Qcow2DecompressedCluster *e)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    QTAILQ_REMOVE(&s->dcache, e, next);
+    s->dcache_size--;
+    qemu_vfree(e->data);
+    g_free(e);
+}
+
+static void qcow2_dcache_clear(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *e, *next_e;
+
+    QTAILQ_FOREACH_SAFE(e, &s->dcache, next, next_e) {
+        assert(e->ref == 0);
+        qcow2_dcache_free_entry(bs, e);
+    }
+    s->ra_next_offset = 0;
+    s->ra_end = 0;
+}
+
+/*
+ * Look up the decompressed cluster for @coffset. The cache holds at most
+ * twice the read-ahead window, so a linear search is good enough.
+ */
+static Qcow2DecompressedCluster *qcow2_dcache_find(BDRVQcow2State *s,
+                                                   uint64_t coffset)
+{
+    Qcow2DecompressedCluster *e;
+
+    QTAILQ_FOREACH(e, &s->dcache, next) {
+        if (e->coffset == coffset) {
+            QTAILQ_REMOVE(&s->dcache, e, next);
+            QTAILQ_INSERT_TAIL(&s->dcache, e, next);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Create a new cache entry for @coffset with a reference held by the caller
+ * and ret == -EINPROGRESS. The least recently used idle entry is evicted if
+ * the cache is full. Returns NULL if no entry can be allocated, in which case
+ * the caller must do without the cache.
+ */
+static Qcow2DecompressedCluster *
+qcow2_dcache_new_entry(BlockDriverState *bs, uint64_t coffset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2DecompressedCluster *e;
+
+    if (s->dcache_size >= 2 * s->compressed_read_ahead) {
+        QTAILQ_FOREACH(e, &s->dcache, next) {
+            if (e->ref == 0) {
+                break;
+            }
+        }
+        if (!e) {
+            return NULL;
+        }
+        qcow2_dcache_free_entry(bs, e);
+    }
+
+    e = g_new0(Qcow2DecompressedCluster, 1);
+    e->data = qemu_try_blockalign(bs, s->cluster_size);
+    if (!e->data) {
+        g_free(e);
+        return NULL;
+    }
+    e->coffset = coffset;
+    e->ret = -EINPROGRESS;
+    e->ref = 1;
+    qemu_co_queue_init(&e->waiters);
+
+    QTAILQ_INSERT_TAIL(&s->dcache, e, next);
+    s->dcache_size++;
+    return e;
+}
+
+static void qcow2_dcache_put(BlockDriverState *bs, Qcow2DecompressedCluster *e)
+{
+    assert(e->ref > 0);
+    if (--e->ref == 0 && e->ret < 0) {
+        /* Don't keep failed entries around, a later read may succeed */
+        qcow2_dcache_free_entry(bs, e);
+    }
+}
+
+static void coroutine_fn qcow2_dcache_fill(BlockDriverState *bs,
+                                           Qcow2DecompressedCluster *e,
+                                           int csize)
+{
+    e->ret = qcow2_co_read_compressed_cluster(bs, e->coffset, csize, e->data);
+    qemu_co_queue_restart_all(&e->waiters);
+}
+
+typedef struct Qcow2ReadAhead {
+    BlockDriverState *bs;
+    uint64_t offset;
+} Qcow2ReadAhead;
+
+static void coroutine_fn qcow2_co_read_ahead_entry(void *opaque)
+{
+    Qcow2ReadAhead *ra = opaque;
+    BlockDriverState *bs = ra->bs;
+    BDRVQcow2State *s = bs->opaque;
+    QCow2SubclusterType type;
+    Qcow2DecompressedCluster *e;
+    unsigned int bytes = s->cluster_size;
+    uint64_t l2_entry, coffset;
+    int ret, csize;
+
+    qemu_co_mutex_lock(&s->lock);
+    ret = qcow2_get_host_offset(bs, ra->offset, &bytes, &l2_entry, &type);
+    qemu_co_mutex_unlock(&s->lock);
+
+    if (ret < 0 || type != QCOW2_SUBCLUSTER_COMPRESSED ||
+        !s->compressed_read_ahead)
+    {
+        goto out;
+    }
+
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+    if (qcow2_dcache_find(s, coffset)) {
+        goto out;
+    }
+
+    e = qcow2_dcache_new_entry(bs, coffset);
+    if (e) {
+        trace_qcow2_read_ahead(bs, ra->offset);
+        qcow2_dcache_fill(bs, e, csize);
+        qcow2_dcache_put(bs, e);
+    }
+
+out:
+    g_free(ra);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Called for each compressed cluster the guest reads. If the read continues
+ * where the previous one ended, decompress up to s->compressed_read_ahead of
+ * the following clusters in the background. Each cluster gets its own
+ * coroutine, so reading and decompressing (in the thread pool) happen in
+ * parallel.
+ */
+static void qcow2_compressed_read_ahead(BlockDriverState *bs,
+                                        uint64_t offset, uint64_t bytes)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t start, end;
+    bool sequential = offset == s->ra_next_offset;
+
+    s->ra_next_offset = offset + bytes;
+    if (!sequential) {
+        s->ra_end = 0;
+        return;
+    }
+
+    start = MAX(s->ra_end, start_of_cluster(s, offset) + s->cluster_size);
+    end = MIN(start_of_cluster(s, offset) +
+              (uint64_t)(s->compressed_read_ahead + 1) * s->cluster_size,
+              bs->total_sectors * BDRV_SECTOR_SIZE);
+
+    for (; start < end; start += s->cluster_size) {
+        Qcow2ReadAhead *ra = g_new(Qcow2ReadAhead, 1);
+
+        *ra = (Qcow2ReadAhead) {
+            .bs = bs,
+            .offset = start,
+        };
+        bdrv_inc_in_flight(bs);
+        aio_co_schedule(bdrv_get_aio_context(bs),
+                        qemu_coroutine_create(qcow2_co_read_ahead_entry, ra));
+    }
+    s->ra_end = MAX(s->ra_end, end);
+}
 
+static int coroutine_fn
+qcow2_co_preadv_compressed(BlockDriverState *bs,
+                           uint64_t l2_entry,
+                           uint64_t offset,
+                           uint64_t bytes,
+                           QEMUIOVector *qiov,
+                           size_t qiov_offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret = 0, csize;
+    uint64_t coffset;
+    uint8_t *out_buf;
+    Qcow2DecompressedCluster *e;
+    int offset_in_cluster = offset_into_cluster(s, offset);
+
+    qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
+
+    if (s->compressed_read_ahead) {
+        qcow2_compressed_read_ahead(bs, offset, bytes);
+
+        e = qcow2_dcache_find(s, coffset);
+        if (e) {
+            trace_qcow2_dcache_hit(bs, offset);
+            e->ref++;
+            while (e->ret == -EINPROGRESS) {
+                qemu_co_queue_wait(&e->waiters, NULL);
+            }
+        } else {
+            e = qcow2_dcache_new_entry(bs, coffset);
+            if (e) {
+                qcow2_dcache_fill(bs, e, csize);
+            }
+        }
+
+        if (e) {
+            ret = e->ret;
+            if (ret == 0) {
+                qemu_iovec_from_buf(qiov, qiov_offset,
+                                    e->data + offset_in_cluster, bytes);
+            }
+            qcow2_dcache_put(bs, e);
+            if (ret == 0) {
+                return 0;
+            }
+            /* Retry without the cache if read-ahead failed */
+        }
+    }
+
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+    ret = qcow2_co_read_compressed_cluster(bs, coffset, csize, out_buf);
+    if (ret == 0) {
+        qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster,
+                            bytes);
+    }
+
+    qemu_vfree(out_buf);
     return ret;
 }
 
@@ -5233,6 +5493,21 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs,
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new(BlockStatsQcow2Cache, 1);
+    stats->u.qcow2.refcount_cache = g_new(BlockStatsQcow2Cache, 1);
+    qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    qcow2_cache_get_stats(s->refcount_block_cache,
+                          stats->u.qcow2.refcount_cache);
+
+    return stats;
+}
+
 static int qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
@@ -6080,6 +6355,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure           = qcow2_measure,
     .bdrv_get_info          = qcow2_get_info,
     .bdrv_get_specific_info = qcow2_get_specific_info,
+    .bdrv_get_specific_stats = qcow2_get_specific_stats,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
@@ -71,6 +71,9 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Maximum number of compressed clusters to decompress ahead of the guest */
+#define QCOW2_MAX_COMPRESSED_READ_AHEAD 64
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -149,6 +152,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_COMPRESSED_READ_AHEAD "compressed-read-ahead"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -419,8 +423,32 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    /*
+     * Read-ahead for compressed clusters. Only enabled for read-only images,
+     * so cached clusters can never become stale.
+     */
+    unsigned compressed_read_ahead; /* Clusters to read ahead, 0 = disabled */
+    unsigned dcache_size;           /* Number of entries in dcache */
+    QTAILQ_HEAD(, Qcow2DecompressedCluster) dcache; /* In LRU order */
+    uint64_t ra_next_offset; /* Guest offset after the last compressed read */
+    uint64_t ra_end;         /* Guest offset up to which read-ahead runs */
 } BDRVQcow2State;
 
+/*
+ * A decompressed compressed cluster, kept around so that streaming reads of
+ * compressed images can be served from clusters that were decompressed ahead
+ * of time.
+ */
+typedef struct Qcow2DecompressedCluster {
+    uint64_t coffset;   /* Host offset of the compressed data (cache key) */
+    uint8_t *data;      /* cluster_size bytes of decompressed data */
+    int ret;            /* -EINPROGRESS while being filled, then 0 or -errno */
+    int ref;            /* Number of coroutines using or waiting for data */
+    CoQueue waiters;    /* Coroutines waiting for ret != -EINPROGRESS */
+    QTAILQ_ENTRY(Qcow2DecompressedCluster) next;
+} Qcow2DecompressedCluster;
+
 typedef struct Qcow2COWRegion {
     /**
      * Offset of the COW region in bytes from the start of the first cluster
@@ -977,6 +1005,7 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, BlockStatsQcow2Cache *stats);
 
 /* qcow2-bitmap.c functions */
 int qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
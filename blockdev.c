@@ -2951,6 +2951,10 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_speed, int64_t speed,
                                    bool has_granularity, uint32_t granularity,
                                    bool has_buf_size, int64_t buf_size,
+                                   bool has_min_in_flight,
+                                   int64_t min_in_flight,
+                                   bool has_max_in_flight,
+                                   int64_t max_in_flight,
                                    bool has_on_source_error,
                                    BlockdevOnError on_source_error,
                                    bool has_on_target_error,
@@ -2981,6 +2985,12 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (!has_buf_size) {
         buf_size = 0;
     }
+    if (!has_min_in_flight) {
+        min_in_flight = 0;
+    }
+    if (!has_max_in_flight) {
+        max_in_flight = 0;
+    }
     if (!has_unmap) {
         unmap = true;
     }
@@ -3007,6 +3017,18 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                    "a power of 2");
         return;
     }
+    if (has_min_in_flight &&
+        (min_in_flight < 1 || min_in_flight > MIRROR_MAX_IN_FLIGHT)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "min-in-flight",
+                   "a value in range [1, 256]");
+        return;
+    }
+    if (has_max_in_flight &&
+        (max_in_flight < 1 || max_in_flight > MIRROR_MAX_IN_FLIGHT)) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-in-flight",
+                   "a value in range [1, 256]");
+        return;
+    }
 
     if (bdrv_op_is_blocked(bs, BLOCK_OP_TYPE_MIRROR_SOURCE, errp)) {
         return;
@@ -3066,7 +3088,8 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
      */
     mirror_start(job_id, bs, target,
                  has_replaces ? replaces : NULL, job_flags,
-                 speed, granularity, buf_size, sync, backing_mode, zero_target,
+                 speed, granularity, buf_size, min_in_flight, max_in_flight,
+                 sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
                  copy_mode, errp);
 }
@@ -3215,6 +3238,8 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_speed, arg->speed,
                            arg->has_granularity, arg->granularity,
                            arg->has_buf_size, arg->buf_size,
+                           arg->has_min_in_flight, arg->min_in_flight,
+                           arg->has_max_in_flight, arg->max_in_flight,
                            arg->has_on_source_error, arg->on_source_error,
                            arg->has_on_target_error, arg->on_target_error,
                            arg->has_unmap, arg->unmap,
@@ -3235,6 +3260,8 @@ void qmp_blockdev_mirror(bool has_job_id, const char *job_id,
                          bool has_speed, int64_t speed,
                          bool has_granularity, uint32_t granularity,
                          bool has_buf_size, int64_t buf_size,
+                         bool has_min_in_flight, int64_t min_in_flight,
+                         bool has_max_in_flight, int64_t max_in_flight,
                          bool has_on_source_error,
                          BlockdevOnError on_source_error,
                          bool has_on_target_error,
@@ -3285,6 +3312,8 @@ void qmp_blockdev_mirror(bool has_job_id, const char *job_id,
                            zero_target, has_speed, speed,
                            has_granularity, granularity,
                            has_buf_size, buf_size,
+                           has_min_in_flight, min_in_flight,
+                           has_max_in_flight, max_in_flight,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
                            true, true,
@@ -121,6 +121,19 @@ struct BHListSlice {
 
 typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * Completion handler for a request submitted with aio_io_uring_add_sqe().
+ * @cb is invoked from aio_poll() with @cqe_res set to the cqe's result.
+ */
+typedef struct AioUringCqeHandler AioUringCqeHandler;
+struct AioUringCqeHandler {
+    void (*cb)(AioUringCqeHandler *handler);
+    int cqe_res;
+    QSIMPLEQ_ENTRY(AioUringCqeHandler) next;
+};
+#endif
+
 struct AioContext {
     GSource source;
 
@@ -216,6 +229,15 @@ struct AioContext {
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+    bool fdmon_io_uring_multishot; /* is multishot poll supported? */
+    unsigned fdmon_io_uring_external_enable_gen; /* see fdmon-io_uring.c */
+
+    /*
+     * Completed aio_io_uring_add_sqe() requests, dispatched from aio_poll()
+     * through fdmon_io_uring_cqe_node.  Only accessed in the home thread.
+     */
+    QSIMPLEQ_HEAD(, AioUringCqeHandler) fdmon_io_uring_cqe_handlers;
+    AioHandler *fdmon_io_uring_cqe_node;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -225,6 +247,9 @@ struct AioContext {
 
     int external_disable_cnt;
 
+    /* Incremented whenever external_disable_cnt drops back to zero */
+    unsigned external_enable_gen;
+
     /* Number of AioHandlers without .io_poll() */
     int poll_disable_cnt;
 
@@ -645,6 +670,7 @@ static inline void aio_enable_external(AioContext *ctx)
     assert(old > 0);
     if (old == 1) {
         /* Kick event loop so it re-arms file descriptors */
+        qatomic_inc(&ctx->external_enable_gen);
         aio_notify(ctx);
     }
 }
@@ -673,6 +699,28 @@ static inline bool aio_node_check(AioContext *ctx, bool is_external)
     return !is_external || !qatomic_read(&ctx->external_disable_cnt);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_io_uring_add_sqe:
+ * @ctx: the aio context
+ * @sqe: a prepared sqe; its user_data field is ignored
+ * @handler: completion handler for the request
+ *
+ * Queue @sqe on the io_uring that @ctx uses for file descriptor monitoring,
+ * so that the request is submitted and its completion reaped by the same
+ * io_uring_enter(2) call that aio_poll() makes to wait for events.
+ * @handler->cb is invoked from aio_poll() once the request completes.
+ *
+ * Must be called from @ctx's home thread, but not from an FDMonOps callback.
+ *
+ * Returns: false if @ctx does not currently use io_uring for file descriptor
+ * monitoring or if called from another thread.  In that case the caller
+ * must submit the request itself.
+ */
+bool aio_io_uring_add_sqe(AioContext *ctx, const struct io_uring_sqe *sqe,
+                          AioUringCqeHandler *handler);
+#endif
+
 /**
  * aio_co_schedule:
  * @ctx: the aio context
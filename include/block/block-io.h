@@ -123,6 +123,11 @@ const char *bdrv_get_node_name(const BlockDriverState *bs);
 const char *bdrv_get_device_name(const BlockDriverState *bs);
 const char *bdrv_get_device_or_node_name(const BlockDriverState *bs);
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi);
+int bdrv_get_host_fd(BlockDriverState *bs);
+bool bdrv_host_fd_write_begin(BlockDriverState *bs, int64_t offset,
+                              int64_t bytes);
+void bdrv_host_fd_write_end(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes);
 ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs,
                                           Error **errp);
 BlockStatsSpecific *bdrv_get_specific_stats(BlockDriverState *bs);
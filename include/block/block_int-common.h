@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/throttle.h"
 #include "qemu/rcu.h"
@@ -88,6 +89,7 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_bytes;
 
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    IntervalTreeNode overlap_node; /* covers overlap_offset/overlap_bytes */
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
@@ -697,6 +699,15 @@ struct BlockDriver {
 
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
 
+    /*
+     * Return a host file descriptor from which data of @bs can be read
+     * directly, at the offsets returned in @map by bdrv_co_block_status().
+     * Only implement this if that mapping cannot change while @bs is open,
+     * and the result is not post-processed (decrypted, decompressed...).
+     * The file descriptor stays owned by @bs.
+     */
+    int (*bdrv_get_host_fd)(BlockDriverState *bs);
+
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs,
                                                  Error **errp);
     BlockStatsSpecific *(*bdrv_get_specific_stats)(BlockDriverState *bs);
@@ -1012,6 +1023,32 @@ typedef struct BdrvBlockStatusCache {
     int64_t data_end;
 } BdrvBlockStatusCache;
 
+/*
+ * Allows bdrv_co_block_status() to cache the allocation status reported
+ * by the driver of a node that supports backing files, for queries with
+ * want_zero == false.  Walking a backing chain then asks each layer's
+ * driver about each of its extents only once, instead of once for every
+ * query that reaches the layer.
+ *
+ * Extents are invalidated by writes to the node and dropped on graph
+ * changes.  Extents with @bytes == 0 are unused.
+ */
+#define BDRV_ALLOC_STATUS_CACHE_EXTENTS 8
+
+typedef struct BdrvAllocStatusExtent {
+    int64_t offset;
+    int64_t bytes;
+    int status;
+    int64_t map;
+    BlockDriverState *file;
+} BdrvAllocStatusExtent;
+
+typedef struct BdrvAllocStatusCache {
+    QemuMutex lock;
+    BdrvAllocStatusExtent extents[BDRV_ALLOC_STATUS_CACHE_EXTENTS];
+    unsigned int next; /* extent to replace when all are used */
+} BdrvAllocStatusCache;
+
 struct BlockDriverState {
     /*
      * Protected by big QEMU lock or read-only after opening.  No special
@@ -1193,6 +1230,7 @@ struct BlockDriverState {
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
     QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    IntervalTreeRoot tracked_requests_tree; /* by overlap range */
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -1206,6 +1244,8 @@ struct BlockDriverState {
     CoMutex bsc_modify_lock;
     /* Always non-NULL, but must only be dereferenced under an RCU read guard */
     BdrvBlockStatusCache *block_status_cache;
+
+    BdrvAllocStatusCache alloc_status_cache;
 };
 
 struct BlockBackendRootState {
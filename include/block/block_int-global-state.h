@@ -115,6 +115,10 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                               const char *filter_node_name,
                               BlockCompletionFunc *cb, void *opaque,
                               bool auto_complete, Error **errp);
+
+/* Upper bound for the number of copy operations a mirror job keeps in flight */
+#define MIRROR_MAX_IN_FLIGHT 256
+
 /*
  * mirror_start:
  * @job_id: The id of the newly-created job, or %NULL to use the
@@ -128,6 +132,10 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @granularity: The chosen granularity for the dirty bitmap.
  * @buf_size: The amount of data that can be in flight at one time.
+ * @min_in_flight: Lower bound for the number of copy operations in flight,
+ *                 or 0 for the default.
+ * @max_in_flight: Upper bound for the number of copy operations in flight,
+ *                 or 0 for the default.
  * @mode: Whether to collapse all images in the chain to the target.
  * @backing_mode: How to establish the target's backing chain after completion.
  * @zero_target: Whether the target should be explicitly zero-initialized
@@ -149,6 +157,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
                   uint32_t granularity, int64_t buf_size,
+                  int64_t min_in_flight, int64_t max_in_flight,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   bool zero_target,
                   BlockdevOnError on_source_error,
@@ -179,6 +179,38 @@ void bdrv_bsc_invalidate_range(BlockDriverState *bs,
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+/**
+ * Look up @offset in the allocation status cache.
+ *
+ * If a cached extent contains it, return true and set *status, *pnum,
+ * *map and *file as the driver's .bdrv_co_block_status() would for
+ * want_zero == false, with *pnum reaching the end of the extent.
+ * Otherwise, return false without touching them.
+ */
+bool bdrv_asc_lookup(BlockDriverState *bs, int64_t offset, int *status,
+                     int64_t *pnum, int64_t *map, BlockDriverState **file);
+
+/**
+ * Cache the allocation status of [offset, offset + bytes), as returned by
+ * the driver for want_zero == false, unless @bs->write_gen has moved
+ * away from @write_gen since the driver was asked.
+ */
+void bdrv_asc_fill(BlockDriverState *bs, unsigned int write_gen,
+                   int64_t offset, int64_t bytes, int status, int64_t map,
+                   BlockDriverState *file);
+
+/**
+ * Drop the cached allocation status of the extents that overlap
+ * [offset, offset + bytes).
+ */
+void bdrv_asc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes);
+
+/**
+ * Drop all of the cached allocation status of @bs.
+ */
+void bdrv_asc_clear(BlockDriverState *bs);
+
 
 /*
  * "I/O or GS" API functions. These functions can run without
@@ -68,6 +68,13 @@ struct BlockJobDriver {
     void (*attached_aio_context)(BlockJob *job, AioContext *new_context);
 
     void (*set_speed)(BlockJob *job, int64_t speed);
+
+    /*
+     * If the callback is not NULL, it will be invoked with the job lock held
+     * when querying the job, to fill in the job type specific members of
+     * @info.
+     */
+    void (*query)(BlockJob *job, BlockJobInfo *info);
 };
 
 /*
@@ -556,6 +556,8 @@ struct TranslationBlock {
     /* size of target code for this block (1 <= size <= TARGET_PAGE_SIZE) */
     uint16_t size;
     uint16_t icount;
+    /* executions left before the TB is hot, see accel/tcg/superblock.h */
+    int32_t exec_count;
 
     struct tb_tc tc;
 
@@ -71,6 +71,14 @@ struct RAMBlock {
      * could not have been valid on the source.
      */
     ram_addr_t postcopy_length;
+
+    /*
+     * Bitmap of the pages stored in this block's region of the migration
+     * file, and location of that region.  Only used with mapped-ram.
+     */
+    unsigned long *file_bmap;
+    off_t bitmap_offset;
+    uint64_t pages_offset;
 };
 #endif
 #endif
@@ -71,4 +71,37 @@
 #define bit_LZCNT       (1 << 5)
 #endif
 
+/*
+ * Return the bit_AVX2 and bit_AVX512F leaf 7 %ebx bits for the features
+ * that are not just available, but usable: the OS must also save the
+ * state of the registers they use.
+ */
+static inline unsigned cpuid_usable_avx(void)
+{
+    unsigned max = __get_cpuid_max(0, NULL);
+    unsigned ret = 0;
+    int a, b, c, d;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 0x6) == 0x6) {
+                ret |= b & bit_AVX2;
+            }
+            /* 0xe6:
+            *  XCR0[7:5] = 111b (OPMASK state, upper 256-bit of ZMM0-ZMM15
+            *                    and ZMM16-ZMM31 state are enabled by OS)
+            *  XCR0[2:1] = 11b (XMM state and YMM state are enabled by OS)
+            */
+            if ((bv & 0xe6) == 0xe6) {
+                ret |= b & bit_AVX512F;
+            }
+        }
+    }
+    return ret;
+}
+
 #endif /* QEMU_CPUID_H */
@@ -80,6 +80,15 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size);
  */
 void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result);
 
+/**
+ * test_hbitmap_next_accel:
+ *
+ * Switch the word kernels used by merge, count and fill to the next
+ * slower implementation, for tests and benchmarks.  Return false if the
+ * generic implementation was already in use.
+ */
+bool test_hbitmap_next_accel(void);
+
 /**
  * hbitmap_empty:
  * @hb: HBitmap to operate on.
@@ -0,0 +1,77 @@
+/*
+ * Intrusive interval tree
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * Nodes are embedded in the caller's structures and describe the closed
+ * interval [start, last].  Nodes are ordered by start; each one also
+ * caches the largest 'last' of its subtree, so that looking for the
+ * intervals that overlap a given range takes O(log n) plus the number of
+ * matches.  The tree is a treap, balanced by pseudo-random priorities.
+ *
+ * The tree does not provide any locking.
+ */
+
+typedef struct IntervalTreeNode {
+    struct IntervalTreeNode *parent, *left, *right;
+    uint64_t start;
+    uint64_t last;
+    /* private */
+    uint64_t subtree_last;
+    uint32_t priority;
+} IntervalTreeNode;
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *node;
+} IntervalTreeRoot;
+
+/**
+ * interval_tree_insert:
+ * @node: the node to insert, with @start and @last filled in
+ * @root: the tree
+ *
+ * Add @node to @root.  Several nodes may have the same interval.
+ */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_remove:
+ * @node: a node of @root
+ * @root: the tree
+ *
+ * Remove @node from @root.  To change the interval of a node, remove
+ * it, update @start and @last and insert it again.
+ */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_iter_first:
+ * @root: the tree
+ * @start: first value of the range
+ * @last: last value of the range
+ *
+ * Return the node with the lowest start among those that overlap
+ * [@start, @last], or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+
+/**
+ * interval_tree_iter_next:
+ * @node: a node returned by interval_tree_iter_first() or
+ *        interval_tree_iter_next() for the same range
+ * @start: first value of the range
+ * @last: last value of the range
+ *
+ * Return the next node, by increasing start, that overlaps
+ * [@start, @last], or NULL if there is none.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+#endif
@@ -594,6 +594,9 @@ struct TCGContext {
 
     TCGLabel *exitreq_label;
 
+    /* The ops refer to host data; see tcg_constant_host_ptr().  */
+    bool host_ptr_consts;
+
 #ifdef CONFIG_PLUGIN
     /*
      * We keep one plugin_tb struct per TCGContext. Note that on every TB
@@ -840,6 +843,23 @@ void tcg_register_thread(void);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
+/*
+ * Serialize the ops of @tb, as generated by the front end, to @buf.
+ * The result can only be loaded by the same QEMU binary, configured
+ * for the same CPU, on a host with the same tcg_host_features_checksum().
+ * Return false if the ops cannot be serialized, for example because
+ * they call plugins or refer to host data.
+ */
+bool tcg_ops_save(TCGContext *s, const TranslationBlock *tb, GByteArray *buf);
+
+/*
+ * Replace the front end for @tb, right after tcg_func_start(), with ops
+ * serialized by tcg_ops_save().  Return false if @data is malformed, in
+ * which case tcg_func_start() must be called again before translating.
+ */
+bool tcg_ops_load(TCGContext *s, const TranslationBlock *tb,
+                  const void *data, size_t size);
+
 int tcg_gen_code(TCGContext *s, TranslationBlock *tb, target_ulong pc_start);
 
 void tcg_set_frame(TCGContext *s, TCGReg reg, intptr_t start, intptr_t size);
@@ -1003,6 +1023,7 @@ do {\
 } while (0)
 
 bool tcg_op_supported(TCGOpcode op);
+void tcg_host_features_checksum(GChecksum *sum);
 
 void tcg_gen_callN(void *func, TCGTemp *ret, int nargs, TCGTemp **args);
 
@@ -1023,6 +1044,9 @@ void tcg_remove_ops_after(TCGOp *op);
 
 void tcg_optimize(TCGContext *s);
 
+/* Also eliminate redundant ops and dead stores to env in tcg_optimize(). */
+extern bool tcg_optimize_cse;
+
 /* Allocate a new temporary and initialize it with a constant. */
 TCGv_i32 tcg_const_i32(int32_t val);
 TCGv_i64 tcg_const_i64(int64_t val);
@@ -1063,6 +1087,20 @@ TCGv_vec tcg_constant_vec_matching(TCGv_vec match, unsigned vece, int64_t val);
 # define tcg_constant_ptr(x)     ((TCGv_ptr)tcg_constant_i64((intptr_t)(x)))
 #endif
 
+/**
+ * tcg_constant_host_ptr
+ * @ptr: host pointer
+ *
+ * Like tcg_constant_ptr(), for pointers into the data of this process
+ * rather than offsets.  The ops of the TB cannot be reused by another
+ * process, see tcg_ops_save().
+ */
+static inline TCGv_ptr tcg_constant_host_ptr(const void *ptr)
+{
+    tcg_ctx->host_ptr_consts = true;
+    return tcg_constant_ptr(ptr);
+}
+
 TCGLabel *gen_new_label(void);
 
 /**
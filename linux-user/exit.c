@@ -18,6 +18,8 @@
  */
 #include "qemu/osdep.h"
 #include "exec/gdbstub.h"
+#include "accel/tcg/perf.h"
+#include "accel/tcg/tb-cache.h"
 #include "qemu.h"
 #include "user-internals.h"
 #ifdef CONFIG_GPROF
@@ -38,4 +40,6 @@ void preexit_cleanup(CPUArchState *env, int code)
 #endif
         gdb_exit(code);
         qemu_plugin_user_exit();
+        perf_exit();
+        tb_cache_flush();
 }
@@ -49,6 +49,8 @@
 #include "target_elf.h"
 #include "cpu_loop-common.h"
 #include "crypto/init.h"
+#include "accel/tcg/perf.h"
+#include "accel/tcg/tb-cache.h"
 #include "fd-trans.h"
 #include "signal-common.h"
 #include "loader.h"
@@ -72,6 +74,9 @@ static envlist_t *envlist;
 static const char *cpu_model;
 static const char *cpu_type;
 static const char *seed_optarg;
+static const char *tb_cache_dir;
+static unsigned int superblock_threshold;
+static bool enable_cse;
 unsigned long mmap_min_addr;
 uintptr_t guest_base;
 bool have_guest_base;
@@ -404,6 +409,34 @@ static void handle_arg_strace(const char *arg)
     enable_strace = true;
 }
 
+static void handle_arg_perfmap(const char *arg)
+{
+    perf_enable_perfmap();
+}
+
+static void handle_arg_jitdump(const char *arg)
+{
+    perf_enable_jitdump();
+}
+
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static void handle_arg_superblock(const char *arg)
+{
+    if (qemu_strtoui(arg, NULL, 0, &superblock_threshold) < 0) {
+        fprintf(stderr, "Invalid superblock threshold: %s\n", arg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void handle_arg_cse(const char *arg)
+{
+    enable_cse = true;
+}
+
 static void handle_arg_version(const char *arg)
 {
     printf("qemu-" TARGET_NAME " version " QEMU_FULL_VERSION
@@ -479,6 +512,16 @@ static const struct qemu_argument arg_table[] = {
      "",           "run in singlestep mode"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
+    {"perfmap",    "QEMU_PERFMAP",     false, handle_arg_perfmap,
+     "",           "Generate a /tmp/perf-${pid}.map file for perf"},
+    {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
+     "",           "Generate a jit-${pid}.dump file for perf"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "keep translated code in 'dir' across runs"},
+    {"superblock", "QEMU_SUPERBLOCK",  true,  handle_arg_superblock,
+     "count",      "retranslate chains of TBs run 'count' times as one"},
+    {"cse",        "QEMU_CSE",         false, handle_arg_cse,
+     "",           "eliminate redundant TCG ops and stores to the CPU state"},
     {"seed",       "QEMU_RAND_SEED",   true,  handle_arg_seed,
      "",           "Seed for pseudo-random number generator"},
     {"trace",      "QEMU_TRACE",       true,  handle_arg_trace,
@@ -746,6 +789,11 @@ int main(int argc, char **argv, char **envp)
         AccelClass *ac = ACCEL_GET_CLASS(current_accel());
 
         accel_init_interfaces(ac);
+        object_property_set_uint(OBJECT(current_accel()),
+                                 "superblock-threshold",
+                                 superblock_threshold, &error_abort);
+        object_property_set_bool(OBJECT(current_accel()), "cse",
+                                 enable_cse, &error_abort);
         ac->init_machine(NULL);
     }
     cpu = cpu_create(cpu_type);
@@ -907,6 +955,10 @@ int main(int argc, char **argv, char **envp)
        the real value of GUEST_BASE into account.  */
     tcg_prologue_init(tcg_ctx);
 
+    if (tb_cache_dir) {
+        tb_cache_init(tb_cache_dir, cpu_model);
+    }
+
     target_cpu_copy_regs(env, regs);
 
     if (gdbstub) {
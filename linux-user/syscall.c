@@ -183,6 +183,7 @@ struct file_clone_range {
 #include "qapi/error.h"
 #include "fd-trans.h"
 #include "tcg/tcg.h"
+#include "accel/tcg/tb-cache.h"
 #include "cpu_loop-common.h"
 
 #ifndef CLONE_IO
@@ -8912,6 +8913,7 @@ static abi_long do_syscall1(CPUArchState *cpu_env, int num, abi_long arg1,
              * before the execve completes and makes it the other
              * program's problem.
              */
+            tb_cache_flush();
             if (is_proc_myself(p, "exe")) {
                 ret = get_errno(safe_execve(exec_path, argp, envp));
             } else {
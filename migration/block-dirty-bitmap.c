@@ -50,8 +50,16 @@
  * header
  * be64: start sector
  * be32: number of sectors
- * [ be64: buffer size  ] \ ! (flags & ZEROES)
+ * [ be64: buffer size  ] \ ! (flags & (ZEROES | RLE))
  * [ n bytes: buffer    ] /
+ * [ be32: number of runs ] \ flags & RLE
+ * [ n * be32: runs       ] /
+ *
+ * With the RLE flag, the chunk is described by the lengths, in bitmap
+ * granules, of alternating clean and dirty runs, starting with a (possibly
+ * empty) clean run.  The runs add up to the number of granules covered by
+ * the chunk.  RLE chunks are only sent if the dirty-bitmaps-rle capability
+ * is enabled, and only if they are smaller than the raw buffer.
  *
  * The last chunk in stream should contain flags & EOS. The chunk may skip
  * device and/or bitmap names, assuming them to be the same with the previous
@@ -71,6 +79,7 @@
 #include "migration/vmstate.h"
 #include "migration/register.h"
 #include "qemu/hbitmap.h"
+#include "qemu/bitmap.h"
 #include "qemu/cutils.h"
 #include "qemu/id.h"
 #include "qapi/error.h"
@@ -80,6 +89,8 @@
 #include "trace.h"
 
 #define CHUNK_SIZE     (1 << 10)
+/* Chunk size with the dirty-bitmaps-rle capability */
+#define RLE_CHUNK_SIZE (1 << 16)
 
 /* Flags occupy one, two or four bytes (Big Endian). The size is determined as
  * follows:
@@ -99,6 +110,9 @@
 
 #define DIRTY_BITMAP_MIG_EXTRA_FLAGS        0x80
 
+/* Flags sent in two bytes */
+#define DIRTY_BITMAP_MIG_FLAG_RLE           0x0100
+
 #define DIRTY_BITMAP_MIG_START_FLAG_ENABLED          0x01
 #define DIRTY_BITMAP_MIG_START_FLAG_PERSISTENT       0x02
 /* 0x04 was "AUTOLOAD" flags on older versions, now it is ignored */
@@ -356,7 +370,7 @@ bool check_dirty_bitmap_mig_alias_map(const BitmapMigrationNodeAliasList *bbm,
 
 static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 {
-    uint8_t flags = qemu_get_byte(f);
+    uint32_t flags = qemu_get_byte(f);
     if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
         flags = flags << 8 | qemu_get_byte(f);
         if (flags & DIRTY_BITMAP_MIG_EXTRA_FLAGS) {
@@ -369,10 +383,15 @@ static uint32_t qemu_get_bitmap_flags(QEMUFile *f)
 
 static void qemu_put_bitmap_flags(QEMUFile *f, uint32_t flags)
 {
-    /* The code currently does not send flags as more than one byte */
-    assert(!(flags & (0xffffff00 | DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
+    /* The code currently does not send flags as more than two bytes */
+    assert(!(flags & (0xffff0000 | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8 |
+                      DIRTY_BITMAP_MIG_EXTRA_FLAGS)));
 
-    qemu_put_byte(f, flags);
+    if (flags & 0xff00) {
+        qemu_put_be16(f, flags | DIRTY_BITMAP_MIG_EXTRA_FLAGS << 8);
+    } else {
+        qemu_put_byte(f, flags);
+    }
 }
 
 static void send_bitmap_header(QEMUFile *f, DBMSaveState *s,
@@ -418,6 +437,50 @@ static void send_bitmap_complete(QEMUFile *f, DBMSaveState *s,
     send_bitmap_header(f, s, dbms, DIRTY_BITMAP_MIG_FLAG_COMPLETE);
 }
 
+/*
+ * Describe @bytes of @bitmap starting at @offset as alternating clean and
+ * dirty runs of granules, starting with a clean run.  Returns the number
+ * of runs stored into @runs, or -1 if more than @max_runs are needed.
+ */
+static int64_t encode_bitmap_runs(BdrvDirtyBitmap *bitmap, uint64_t offset,
+                                  uint64_t bytes, uint32_t *runs,
+                                  int64_t max_runs)
+{
+    uint64_t gran = bdrv_dirty_bitmap_granularity(bitmap);
+    uint64_t end = offset + bytes;
+    uint64_t pos = offset;
+    uint64_t bit = 0, next_bit;
+    int64_t nr_runs = 0;
+
+    while (pos < end) {
+        int64_t dirty_start, dirty_count;
+
+        if (nr_runs + 2 > max_runs) {
+            return -1;
+        }
+
+        if (!bdrv_dirty_bitmap_next_dirty_area(bitmap, pos, end, INT64_MAX,
+                                               &dirty_start, &dirty_count)) {
+            dirty_start = end;
+            dirty_count = 0;
+        }
+
+        next_bit = DIV_ROUND_UP(dirty_start - offset, gran);
+        runs[nr_runs++] = next_bit - bit;
+        bit = next_bit;
+        if (!dirty_count) {
+            break;
+        }
+
+        next_bit = DIV_ROUND_UP(dirty_start + dirty_count - offset, gran);
+        runs[nr_runs++] = next_bit - bit;
+        bit = next_bit;
+        pos = dirty_start + dirty_count;
+    }
+
+    return nr_runs;
+}
+
 static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
                              SaveBitmapState *dbms,
                              uint64_t start_sector, uint32_t nr_sectors)
@@ -429,17 +492,39 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
             dbms->bitmap, start_sector << BDRV_SECTOR_BITS,
             (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
     uint64_t buf_size = QEMU_ALIGN_UP(unaligned_size, align);
-    uint8_t *buf = g_malloc0(buf_size);
+    uint8_t *buf = NULL;
+    g_autofree uint32_t *runs = NULL;
+    int64_t nr_runs = -1;
     uint32_t flags = DIRTY_BITMAP_MIG_FLAG_BITS;
 
-    bdrv_dirty_bitmap_serialize_part(
-        dbms->bitmap, buf, start_sector << BDRV_SECTOR_BITS,
-        (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
+    if (migrate_dirty_bitmaps_rle()) {
+        /* The run count and the runs must take less than the raw buffer */
+        int64_t max_runs = buf_size / sizeof(uint32_t) - 2;
+
+        runs = g_new(uint32_t, max_runs);
+        nr_runs = encode_bitmap_runs(dbms->bitmap,
+                                     start_sector << BDRV_SECTOR_BITS,
+                                     (uint64_t)nr_sectors << BDRV_SECTOR_BITS,
+                                     runs, max_runs);
+        if (nr_runs == 1) {
+            flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+        } else if (nr_runs > 0) {
+            flags |= DIRTY_BITMAP_MIG_FLAG_RLE;
+            buf_size = (nr_runs + 1) * sizeof(uint32_t);
+        }
+    }
+
+    if (nr_runs < 0) {
+        buf = g_malloc0(buf_size);
+        bdrv_dirty_bitmap_serialize_part(
+            dbms->bitmap, buf, start_sector << BDRV_SECTOR_BITS,
+            (uint64_t)nr_sectors << BDRV_SECTOR_BITS);
 
-    if (buffer_is_zero(buf, buf_size)) {
-        g_free(buf);
-        buf = NULL;
-        flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+        if (buffer_is_zero(buf, buf_size)) {
+            g_free(buf);
+            buf = NULL;
+            flags |= DIRTY_BITMAP_MIG_FLAG_ZEROES;
+        }
     }
 
     trace_send_bitmap_bits(flags, start_sector, nr_sectors, buf_size);
@@ -454,6 +539,13 @@ static void send_bitmap_bits(QEMUFile *f, DBMSaveState *s,
      * thus if we queue zero blocks we slow down the migration. */
     if (flags & DIRTY_BITMAP_MIG_FLAG_ZEROES) {
         qemu_fflush(f);
+    } else if (flags & DIRTY_BITMAP_MIG_FLAG_RLE) {
+        int64_t i;
+
+        qemu_put_be32(f, nr_runs);
+        for (i = 0; i < nr_runs; i++) {
+            qemu_put_be32(f, runs[i]);
+        }
     } else {
         qemu_put_be64(f, buf_size);
         qemu_put_buffer(f, buf, buf_size);
@@ -485,6 +577,7 @@ static int add_bitmaps_to_list(DBMSaveState *s, BlockDriverState *bs,
     SaveBitmapState *dbms;
     GHashTable *bitmap_aliases;
     const char *node_alias, *bitmap_name, *bitmap_alias;
+    uint64_t gran_sectors;
     Error *local_err = NULL;
 
     /* When an alias map is given, @bs_name must be @bs's node name */
@@ -573,8 +666,16 @@ static int add_bitmaps_to_list(DBMSaveState *s, BlockDriverState *bs,
         dbms->bitmap_alias = g_strdup(bitmap_alias);
         dbms->bitmap = bitmap;
         dbms->total_sectors = bdrv_nb_sectors(bs);
-        dbms->sectors_per_chunk = CHUNK_SIZE * 8LLU *
-            (bdrv_dirty_bitmap_granularity(bitmap) >> BDRV_SECTOR_BITS);
+        gran_sectors = bdrv_dirty_bitmap_granularity(bitmap) >>
+                       BDRV_SECTOR_BITS;
+        dbms->sectors_per_chunk =
+            (migrate_dirty_bitmaps_rle() ? RLE_CHUNK_SIZE : CHUNK_SIZE) *
+            8LLU * gran_sectors;
+        /* The number of sectors in a chunk is sent as be32 */
+        dbms->sectors_per_chunk = MIN(dbms->sectors_per_chunk,
+            QEMU_ALIGN_DOWN(UINT32_MAX,
+                            bdrv_dirty_bitmap_serialization_align(bitmap) >>
+                            BDRV_SECTOR_BITS));
         assert(dbms->sectors_per_chunk != 0);
         if (bdrv_dirty_bitmap_enabled(bitmap)) {
             dbms->flags |= DIRTY_BITMAP_MIG_START_FLAG_ENABLED;
@@ -973,6 +1074,80 @@ static void dirty_bitmap_load_complete(QEMUFile *f, DBMLoadState *s)
     }
 }
 
+/*
+ * Read the runs of an RLE chunk covering @nr_bytes from @first_byte and
+ * apply them to the bitmap.  The runs are read even if the incoming
+ * migration is (or gets) cancelled.
+ */
+static int dirty_bitmap_load_runs(QEMUFile *f, DBMLoadState *s,
+                                  uint64_t first_byte, uint64_t nr_bytes)
+{
+    uint32_t nr_runs = qemu_get_be32(f);
+    g_autofree unsigned long *buf = NULL;
+    uint64_t buf_size = 0, nr_bits = 0, bit = 0, i;
+    bool dirty = false;
+
+    /* RLE chunks are only sent if smaller than the raw buffer */
+    if (nr_runs > RLE_CHUNK_SIZE) {
+        error_report("Bitmap migration stream chunk has too many runs");
+        return -EIO;
+    }
+
+    if (!s->cancelled) {
+        buf_size = bdrv_dirty_bitmap_serialization_size(s->bitmap, first_byte,
+                                                        nr_bytes);
+        if (buf_size > 10 * RLE_CHUNK_SIZE) {
+            error_report("Bitmap migration stream buffer allocation request "
+                         "is too large");
+            return -EIO;
+        }
+        buf = g_malloc0(buf_size);
+        nr_bits = DIV_ROUND_UP(nr_bytes,
+                               bdrv_dirty_bitmap_granularity(s->bitmap));
+    }
+
+    for (i = 0; i < nr_runs; i++, dirty = !dirty) {
+        uint32_t run = qemu_get_be32(f);
+
+        if (!buf) {
+            continue;
+        }
+
+        if (run > nr_bits - bit) {
+            g_clear_pointer(&buf, g_free);
+            continue;
+        }
+        if (dirty) {
+            bitmap_set(buf, bit, run);
+        }
+        bit += run;
+    }
+
+    if (s->cancelled) {
+        return 0;
+    }
+
+    if (!buf || bit != nr_bits) {
+        error_report("Migrated bitmap granularity doesn't "
+                     "match the destination bitmap '%s' granularity",
+                     bdrv_dirty_bitmap_name(s->bitmap));
+        cancel_incoming_locked(s);
+        return 0;
+    }
+
+    /* Serialized bitmaps are made of little endian longs */
+    if (HOST_BIG_ENDIAN) {
+        for (i = 0; i < buf_size / sizeof(unsigned long); i++) {
+            buf[i] = BITS_PER_LONG == 32 ? cpu_to_le32(buf[i]) :
+                                           cpu_to_le64(buf[i]);
+        }
+    }
+    bdrv_dirty_bitmap_deserialize_part(s->bitmap, (uint8_t *)buf, first_byte,
+                                       nr_bytes, false);
+
+    return 0;
+}
+
 static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
 {
     uint64_t first_byte = qemu_get_be64(f) << BDRV_SECTOR_BITS;
@@ -986,6 +1161,8 @@ static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
             bdrv_dirty_bitmap_deserialize_zeroes(s->bitmap, first_byte,
                                                  nr_bytes, false);
         }
+    } else if (s->flags & DIRTY_BITMAP_MIG_FLAG_RLE) {
+        return dirty_bitmap_load_runs(f, s, first_byte, nr_bytes);
     } else {
         size_t ret;
         g_autofree uint8_t *buf = NULL;
@@ -997,12 +1174,13 @@ static int dirty_bitmap_load_bits(QEMUFile *f, DBMLoadState *s)
          * cancelled mode as we don't have the bitmap to check the constraints
          * (so, we allocate a buffer and read prior to the check). On the other
          * hand, we shouldn't blindly g_malloc the number from the stream.
-         * Actually one chunk should not be larger than CHUNK_SIZE. Let's allow
-         * a bit larger (which means that bitmap migration will fail anyway and
-         * the whole migration will most probably fail soon due to broken
-         * stream).
+         * Actually one chunk should not be larger than CHUNK_SIZE (or
+         * RLE_CHUNK_SIZE). Let's allow a bit larger (which means that bitmap
+         * migration will fail anyway and the whole migration will most
+         * probably fail soon due to broken stream).
          */
-        if (buf_size > 10 * CHUNK_SIZE) {
+        if (buf_size > 10 * (migrate_dirty_bitmaps_rle() ? RLE_CHUNK_SIZE :
+                                                           CHUNK_SIZE)) {
             error_report("Bitmap migration stream buffer allocation request "
                          "is too large");
             return -EIO;
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/cutils.h"
 #include "qemu/rcu.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
@@ -20,6 +21,7 @@
 #include "ram.h"
 #include "migration.h"
 #include "socket.h"
+#include "file.h"
 #include "tls.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -263,6 +265,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->pages_alloc = cpu_to_be32(p->pages->allocated);
     packet->normal_pages = cpu_to_be32(p->normal_num);
+    packet->zero_pages = cpu_to_be32(p->zero_num);
     packet->next_packet_size = cpu_to_be32(p->next_packet_size);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
@@ -276,6 +279,12 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
 
         packet->offset[i] = cpu_to_be64(temp);
     }
+
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t temp = p->zero[i];
+
+        packet->offset[p->normal_num + i] = cpu_to_be64(temp);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -324,10 +333,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->zero_num = be32_to_cpu(packet->zero_pages);
+    if (p->zero_num > packet->pages_alloc - p->normal_num) {
+        error_setg(errp, "multifd: received packet "
+                   "with %u zero pages and expected maximum zero pages are %u",
+                   p->zero_num, packet->pages_alloc - p->normal_num) ;
+        return -1;
+    }
+
     p->next_packet_size = be32_to_cpu(packet->next_packet_size);
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->normal_num == 0) {
+    if (p->normal_num == 0 && p->zero_num == 0) {
         return 0;
     }
 
@@ -353,6 +370,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->normal[i] = offset;
     }
 
+    for (i = 0; i < p->zero_num; i++) {
+        uint64_t offset = be64_to_cpu(packet->offset[p->normal_num + i]);
+
+        if (offset > (block->used_length - page_size)) {
+            error_setg(errp, "multifd: offset too long %" PRIu64
+                       " (max " RAM_ADDR_FMT ")",
+                       offset, block->used_length);
+            return -1;
+        }
+        p->zero[i] = offset;
+    }
+
     return 0;
 }
 
@@ -392,6 +421,39 @@ struct {
  * false.
  */
 
+/*
+ * With mapped-ram, the channels write the pages straight to their
+ * location in the migration file and no packets are sent at all.
+ */
+static uint32_t multifd_send_packet_len(MultiFDSendParams *p)
+{
+    return migrate_use_mapped_ram() ? 0 : p->packet_len;
+}
+
+/**
+ * multifd_send_account_pages: add a channel's classified pages to the stats
+ *
+ * With multifd-zero-page it is the channel thread that decides whether a
+ * queued page is zero, so the migration thread can only account for the
+ * page once the channel has looked at it.
+ *
+ * Returns the number of page bytes written to the channel since the
+ * previous call.  Must be called with p->mutex held.
+ *
+ * @p: Params for the channel
+ */
+static uint64_t multifd_send_account_pages(MultiFDSendParams *p)
+{
+    uint64_t bytes = p->unaccounted_normal_pages * qemu_target_page_size();
+
+    ram_counters.normal += p->unaccounted_normal_pages;
+    ram_counters.duplicate += p->unaccounted_zero_pages;
+    p->unaccounted_normal_pages = 0;
+    p->unaccounted_zero_pages = 0;
+
+    return bytes;
+}
+
 static int multifd_send_pages(QEMUFile *f)
 {
     int i;
@@ -433,8 +495,13 @@ static int multifd_send_pages(QEMUFile *f)
     p->packet_num = multifd_send_state->packet_num++;
     multifd_send_state->pages = p->pages;
     p->pages = pages;
-    transferred = ((uint64_t) pages->num) * qemu_target_page_size()
-                + p->packet_len;
+    if (migrate_use_multifd_zero_page()) {
+        transferred = multifd_send_account_pages(p)
+                    + multifd_send_packet_len(p);
+    } else {
+        transferred = ((uint64_t) pages->num) * qemu_target_page_size()
+                    + multifd_send_packet_len(p);
+    }
     qemu_file_acct_rate_limit(f, transferred);
     ram_counters.multifd_bytes += transferred;
     ram_counters.transferred += transferred;
@@ -535,7 +602,11 @@ void multifd_save_cleanup(void)
         if (p->registered_yank) {
             migration_ioc_unregister_yank(p->c);
         }
-        socket_send_channel_destroy(p->c);
+        if (migrate_use_mapped_ram()) {
+            file_send_channel_destroy(p->c);
+        } else {
+            socket_send_channel_destroy(p->c);
+        }
         p->c = NULL;
         qemu_mutex_destroy(&p->mutex);
         qemu_sem_destroy(&p->sem);
@@ -551,6 +622,8 @@ void multifd_save_cleanup(void)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_send_state->ops->send_cleanup(p, &local_err);
         if (local_err) {
             migrate_set_error(migrate_get_current(), local_err);
@@ -610,9 +683,9 @@ int multifd_send_sync_main(QEMUFile *f)
         p->packet_num = multifd_send_state->packet_num++;
         p->flags |= MULTIFD_FLAG_SYNC;
         p->pending_job++;
-        qemu_file_acct_rate_limit(f, p->packet_len);
-        ram_counters.multifd_bytes += p->packet_len;
-        ram_counters.transferred += p->packet_len;
+        qemu_file_acct_rate_limit(f, multifd_send_packet_len(p));
+        ram_counters.multifd_bytes += multifd_send_packet_len(p);
+        ram_counters.transferred += multifd_send_packet_len(p);
         qemu_mutex_unlock(&p->mutex);
         qemu_sem_post(&p->sem);
 
@@ -635,22 +708,85 @@ int multifd_send_sync_main(QEMUFile *f)
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&p->sem_sync);
     }
+    if (migrate_use_multifd_zero_page()) {
+        for (i = 0; i < migrate_multifd_channels(); i++) {
+            MultiFDSendParams *p = &multifd_send_state->params[i];
+            uint64_t transferred;
+
+            qemu_mutex_lock(&p->mutex);
+            transferred = multifd_send_account_pages(p);
+            qemu_mutex_unlock(&p->mutex);
+            qemu_file_acct_rate_limit(f, transferred);
+            ram_counters.multifd_bytes += transferred;
+            ram_counters.transferred += transferred;
+        }
+    }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 
     return 0;
 }
 
+/**
+ * multifd_send_mapped_ram: write a channel's pages to the migration file
+ *
+ * Each run of pages that are contiguous in the RAMBlock is contiguous
+ * in the file too, so it is written with a single positioned write.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @block: the RAMBlock the pages belong to
+ * @errp: pointer to an error
+ */
+static int multifd_send_mapped_ram(MultiFDSendParams *p, RAMBlock *block,
+                                   Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    int i, j;
+
+    for (i = 0; i < p->zero_num; i++) {
+        clear_bit_atomic(p->zero[i] / page_size, block->file_bmap);
+    }
+
+    for (i = 0; i < p->normal_num; i = j) {
+        struct iovec iov;
+
+        for (j = i + 1; j < p->normal_num; j++) {
+            if (p->normal[j] != p->normal[j - 1] + page_size) {
+                break;
+            }
+        }
+
+        iov.iov_base = block->host + p->normal[i];
+        iov.iov_len = (j - i) * page_size;
+        if (qio_channel_pwritev_all(p->c, &iov, 1,
+                                    block->pages_offset + p->normal[i],
+                                    errp) < 0) {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        set_bit_atomic(p->normal[i] / page_size, block->file_bmap);
+    }
+
+    return 0;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
     Error *local_err = NULL;
     int ret = 0;
     bool use_zero_copy_send = migrate_use_zero_copy_send();
+    bool use_zero_page = migrate_use_multifd_zero_page();
+    bool use_mapped_ram = migrate_use_mapped_ram();
+    size_t page_size = qemu_target_page_size();
 
     trace_multifd_send_thread_start(p->id);
     rcu_register_thread();
 
-    if (multifd_send_initial_packet(p, &local_err) < 0) {
+    if (!use_mapped_ram && multifd_send_initial_packet(p, &local_err) < 0) {
         ret = -1;
         goto out;
     }
@@ -668,7 +804,9 @@ static void *multifd_send_thread(void *opaque)
         if (p->pending_job) {
             uint64_t packet_num = p->packet_num;
             uint32_t flags = p->flags;
+            RAMBlock *block;
             p->normal_num = 0;
+            p->zero_num = 0;
 
             if (use_zero_copy_send) {
                 p->iovs_num = 0;
@@ -677,45 +815,71 @@ static void *multifd_send_thread(void *opaque)
             }
 
             for (int i = 0; i < p->pages->num; i++) {
-                p->normal[p->normal_num] = p->pages->offset[i];
-                p->normal_num++;
+                ram_addr_t offset = p->pages->offset[i];
+
+                if (use_zero_page &&
+                    buffer_is_zero(p->pages->block->host + offset, page_size)) {
+                    p->zero[p->zero_num] = offset;
+                    p->zero_num++;
+                } else {
+                    p->normal[p->normal_num] = offset;
+                    p->normal_num++;
+                }
+            }
+            if (use_zero_page) {
+                p->unaccounted_normal_pages += p->normal_num;
+                p->unaccounted_zero_pages += p->zero_num;
             }
 
-            if (p->normal_num) {
+            if (p->normal_num && !use_mapped_ram) {
                 ret = multifd_send_state->ops->send_prepare(p, &local_err);
                 if (ret != 0) {
                     qemu_mutex_unlock(&p->mutex);
                     break;
                 }
             }
-            multifd_send_fill_packet(p);
+            if (!use_mapped_ram) {
+                multifd_send_fill_packet(p);
+            }
+            block = p->pages->block;
             p->flags = 0;
             p->num_packets++;
             p->total_normal_pages += p->normal_num;
+            p->total_zero_pages += p->zero_num;
             p->pages->num = 0;
             p->pages->block = NULL;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, p->normal_num, flags,
-                               p->next_packet_size);
+            trace_multifd_send(p->id, packet_num, p->normal_num, p->zero_num,
+                               flags, p->next_packet_size);
 
-            if (use_zero_copy_send) {
-                /* Send header first, without zerocopy */
-                ret = qio_channel_write_all(p->c, (void *)p->packet,
-                                            p->packet_len, &local_err);
-                if (ret != 0) {
-                    break;
+            if (use_mapped_ram) {
+                if (block) {
+                    ret = multifd_send_mapped_ram(p, block, &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
                 }
             } else {
-                /* Send header using the same writev call */
-                p->iov[0].iov_len = p->packet_len;
-                p->iov[0].iov_base = p->packet;
-            }
+                if (use_zero_copy_send) {
+                    /* Send header first, without zerocopy */
+                    ret = qio_channel_write_all(p->c, (void *)p->packet,
+                                                p->packet_len, &local_err);
+                    if (ret != 0) {
+                        break;
+                    }
+                } else {
+                    /* Send header using the same writev call */
+                    p->iov[0].iov_len = p->packet_len;
+                    p->iov[0].iov_base = p->packet;
+                }
 
-            ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num, NULL,
-                                              0, p->write_flags, &local_err);
-            if (ret != 0) {
-                break;
+                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                                  NULL, 0, p->write_flags,
+                                                  &local_err);
+                if (ret != 0) {
+                    break;
+                }
             }
 
             qemu_mutex_lock(&p->mutex);
@@ -756,7 +920,8 @@ out:
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -939,6 +1104,7 @@ int multifd_save_setup(Error **errp)
         /* We need one extra place for the packet header */
         p->iov = g_new0(struct iovec, page_count + 1);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
 
         if (migrate_use_zero_copy_send()) {
             p->write_flags = QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
@@ -946,7 +1112,11 @@ int multifd_save_setup(Error **errp)
             p->write_flags = 0;
         }
 
-        socket_send_channel_create(multifd_new_send_channel_async, p);
+        if (migrate_use_mapped_ram()) {
+            file_send_channel_create(multifd_new_send_channel_async, p);
+        } else {
+            socket_send_channel_create(multifd_new_send_channel_async, p);
+        }
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -975,6 +1145,15 @@ struct {
     MultiFDMethods *ops;
 } *multifd_recv_state;
 
+/*
+ * With mapped-ram, the destination reads RAM straight from the file in
+ * ram_load_precopy(), so no receive channel is ever created.
+ */
+bool multifd_recv_uses_channels(void)
+{
+    return migrate_use_multifd() && !migrate_use_mapped_ram();
+}
+
 static void multifd_recv_terminate_threads(Error *err)
 {
     int i;
@@ -1013,7 +1192,8 @@ int multifd_load_cleanup(Error **errp)
 {
     int i;
 
-    if (!migrate_use_multifd() || !migrate_multi_channels_is_allowed()) {
+    if (!multifd_recv_uses_channels() ||
+        !migrate_multi_channels_is_allowed()) {
         return 0;
     }
     multifd_recv_terminate_threads(NULL);
@@ -1047,6 +1227,8 @@ int multifd_load_cleanup(Error **errp)
         p->iov = NULL;
         g_free(p->normal);
         p->normal = NULL;
+        g_free(p->zero);
+        p->zero = NULL;
         multifd_recv_state->ops->recv_cleanup(p);
     }
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
@@ -1062,7 +1244,7 @@ void multifd_recv_sync_main(void)
 {
     int i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_uses_channels()) {
         return;
     }
     for (i = 0; i < migrate_multifd_channels(); i++) {
@@ -1085,6 +1267,23 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/**
+ * multifd_recv_zero_pages: materialize the zero pages of a packet
+ *
+ * Pages that are already zero are left untouched, so that memory that
+ * the guest never wrote on the destination does not get populated.
+ *
+ * @p: Params for the channel that we are using
+ */
+static void multifd_recv_zero_pages(MultiFDRecvParams *p)
+{
+    size_t page_size = qemu_target_page_size();
+
+    for (int i = 0; i < p->zero_num; i++) {
+        ram_handle_compressed(p->host + p->zero[i], 0, page_size);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1120,10 +1319,11 @@ static void *multifd_recv_thread(void *opaque)
         flags = p->flags;
         /* recv methods don't know how to handle the SYNC flag */
         p->flags &= ~MULTIFD_FLAG_SYNC;
-        trace_multifd_recv(p->id, p->packet_num, p->normal_num, flags,
-                           p->next_packet_size);
+        trace_multifd_recv(p->id, p->packet_num, p->normal_num, p->zero_num,
+                           flags, p->next_packet_size);
         p->num_packets++;
         p->total_normal_pages += p->normal_num;
+        p->total_zero_pages += p->zero_num;
         qemu_mutex_unlock(&p->mutex);
 
         if (p->normal_num) {
@@ -1133,6 +1333,10 @@ static void *multifd_recv_thread(void *opaque)
             }
         }
 
+        if (p->zero_num) {
+            multifd_recv_zero_pages(p);
+        }
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1148,7 +1352,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->total_normal_pages,
+                                  p->total_zero_pages);
 
     return NULL;
 }
@@ -1159,7 +1364,7 @@ int multifd_load_setup(Error **errp)
     uint32_t page_count = MULTIFD_PACKET_SIZE / qemu_target_page_size();
     uint8_t i;
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_uses_channels()) {
         return 0;
     }
     if (!migrate_multi_channels_is_allowed()) {
@@ -1186,6 +1391,7 @@ int multifd_load_setup(Error **errp)
         p->name = g_strdup_printf("multifdrecv_%d", i);
         p->iov = g_new0(struct iovec, page_count);
         p->normal = g_new0(ram_addr_t, page_count);
+        p->zero = g_new0(ram_addr_t, page_count);
     }
 
     for (i = 0; i < thread_count; i++) {
@@ -1206,7 +1412,7 @@ bool multifd_recv_all_channels_created(void)
 {
     int thread_count = migrate_multifd_channels();
 
-    if (!migrate_use_multifd()) {
+    if (!multifd_recv_uses_channels()) {
         return true;
     }
 
@@ -919,3 +919,56 @@ QIOChannel *qemu_file_get_ioc(QEMUFile *file)
 {
     return file->ioc;
 }
+
+/*
+ * Get the position of the file cursor in the underlying channel,
+ * taking into account what has been buffered but not yet written,
+ * or read ahead but not yet consumed.
+ *
+ * Returns -1 and sets the file error if the channel is not seekable.
+ */
+off_t qemu_get_offset(QEMUFile *f)
+{
+    Error *local_err = NULL;
+    off_t pos;
+
+    qemu_fflush(f);
+
+    pos = qio_channel_io_seek(f->ioc, 0, SEEK_CUR, &local_err);
+    if (pos < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+        return -1;
+    }
+
+    if (!qemu_file_is_writable(f)) {
+        pos -= f->buf_size - f->buf_index;
+    }
+
+    return pos;
+}
+
+/*
+ * Move the file cursor, e.g. to skip over a region of the file that
+ * is accessed with positioned I/O on the underlying channel.
+ */
+void qemu_set_offset(QEMUFile *f, off_t off, int whence)
+{
+    Error *local_err = NULL;
+    off_t ret;
+
+    if (qemu_file_is_writable(f)) {
+        qemu_fflush(f);
+    } else {
+        /* Drop the read-ahead buffer */
+        if (whence == SEEK_CUR) {
+            off -= f->buf_size - f->buf_index;
+        }
+        f->buf_index = 0;
+        f->buf_size = 0;
+    }
+
+    ret = qio_channel_io_seek(f->ioc, off, whence, &local_err);
+    if (ret < 0) {
+        qemu_file_set_error_obj(f, -EIO, local_err);
+    }
+}
@@ -83,6 +83,32 @@
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
 
+/*
+ * mapped-ram: the RAM_SAVE_FLAG_MEM_SIZE entry of each RAMBlock is
+ * followed by a MappedRamHeader describing where the block's page
+ * bitmap and pages live in the file.  The pages region of a block is a
+ * direct image of its memory: page N of the block is always stored at
+ * pages_offset + N * page_size.
+ */
+#define MAPPED_RAM_HDR_VERSION 1
+
+/* Alignment of the pages region, so that it can be read with O_DIRECT */
+#define MAPPED_RAM_FILE_OFFSET_ALIGNMENT 0x100000
+
+typedef struct {
+    uint32_t version;
+    uint32_t unused;        /* Reserved for future use */
+    uint64_t page_size;
+    uint64_t bitmap_offset; /* absolute offset of the page bitmap */
+    uint64_t pages_offset;  /* absolute offset of the pages region */
+} QEMU_PACKED MappedRamHeader;
+
+/* On-disk size of a mapped-ram bitmap: little endian 64-bit words */
+static size_t mapped_ram_bitmap_size(long num_pages)
+{
+    return ROUND_UP(num_pages, 64) / BITS_PER_BYTE;
+}
+
 XBZRLECacheStats xbzrle_counters;
 
 /* struct contains XBZRLE cache and a static page
@@ -1280,7 +1306,23 @@ static int save_zero_page_to_file(RAMState *rs, QEMUFile *file,
  */
 static int save_zero_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
 {
-    int len = save_zero_page_to_file(rs, rs->f, block, offset);
+    int len;
+
+    if (migrate_use_mapped_ram()) {
+        if (!buffer_is_zero(block->host + offset, TARGET_PAGE_SIZE)) {
+            return -1;
+        }
+        /*
+         * Nothing to write: the destination starts with zeroed memory,
+         * we only need to forget about any data written to the file for
+         * this page in a previous iteration.
+         */
+        clear_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+        ram_counters.duplicate++;
+        return 1;
+    }
+
+    len = save_zero_page_to_file(rs, rs->f, block, offset);
 
     if (len) {
         ram_counters.duplicate++;
@@ -1402,13 +1444,49 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss)
     return pages;
 }
 
+/**
+ * ram_save_mapped_ram_page: write a page at its fixed offset in the file
+ *
+ * Returns the number of pages written, or < 0 on error
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static int ram_save_mapped_ram_page(RAMState *rs, RAMBlock *block,
+                                    ram_addr_t offset)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(rs->f);
+    struct iovec iov = {
+        .iov_base = block->host + offset,
+        .iov_len = TARGET_PAGE_SIZE,
+    };
+    Error *local_err = NULL;
+
+    if (qio_channel_pwritev_all(ioc, &iov, 1, block->pages_offset + offset,
+                                &local_err) < 0) {
+        qemu_file_set_error_obj(rs->f, -EIO, local_err);
+        return -1;
+    }
+
+    set_bit_atomic(offset >> TARGET_PAGE_BITS, block->file_bmap);
+    qemu_file_acct_rate_limit(rs->f, TARGET_PAGE_SIZE);
+    ram_transferred_add(TARGET_PAGE_SIZE);
+    ram_counters.normal++;
+
+    return 1;
+}
+
 static int ram_save_multifd_page(RAMState *rs, RAMBlock *block,
                                  ram_addr_t offset)
 {
     if (multifd_queue_page(rs->f, block, offset) < 0) {
         return -1;
     }
-    ram_counters.normal++;
+    /* With multifd-zero-page the channels account for their own pages */
+    if (!migrate_use_multifd_zero_page()) {
+        ram_counters.normal++;
+    }
 
     return 1;
 }
@@ -2281,6 +2359,7 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
 {
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
+    bool use_multifd;
     int res;
 
     if (control_save_page(rs, block, offset, &res)) {
@@ -2291,30 +2370,39 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss)
         return 1;
     }
 
-    res = save_zero_page(rs, block, offset);
-    if (res > 0) {
-        /* Must let xbzrle know, otherwise a previous (now 0'd) cached
-         * page would be stale
-         */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
-        }
-        return res;
-    }
-
     /*
      * Do not use multifd for:
      * 1. Compression as the first page in the new block should be posted out
      *    before sending the compressed page
      * 2. In postcopy as one whole host page should be placed
      */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()
-        && !migration_in_postcopy()) {
+    use_multifd = !save_page_use_compression(rs) && migrate_use_multifd()
+                  && !migration_in_postcopy();
+
+    /* With multifd-zero-page, the multifd channels look for zero pages */
+    if (!use_multifd || !migrate_use_multifd_zero_page()) {
+        res = save_zero_page(rs, block, offset);
+        if (res > 0) {
+            /* Must let xbzrle know, otherwise a previous (now 0'd) cached
+             * page would be stale
+             */
+            if (!save_page_use_compression(rs)) {
+                XBZRLE_cache_lock();
+                xbzrle_cache_zero_page(rs, block->offset + offset);
+                XBZRLE_cache_unlock();
+            }
+            return res;
+        }
+    }
+
+    if (use_multifd) {
         return ram_save_multifd_page(rs, block, offset);
     }
 
+    if (migrate_use_mapped_ram()) {
+        return ram_save_mapped_ram_page(rs, block, offset);
+    }
+
     return ram_save_page(rs, pss);
 }
 
@@ -2683,6 +2771,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->file_bmap);
+        block->file_bmap = NULL;
     }
 
     xbzrle_cleanup();
@@ -3184,6 +3274,77 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
+/**
+ * mapped_ram_setup_ramblock: reserve the file region of a RAMBlock
+ *
+ * Writes the mapped-ram header of @block and moves the file cursor past
+ * the bitmap and pages regions, which are filled in with positioned
+ * writes while migrating.
+ *
+ * @file: the migration file, positioned right after the block's entry
+ * @block: the RAMBlock
+ */
+static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
+{
+    MappedRamHeader header = {};
+    long num_pages = block->used_length >> TARGET_PAGE_BITS;
+    off_t header_offset;
+
+    header_offset = qemu_get_offset(file);
+    if (header_offset < 0) {
+        return;
+    }
+
+    block->file_bmap = bitmap_new(num_pages);
+    block->bitmap_offset = header_offset + sizeof(header);
+    block->pages_offset = ROUND_UP(block->bitmap_offset +
+                                   mapped_ram_bitmap_size(num_pages),
+                                   MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
+
+    header.version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header.page_size = cpu_to_be64(TARGET_PAGE_SIZE);
+    header.bitmap_offset = cpu_to_be64(block->bitmap_offset);
+    header.pages_offset = cpu_to_be64(block->pages_offset);
+
+    qemu_put_buffer(file, (uint8_t *)&header, sizeof(header));
+
+    /* The next block goes after this one's pages */
+    qemu_set_offset(file, block->pages_offset + block->used_length, SEEK_SET);
+}
+
+/**
+ * mapped_ram_write_bitmaps: write the page bitmap of every RAMBlock
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @file: the migration file
+ */
+static int mapped_ram_write_bitmaps(QEMUFile *file)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(file);
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        long num_pages = block->used_length >> TARGET_PAGE_BITS;
+        size_t bitmap_size = mapped_ram_bitmap_size(num_pages);
+        g_autofree unsigned long *le_bmap = g_malloc0(bitmap_size);
+        struct iovec iov = {
+            .iov_base = le_bmap,
+            .iov_len = bitmap_size,
+        };
+        Error *local_err = NULL;
+
+        bitmap_to_le(le_bmap, block->file_bmap, num_pages);
+        if (qio_channel_pwritev_all(ioc, &iov, 1, block->bitmap_offset,
+                                    &local_err) < 0) {
+            qemu_file_set_error_obj(file, -EIO, local_err);
+            return -EIO;
+        }
+    }
+
+    return 0;
+}
+
 /*
  * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
  * long-running RCU critical section.  When rcu-reclaims in the code
@@ -3205,6 +3366,13 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     RAMBlock *block;
     int ret;
 
+    if (migrate_use_mapped_ram() &&
+        !qio_channel_has_feature(qemu_file_get_ioc(f),
+                                 QIO_CHANNEL_FEATURE_SEEKABLE)) {
+        error_report("mapped-ram requires a seekable migration channel");
+        return -1;
+    }
+
     if (compress_threads_save_setup()) {
         return -1;
     }
@@ -3232,6 +3400,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
             if (migrate_ignore_shared()) {
                 qemu_put_be64(f, block->mr->addr);
             }
+            if (migrate_use_mapped_ram()) {
+                mapped_ram_setup_ramblock(f, block);
+            }
         }
     }
 
@@ -3428,6 +3599,15 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
         return ret;
     }
 
+    if (migrate_use_mapped_ram()) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            ret = mapped_ram_write_bitmaps(f);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     qemu_fflush(f);
 
@@ -4194,6 +4374,177 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
+typedef struct {
+    QIOChannel *ioc;
+    RAMBlock *block;
+    unsigned long *bitmap;
+    /* range of pages handled by this job */
+    unsigned long start;
+    unsigned long end;
+    uint64_t pages_offset;
+    QemuThread thread;
+    Error *err;
+} MappedRamLoadJob;
+
+/*
+ * Read all the pages of a job's range that are present in the file,
+ * one positioned read per run of contiguous pages.
+ */
+static void *mapped_ram_load_thread(void *opaque)
+{
+    MappedRamLoadJob *job = opaque;
+    unsigned long set, clear;
+
+    for (set = find_next_bit(job->bitmap, job->end, job->start);
+         set < job->end;
+         set = find_next_bit(job->bitmap, job->end, clear)) {
+        struct iovec iov;
+
+        clear = find_next_zero_bit(job->bitmap, job->end, set + 1);
+        iov.iov_base = job->block->host + ((ram_addr_t)set << TARGET_PAGE_BITS);
+        iov.iov_len = (size_t)(clear - set) << TARGET_PAGE_BITS;
+
+        if (qio_channel_preadv_all(job->ioc, &iov, 1,
+                                   job->pages_offset +
+                                   ((uint64_t)set << TARGET_PAGE_BITS),
+                                   &job->err) < 0) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * mapped_ram_read_pages: load a RAMBlock from its mapped-ram region
+ *
+ * The page range is split among as many threads as there are multifd
+ * channels, so that restoring scales with the storage bandwidth.
+ *
+ * Returns zero to indicate success and negative for error
+ */
+static int mapped_ram_read_pages(QIOChannel *ioc, RAMBlock *block,
+                                 unsigned long *bitmap, long num_pages,
+                                 uint64_t pages_offset)
+{
+    int nr_jobs = migrate_use_multifd() ? migrate_multifd_channels() : 1;
+    g_autofree MappedRamLoadJob *jobs = g_new0(MappedRamLoadJob, nr_jobs);
+    unsigned long chunk;
+    int i, ret = 0;
+
+    /* Keep the jobs' boundaries on bitmap word boundaries */
+    chunk = ROUND_UP(DIV_ROUND_UP(num_pages, nr_jobs), BITS_PER_LONG);
+
+    for (i = 0; i < nr_jobs; i++) {
+        MappedRamLoadJob *job = &jobs[i];
+
+        job->ioc = ioc;
+        job->block = block;
+        job->bitmap = bitmap;
+        job->start = MIN(i * chunk, num_pages);
+        job->end = MIN(job->start + chunk, num_pages);
+        job->pages_offset = pages_offset;
+
+        if (i == nr_jobs - 1) {
+            mapped_ram_load_thread(job);
+        } else {
+            qemu_thread_create(&job->thread, "mapped-ram-load",
+                               mapped_ram_load_thread, job,
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    for (i = 0; i < nr_jobs; i++) {
+        MappedRamLoadJob *job = &jobs[i];
+
+        if (i != nr_jobs - 1) {
+            qemu_thread_join(&job->thread);
+        }
+        if (job->err) {
+            if (!ret) {
+                error_reportf_err(job->err, "Failed to load RAM block %s: ",
+                                  block->idstr);
+                ret = -EIO;
+            } else {
+                error_free(job->err);
+            }
+        }
+    }
+
+    return ret;
+}
+
+/**
+ * parse_ramblock_mapped_ram: load a RAMBlock saved with mapped-ram
+ *
+ * Returns zero to indicate success and negative for error
+ *
+ * @f: the migration file, positioned at the block's MappedRamHeader
+ * @block: the RAMBlock
+ * @length: the length of the block in the file
+ */
+static int parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
+                                     ram_addr_t length)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    g_autofree unsigned long *bitmap = NULL;
+    MappedRamHeader header;
+    Error *local_err = NULL;
+    struct iovec iov;
+    long num_pages;
+    int ret;
+
+    if (qemu_get_buffer(f, (uint8_t *)&header, sizeof(header)) !=
+        sizeof(header)) {
+        error_report("Failed to read mapped-ram header of block %s",
+                     block->idstr);
+        return -EINVAL;
+    }
+
+    header.version = be32_to_cpu(header.version);
+    header.page_size = be64_to_cpu(header.page_size);
+    header.bitmap_offset = be64_to_cpu(header.bitmap_offset);
+    header.pages_offset = be64_to_cpu(header.pages_offset);
+
+    if (header.version > MAPPED_RAM_HDR_VERSION) {
+        error_report("Unsupported mapped-ram header version %" PRIu32
+                     " (max %d) for block %s", header.version,
+                     MAPPED_RAM_HDR_VERSION, block->idstr);
+        return -EINVAL;
+    }
+
+    if (header.page_size != TARGET_PAGE_SIZE) {
+        error_report("Mismatched mapped-ram page size %" PRIu64
+                     " (expected %d) for block %s", header.page_size,
+                     TARGET_PAGE_SIZE, block->idstr);
+        return -EINVAL;
+    }
+
+    num_pages = length >> TARGET_PAGE_BITS;
+    iov.iov_len = mapped_ram_bitmap_size(num_pages);
+    bitmap = g_malloc0(iov.iov_len);
+    iov.iov_base = bitmap;
+
+    if (qio_channel_preadv_all(ioc, &iov, 1, header.bitmap_offset,
+                               &local_err) < 0) {
+        error_reportf_err(local_err, "Failed to read bitmap of block %s: ",
+                          block->idstr);
+        return -EIO;
+    }
+    bitmap_from_le(bitmap, bitmap, num_pages);
+
+    ret = mapped_ram_read_pages(ioc, block, bitmap, num_pages,
+                                header.pages_offset);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Skip the pages region, the stream continues after it */
+    qemu_set_offset(f, header.pages_offset + length, SEEK_SET);
+
+    return qemu_file_get_error(f);
+}
+
 /**
  * ram_load_precopy: load pages in precopy case
  *
@@ -4335,6 +4686,9 @@ static int ram_load_precopy(QEMUFile *f)
                             ret = -EINVAL;
                         }
                     }
+                    if (!ret && migrate_use_mapped_ram()) {
+                        ret = parse_ramblock_mapped_ram(f, block, length);
+                    }
                     ram_control_load_hook(f, RAM_CONTROL_BLOCK_REG,
                                           block->idstr);
                 } else {
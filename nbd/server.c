@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 
 #include "block/export.h"
+#include "block/thread-pool.h"
 #include "qapi/error.h"
 #include "qemu/queue.h"
 #include "trace.h"
@@ -27,6 +28,11 @@
 #include "qemu/units.h"
 #include "qemu/memalign.h"
 
+#if defined(CONFIG_LINUX) && defined(CONFIG_SENDFILE)
+#include <sys/sendfile.h>
+#define NBD_SERVER_SENDFILE
+#endif
+
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
 /* Dirty bitmaps use 'NBD_META_ID_DIRTY_BITMAP + i', so keep this id last. */
@@ -142,6 +148,7 @@ struct NBDClient {
     uint32_t check_align; /* If non-zero, check for aligned client requests */
 
     bool structured_reply;
+    bool no_sendfile; /* sendfile() failed on the export's host file */
     NBDExportMetaContexts export_meta;
 
     uint32_t opt; /* Current option being negotiated */
@@ -1990,6 +1997,162 @@ static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
     return nbd_co_send_iov(client, iov, 1 + !!iov[1].iov_len, errp);
 }
 
+/*
+ * Return the host file descriptor that reads of the export can be served
+ * from with sendfile(), or -1.  This needs a connection without TLS, and
+ * a node that maps export offsets to a host file which does not change
+ * under our feet (see BlockDriver.bdrv_get_host_fd), which currently means
+ * file-posix, possibly under a raw format node.
+ */
+static int nbd_sendfile_fd(NBDClient *client)
+{
+#ifdef NBD_SERVER_SENDFILE
+    int fd;
+
+    if (client->no_sendfile || client->ioc != QIO_CHANNEL(client->sioc)) {
+        return -1;
+    }
+    fd = bdrv_get_host_fd(blk_bs(client->exp->common.blk));
+    return fd < 0 ? -1 : fd;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * Check that block status mapped a whole data range to the host file @fd
+ * returned by nbd_sendfile_fd().
+ */
+static bool nbd_sendfile_mapped(int fd, int status, BlockDriverState *file)
+{
+    return fd >= 0 && (status & BDRV_BLOCK_OFFSET_VALID) &&
+        !(status & BDRV_BLOCK_ZERO) && file && bdrv_get_host_fd(file) == fd;
+}
+
+typedef struct NBDSendfileData {
+    int out_fd;
+    int in_fd;
+    off_t offset;
+    size_t count;
+} NBDSendfileData;
+
+static int nbd_sendfile_worker(void *opaque)
+{
+#ifdef NBD_SERVER_SENDFILE
+    NBDSendfileData *data = opaque;
+    ssize_t len;
+
+    do {
+        len = sendfile(data->out_fd, data->in_fd, &data->offset, data->count);
+    } while (len < 0 && errno == EINTR);
+
+    return len < 0 ? -errno : len;
+#else
+    return -ENOSYS;
+#endif
+}
+
+/*
+ * Send the data reply for [@offset, @offset + @size) of the export, which
+ * block status mapped to @host_offset in the host file @fd.  The payload
+ * goes straight from the page cache to the socket with sendfile(); that
+ * runs in the thread pool because it may wait for the disk.  If sendfile()
+ * does not work for @fd, or the file ends early (its size need not be
+ * sector aligned), the rest is read through the block layer into @data.
+ *
+ * Like blk_co_preadv(), the request is counted as in flight on the export's
+ * BlockBackend and subject to its I/O limits.  Bytes read by the fallback
+ * are counted twice against the limits.
+ */
+static int coroutine_fn nbd_co_send_read_sendfile(NBDClient *client,
+                                                  uint64_t handle,
+                                                  uint64_t offset,
+                                                  uint8_t *data,
+                                                  size_t size,
+                                                  bool final,
+                                                  int fd,
+                                                  int64_t host_offset,
+                                                  Error **errp)
+{
+    NBDExport *exp = client->exp;
+    ThreadPool *pool = aio_get_thread_pool(exp->common.ctx);
+    NBDSimpleReply reply;
+    NBDStructuredReadData chunk;
+    struct iovec iov;
+    NBDSendfileData sf = {
+        .out_fd = client->sioc->fd,
+        .in_fd = fd,
+        .offset = host_offset,
+    };
+    size_t done = 0;
+    int ret;
+
+    assert(size);
+    trace_nbd_co_send_read_sendfile(handle, offset, size, fd, host_offset);
+    if (client->structured_reply) {
+        set_be_chunk(&chunk.h, final ? NBD_REPLY_FLAG_DONE : 0,
+                     NBD_REPLY_TYPE_OFFSET_DATA, handle,
+                     sizeof(chunk) - sizeof(chunk.h) + size);
+        stq_be_p(&chunk.offset, offset);
+        iov = (struct iovec) { .iov_base = &chunk, .iov_len = sizeof(chunk) };
+    } else {
+        set_be_simple_reply(&reply, 0, handle);
+        iov = (struct iovec) { .iov_base = &reply, .iov_len = sizeof(reply) };
+    }
+
+    g_assert(qemu_in_coroutine());
+    blk_inc_in_flight(exp->common.blk);
+    blk_co_io_limits_intercept(exp->common.blk, size, false);
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+    qio_channel_set_cork(client->ioc, true);
+
+    ret = qio_channel_writev_all(client->ioc, &iov, 1, errp) < 0 ? -EIO : 0;
+
+    while (ret == 0 && done < size) {
+        sf.count = size - done;
+        ret = thread_pool_submit_co(pool, nbd_sendfile_worker, &sf);
+        if (ret > 0) {
+            done += ret;
+            ret = 0;
+        } else if (ret == -EAGAIN) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            ret = 0;
+        } else if (ret == 0 || ret == -EINVAL || ret == -ENOSYS) {
+            if (ret < 0) {
+                client->no_sendfile = true;
+            }
+            trace_nbd_co_send_read_sendfile_fallback(handle, done, ret);
+            ret = 0;
+            break;
+        } else {
+            error_setg_errno(errp, -ret, "sendfile failed");
+            ret = -EIO;
+        }
+    }
+
+    if (ret == 0 && done < size) {
+        /* The header is out already, so failing here drops the connection */
+        ret = blk_pread(exp->common.blk, offset + done, size - done,
+                        data + done, 0);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "reading from file failed");
+            ret = -EIO;
+        } else {
+            ret = qio_channel_write_all(client->ioc, (char *)data + done,
+                                        size - done, errp) < 0 ? -EIO : 0;
+        }
+    }
+
+    qio_channel_set_cork(client->ioc, false);
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+    blk_dec_in_flight(exp->common.blk);
+
+    return ret;
+}
+
 /* Do a sparse read and send the structured reply to the client.
  * Returns -errno if sending fails. bdrv_block_status_above() failure is
  * reported to the client, at which point this function succeeds.
@@ -2004,13 +2167,15 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
     int ret = 0;
     NBDExport *exp = client->exp;
     size_t progress = 0;
+    int fd = nbd_sendfile_fd(client);
 
     while (progress < size) {
-        int64_t pnum;
+        int64_t pnum, map;
+        BlockDriverState *file = NULL;
         int status = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
                                              offset + progress,
-                                             size - progress, &pnum, NULL,
-                                             NULL);
+                                             size - progress, &pnum, &map,
+                                             &file);
         bool final;
 
         if (status < 0) {
@@ -2038,6 +2203,10 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
             stq_be_p(&chunk.offset, offset + progress);
             stl_be_p(&chunk.length, pnum);
             ret = nbd_co_send_iov(client, iov, 1, errp);
+        } else if (nbd_sendfile_mapped(fd, status, file)) {
+            ret = nbd_co_send_read_sendfile(client, handle, offset + progress,
+                                            data + progress, pnum, final,
+                                            fd, map, errp);
         } else {
             ret = blk_pread(exp->common.blk, offset + progress, pnum,
                             data + progress, 0);
@@ -2423,7 +2592,7 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                         uint8_t *data, Error **errp)
 {
-    int ret;
+    int ret, fd;
     NBDExport *exp = client->exp;
 
     assert(request->type == NBD_CMD_READ);
@@ -2444,6 +2613,23 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
                                        data, request->len, errp);
     }
 
+    fd = nbd_sendfile_fd(client);
+    if (fd >= 0 && request->len) {
+        int64_t pnum, map;
+        BlockDriverState *file = NULL;
+        int status = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
+                                             request->from, request->len,
+                                             &pnum, &map, &file);
+
+        if (status >= 0 && pnum == request->len &&
+            nbd_sendfile_mapped(fd, status, file)) {
+            return nbd_co_send_read_sendfile(client, request->handle,
+                                             request->from, data,
+                                             request->len, true, fd, map,
+                                             errp);
+        }
+    }
+
     ret = blk_pread(exp->common.blk, request->from, request->len, data, 0);
     if (ret < 0) {
         return nbd_send_generic_reply(client, request->handle, ret,
@@ -1645,8 +1645,20 @@ enum ImgConvertBlockStatus {
 };
 
 #define MAX_COROUTINES 16
+#define MAX_BUF_SECTORS 32768
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Limit for the memory used by the block status map (16 bytes each) */
+#define CONVERT_MAX_STATUS_EXTENTS (1 << 20)
+
+/* Limit for the memory used by all copy buffers when growing them */
+#define CONVERT_MAX_BUF_BYTES (64 * MiB)
+
+typedef struct ImgConvertExtent {
+    int64_t end; /* first sector after the extent */
+    enum ImgConvertBlockStatus status;
+} ImgConvertExtent;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1659,6 +1671,15 @@ typedef struct ImgConvertState {
     int64_t wr_offs;
     enum ImgConvertBlockStatus status;
     int64_t sector_next_status;
+    /*
+     * Source block status recorded while counting the allocated sectors,
+     * so that the copy coroutines do not have to query it again under
+     * the lock.  It covers [0, status_map_end); anything after that is
+     * queried when needed.
+     */
+    GArray *status_map;
+    int64_t status_map_end;
+    guint status_map_pos;
     BlockBackend *target;
     bool has_zero_init;
     bool compressed;
@@ -1693,6 +1714,54 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/* Append the status just queried for @sector_num to the status map */
+static void convert_record_status(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *last, extent = {
+        .end = s->sector_next_status,
+        .status = s->status,
+    };
+
+    if (!s->status_map || sector_num != s->status_map_end) {
+        return;
+    }
+
+    if (s->status_map->len) {
+        last = &g_array_index(s->status_map, ImgConvertExtent,
+                              s->status_map->len - 1);
+        if (last->status == extent.status) {
+            last->end = extent.end;
+            s->status_map_end = extent.end;
+            return;
+        }
+    }
+
+    if (s->status_map->len < CONVERT_MAX_STATUS_EXTENTS) {
+        g_array_append_val(s->status_map, extent);
+        s->status_map_end = extent.end;
+    }
+}
+
+/*
+ * Look up the status of @sector_num in the status map.  The copy
+ * coroutines process the image in order, so a forward-only cursor does.
+ */
+static void convert_lookup_status(ImgConvertState *s, int64_t sector_num)
+{
+    ImgConvertExtent *extent;
+
+    assert(sector_num < s->status_map_end);
+    while (g_array_index(s->status_map, ImgConvertExtent,
+                         s->status_map_pos).end <= sector_num) {
+        s->status_map_pos++;
+    }
+
+    extent = &g_array_index(s->status_map, ImgConvertExtent,
+                            s->status_map_pos);
+    s->status = extent->status;
+    s->sector_next_status = extent->end;
+}
+
 static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
     int64_t src_cur_offset;
@@ -1714,6 +1783,11 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
     }
 
+    if (s->sector_next_status <= sector_num &&
+        sector_num < s->status_map_end) {
+        convert_lookup_status(s, sector_num);
+    }
+
     if (s->sector_next_status <= sector_num) {
         uint64_t offset = (sector_num - src_cur_offset) * BDRV_SECTOR_SIZE;
         int64_t count;
@@ -1777,6 +1851,7 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
         }
 
         s->sector_next_status = sector_num + n;
+        convert_record_status(s, sector_num);
     }
 
     n = MIN(n, s->sector_next_status - sector_num);
@@ -2071,6 +2146,8 @@ static int convert_do_copy(ImgConvertState *s)
 {
     int ret, i, n;
     int64_t sector_num = 0;
+    int64_t data_runs = 0;
+    bool in_data_run = false;
 
     /* Check whether we have zero initialisation or can get it efficiently */
     if (!s->has_zero_init && s->target_is_new && s->min_sparse &&
@@ -2088,20 +2165,43 @@ static int convert_do_copy(ImgConvertState *s)
         s->buf_sectors = s->cluster_sectors;
     }
 
+    s->status_map = g_array_new(false, false, sizeof(ImgConvertExtent));
     while (sector_num < s->total_sectors) {
         n = convert_iteration_sectors(s, sector_num);
         if (n < 0) {
-            return n;
+            ret = n;
+            goto out;
         }
         if (s->status == BLK_DATA || (!s->min_sparse && s->status == BLK_ZERO))
         {
             s->allocated_sectors += n;
+            data_runs += !in_data_run;
+            in_data_run = true;
+        } else {
+            in_data_run = false;
         }
         sector_num += n;
     }
 
+    /*
+     * Long runs of data are copied faster with larger requests, so grow
+     * the buffers towards the average run length, but keep the memory used
+     * by all coroutines bounded.  Compressed output is written cluster by
+     * cluster anyway.
+     */
+    if (!s->compressed && data_runs) {
+        int64_t max_sectors = MIN(MAX_BUF_SECTORS,
+                                  CONVERT_MAX_BUF_BYTES / BDRV_SECTOR_SIZE /
+                                  s->num_coroutines);
+        int64_t run_sectors = s->allocated_sectors / data_runs;
+
+        s->buf_sectors = MAX(s->buf_sectors,
+                             pow2floor(MIN(run_sectors, max_sectors)));
+    }
+
     /* Do the copy */
     s->sector_next_status = 0;
+    s->status_map_pos = 0;
     s->ret = -EINPROGRESS;
 
     qemu_co_mutex_init(&s->lock);
@@ -2119,11 +2219,15 @@ static int convert_do_copy(ImgConvertState *s)
         /* signal EOF to align */
         ret = blk_pwrite_compressed(s->target, 0, 0, NULL);
         if (ret < 0) {
-            return ret;
+            goto out;
         }
     }
 
-    return s->ret;
+    ret = s->ret;
+out:
+    g_array_free(s->status_map, true);
+    s->status_map = NULL;
+    return ret;
 }
 
 /* Check that bitmaps can be copied, or output an error */
@@ -2189,8 +2293,6 @@ static int convert_copy_bitmaps(BlockDriverState *src, BlockDriverState *dst,
     return 0;
 }
 
-#define MAX_BUF_SECTORS 32768
-
 static void set_rate_limit(BlockBackend *blk, int64_t rate_limit)
 {
     ThrottleConfig cfg;
@@ -189,7 +189,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                cse=on|off (eliminate redundant TCG ops, default=off)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                superblock-threshold=n (form TCG superblocks after n executions, default=0 (off))\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
@@ -225,6 +227,22 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``cse=on|off``
+        Makes the TCG optimizer also replace operations that compute a
+        value already computed in the same basic block by a copy of it,
+        and remove stores to the CPU state that are overwritten before
+        anything may read them. This makes translation a little slower,
+        and the generated code smaller for guests that update the
+        condition flags on every instruction (default=off).
+
+    ``superblock-threshold=n``
+        Makes every translation block count its executions. Once one has
+        run n times, the chain of translation blocks it usually jumps to
+        on the same page is translated again as a single block, so that
+        TCG optimizes across the jumps. A block that cannot start such a
+        chain is no longer counted. Not done while TCG plugins are
+        loaded. 0 disables superblocks (default=0).
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -4177,6 +4195,33 @@ SRST
     Run the emulation in single step mode.
 ERST
 
+DEF("perfmap", 0, QEMU_OPTION_perfmap, \
+    "-perfmap        generate a /tmp/perf-${pid}.map file for perf\n",
+    QEMU_ARCH_ALL)
+SRST
+``-perfmap``
+    Generate a map file for Linux perf tools that will allow basic profiling
+    information to be broken down by the guest code that was translated.
+    Each translation block appears as a symbol named after the guest address
+    range it was translated from, e.g. ``guest-0x401000+0x1c``.  Code that
+    is retranslated after the translation cache is flushed shows up under
+    all of the symbols that lived at its address; use ``-jitdump`` if that
+    matters.  Only effective with TCG.
+ERST
+
+DEF("jitdump", 0, QEMU_OPTION_jitdump, \
+    "-jitdump        generate a jit-${pid}.dump file for perf\n",
+    QEMU_ARCH_ALL)
+SRST
+``-jitdump``
+    Generate a dump file for Linux perf tools in the current directory,
+    with timestamped records of the code generated for each translation
+    block.  Record with ``perf record -k 1``, then run ``perf inject --jit``
+    on the result, so that samples are attributed to the translation block
+    that was live when they were taken.  Only effective with TCG on Linux
+    hosts.
+ERST
+
 DEF("preconfig", 0, QEMU_OPTION_preconfig, \
     "--preconfig     pause QEMU before machine is initialized (experimental)\n",
     QEMU_ARCH_ALL)
@@ -4554,6 +4599,8 @@ DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming exec:cmdline\n" \
     "                accept incoming migration on given file descriptor\n" \
     "                or from given external command\n" \
+    "-incoming file:filename\n" \
+    "                accept incoming migration from given file\n" \
     "-incoming defer\n" \
     "                wait for the URI to be specified via migrate_incoming\n",
     QEMU_ARCH_ALL)
@@ -4573,6 +4620,10 @@ SRST
     Accept incoming migration as an output from specified external
     command.
 
+``-incoming file:filename``
+    Accept incoming migration from a given file, previously written
+    by migrating to a ``file:`` URI.
+
 ``-incoming defer``
     Wait for the URI to be specified via migrate\_incoming. The monitor
     can be used to change settings (such as migration parameters) prior
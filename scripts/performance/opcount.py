@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+
+#  Compare the number of TCG ops generated for a program by QEMU
+#  user-mode emulation, with and without the -cse optimizations.
+#
+#  Syntax:
+#  opcount.py [-h] [-n <number of displayed opcodes>] -- \
+#             <qemu executable> [<qemu executable options>] \
+#             <target executable> [<target executable options>]
+#
+#  [-h] - Print the script arguments help message.
+#  [-n] - Specify the number of opcodes to print.
+#       - If this flag is not specified, the tool defaults to 15.
+#
+#  Example of usage:
+#  opcount.py -n 20 -- qemu-x86_64 coulomb_double-x86_64
+#
+#  The counts are of the ops left after optimization and liveness
+#  analysis, as logged with "-d op_opt", for each translation block
+#  translated during the run.  The QEMU executable must be built
+#  with DEBUG_DISAS, which is the default.
+#
+#  This program is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+import argparse
+import collections
+import os
+import subprocess
+import sys
+import tempfile
+
+
+def count_ops(command, extra_options):
+    """
+    Run QEMU with op logging and count the logged ops by opcode.
+
+    Parameters:
+    command (list): QEMU executable, its options and the target program
+    extra_options (list): options to pass to QEMU in addition
+
+    Returns:
+    (int, Counter): Number of translation blocks, ops by opcode
+    """
+    with tempfile.TemporaryDirectory() as tmpdir:
+        log_path = os.path.join(tmpdir, "op_opt.log")
+        run = subprocess.run([command[0]] + extra_options +
+                             ["-d", "op_opt", "-D", log_path] + command[1:],
+                             stdout=subprocess.DEVNULL,
+                             stderr=subprocess.PIPE)
+        if run.returncode:
+            sys.exit(run.stderr.decode("utf-8"))
+
+        blocks = 0
+        ops = collections.Counter()
+        in_ops = False
+        with open(log_path, "r") as log:
+            for line in log:
+                if line.startswith("OP after optimization"):
+                    blocks += 1
+                    in_ops = True
+                elif not line.strip():
+                    # Instructions are separated by an empty line
+                    continue
+                elif not line.startswith(" "):
+                    in_ops = False
+                elif in_ops:
+                    opcode = line.split()[0]
+                    if opcode != "----":
+                        ops[opcode] += 1
+        return blocks, ops
+
+
+def main():
+    # Parse the command line arguments
+    parser = argparse.ArgumentParser(
+        usage='opcount.py [-h] [-n <number of displayed opcodes>] -- '
+        '<qemu executable> [<qemu executable options>] '
+        '<target executable> [<target executable options>]')
+
+    parser.add_argument('-n', dest='top', type=int, default=15,
+                        help='Specify the number of opcodes to print.')
+
+    parser.add_argument('command', type=str, nargs='+', help=argparse.SUPPRESS)
+
+    args = parser.parse_args()
+
+    # Extract the needed variables from the args
+    command = args.command
+    top = args.top
+
+    base_blocks, base_ops = count_ops(command, [])
+    cse_blocks, cse_ops = count_ops(command, ["-cse"])
+
+    base_total = sum(base_ops.values())
+    cse_total = sum(cse_ops.values())
+    if not base_total:
+        sys.exit("No ops were logged, is DEBUG_DISAS defined?")
+
+    print("{:>20}  {:>10}  {:>10}  {:>8}".format(
+        "", "baseline", "-cse", "change"))
+    print("{:>20}  {:>10}  {:>10}".format(
+        "translation blocks", base_blocks, cse_blocks))
+    print("{:>20}  {:>10}  {:>10}  {:>7.2f}%".format(
+        "ops", base_total, cse_total,
+        (cse_total - base_total) * 100 / base_total))
+    print("{:>20}  {:>10.2f}  {:>10.2f}".format(
+        "ops per block", base_total / max(base_blocks, 1),
+        cse_total / max(cse_blocks, 1)))
+    print()
+
+    # Print the opcodes whose count changed the most
+    opcodes = sorted(set(base_ops) | set(cse_ops),
+                     key=lambda op: base_ops[op] - cse_ops[op],
+                     reverse=True)
+    print("{:>20}  {:>10}  {:>10}  {:>8}".format(
+        "opcode", "baseline", "-cse", "change"))
+    for opcode in opcodes[:top]:
+        print("{:>20}  {:>10}  {:>10}  {:>8}".format(
+            opcode, base_ops[opcode], cse_ops[opcode],
+            cse_ops[opcode] - base_ops[opcode]))
+
+
+if __name__ == "__main__":
+    main()
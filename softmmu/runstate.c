@@ -31,6 +31,7 @@
 #include "crypto/init.h"
 #include "exec/cpu-common.h"
 #include "exec/gdbstub.h"
+#include "accel/tcg/perf.h"
 #include "hw/boards.h"
 #include "migration/misc.h"
 #include "migration/postcopy-ram.h"
@@ -825,6 +826,7 @@ void qemu_cleanup(void)
 
     /* No more vcpu or device emulation activity beyond this point */
     vm_shutdown();
+    perf_exit();
     replay_finish();
 
     job_cancel_sync_all();
@@ -132,6 +132,7 @@
 #include "sysemu/iothread.h"
 #include "qemu/guest-random.h"
 #include "qemu/keyval.h"
+#include "accel/tcg/perf.h"
 
 #include "config-host.h"
 
@@ -2948,6 +2949,12 @@ void qemu_init(int argc, char **argv)
             case QEMU_OPTION_singlestep:
                 singlestep = 1;
                 break;
+            case QEMU_OPTION_perfmap:
+                perf_enable_perfmap();
+                break;
+            case QEMU_OPTION_jitdump:
+                perf_enable_jitdump();
+                break;
             case QEMU_OPTION_S:
                 autostart = 0;
                 break;
@@ -4777,7 +4777,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
             gen_set_condexec(s);
             gen_update_pc(s, 0);
             gen_helper_access_check_cp_reg(cpu_env,
-                                           tcg_constant_ptr(ri),
+                                           tcg_constant_host_ptr(ri),
                                            tcg_constant_i32(syndrome),
                                            tcg_constant_i32(isread));
         } else if (ri->type & ARM_CP_RAISES_EXC) {
@@ -4821,7 +4821,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                 } else if (ri->readfn) {
                     tmp64 = tcg_temp_new_i64();
                     gen_helper_get_cp_reg64(tmp64, cpu_env,
-                                            tcg_constant_ptr(ri));
+                                            tcg_constant_host_ptr(ri));
                 } else {
                     tmp64 = tcg_temp_new_i64();
                     tcg_gen_ld_i64(tmp64, cpu_env, ri->fieldoffset);
@@ -4839,7 +4839,8 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                     tmp = tcg_constant_i32(ri->resetvalue);
                 } else if (ri->readfn) {
                     tmp = tcg_temp_new_i32();
-                    gen_helper_get_cp_reg(tmp, cpu_env, tcg_constant_ptr(ri));
+                    gen_helper_get_cp_reg(tmp, cpu_env,
+                                          tcg_constant_host_ptr(ri));
                 } else {
                     tmp = load_cpu_offset(ri->fieldoffset);
                 }
@@ -4869,7 +4870,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                 tcg_temp_free_i32(tmplo);
                 tcg_temp_free_i32(tmphi);
                 if (ri->writefn) {
-                    gen_helper_set_cp_reg64(cpu_env, tcg_constant_ptr(ri),
+                    gen_helper_set_cp_reg64(cpu_env, tcg_constant_host_ptr(ri),
                                             tmp64);
                 } else {
                     tcg_gen_st_i64(tmp64, cpu_env, ri->fieldoffset);
@@ -4878,7 +4879,8 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
             } else {
                 TCGv_i32 tmp = load_reg(s, rt);
                 if (ri->writefn) {
-                    gen_helper_set_cp_reg(cpu_env, tcg_constant_ptr(ri), tmp);
+                    gen_helper_set_cp_reg(cpu_env, tcg_constant_host_ptr(ri),
+                                          tmp);
                     tcg_temp_free_i32(tmp);
                 } else {
                     store_cpu_offset(tmp, ri->fieldoffset, 4);
@@ -44,13 +44,39 @@ typedef struct TempOptInfo {
     uint64_t val;
     uint64_t z_mask;  /* mask bit is 0 if and only if value bit is 0 */
     uint64_t s_mask;  /* a left-aligned mask of clrsb(value) bits. */
+    uint32_t version; /* incremented whenever the value changes */
 } TempOptInfo;
 
+/* Value numbering, see fold_cse(). */
+#define CSE_TABLE_BITS  7
+#define CSE_MAX_IARGS   4
+
+typedef struct CSEEntry {
+    TCGOp *op;        /* computes the value into its args[0] */
+    uint32_t gen;     /* valid if equal to OptContext.cse_gen */
+    uint32_t out_version;
+    uint32_t in_version[CSE_MAX_IARGS];
+} CSEEntry;
+
+/* Stores to env tracked at once, see fold_tcg_st(). */
+#define MAX_ENV_ST      16
+
+bool tcg_optimize_cse;
+
 typedef struct OptContext {
     TCGContext *tcg;
     TCGOp *prev_mb;
     TCGTempSet temps_used;
 
+    /* Pure ops of the current BB, by opcode and arguments. */
+    CSEEntry cse[1 << CSE_TABLE_BITS];
+    CSEEntry *cse_entry;  /* for the current op, or NULL */
+    uint32_t cse_gen;
+
+    /* Stores to env in the current BB that nothing has read yet. */
+    TCGOp *env_st[MAX_ENV_ST];
+    int nb_env_st;
+
     /* In flight values from optimization. */
     uint64_t a_mask;  /* mask bit is 0 iff value identical to first input */
     uint64_t z_mask;  /* mask bit is 0 iff value bit is 0 */
@@ -136,6 +162,7 @@ static void reset_ts(TCGTemp *ts)
     ti->is_const = false;
     ti->z_mask = -1;
     ti->s_mask = 0;
+    ti->version++;
 }
 
 static void reset_temp(TCGArg arg)
@@ -157,6 +184,7 @@ static void init_ts_info(OptContext *ctx, TCGTemp *ts)
     ti = ts->state_ptr;
     if (ti == NULL) {
         ti = tcg_malloc(sizeof(TempOptInfo));
+        ti->version = 0;
         ts->state_ptr = ti;
     }
 
@@ -714,6 +742,23 @@ static void finish_folding(OptContext *ctx, TCGOp *op)
             ts_info(ts)->s_mask = ctx->s_mask;
         }
     }
+
+    /*
+     * Number the value, now that the output has its new version.  Some
+     * fold_* functions call this without going through fold_cse(), so the
+     * entry must not be left around for them.
+     */
+    if (ctx->cse_entry) {
+        CSEEntry *e = ctx->cse_entry;
+
+        e->op = op;
+        e->gen = ctx->cse_gen;
+        e->out_version = arg_info(op->args[0])->version;
+        for (i = 0; i < def->nb_iargs; i++) {
+            e->in_version[i] = arg_info(op->args[1 + i])->version;
+        }
+        ctx->cse_entry = NULL;
+    }
 }
 
 /*
@@ -1229,6 +1274,8 @@ static bool fold_call(OptContext *ctx, TCGOp *op)
 
     /* Stop optimizing MB across calls. */
     ctx->prev_mb = NULL;
+    /* The helper may read env, or raise an exception. */
+    ctx->nb_env_st = 0;
     return true;
 }
 
@@ -1261,6 +1308,77 @@ static bool fold_count_zeros(OptContext *ctx, TCGOp *op)
     return false;
 }
 
+/*
+ * Replace @op with a copy of the same value computed earlier in the BB.
+ * Only pure ops are numbered, whose output depends on nothing but their
+ * arguments; e.g. front ends compute the same address or flag several
+ * times.  Arguments are matched after copy propagation, along with the
+ * version of each temp so that a value is not used after a temp changes.
+ */
+static bool fold_cse(OptContext *ctx, TCGOp *op)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    int nb_iargs = def->nb_iargs;
+    int nb_args = def->nb_oargs + nb_iargs + def->nb_cargs;
+    CSEEntry *e;
+    uint64_t h;
+    int i;
+
+    ctx->cse_entry = NULL;
+    if (!tcg_optimize_cse || def->nb_oargs != 1 || nb_iargs > CSE_MAX_IARGS ||
+        (def->flags & (TCG_OPF_BB_END | TCG_OPF_CALL_CLOBBER |
+                       TCG_OPF_SIDE_EFFECTS | TCG_OPF_NOT_PRESENT |
+                       TCG_OPF_VECTOR))) {
+        return false;
+    }
+
+    switch (op->opc) {
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(ld16u):
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_ld32u_i64:
+    CASE_OP_32_64(ld):
+    CASE_OP_32_64(mov):
+        /* Loads depend on memory, and copies are propagated instead. */
+        return false;
+    default:
+        break;
+    }
+
+    h = op->opc;
+    for (i = 1; i < nb_args; i++) {
+        h = (h + op->args[i]) * 0x9e3779b97f4a7c15ull;
+    }
+    e = &ctx->cse[h >> (64 - CSE_TABLE_BITS)];
+
+    if (e->gen == ctx->cse_gen && e->op->opc == op->opc &&
+        !memcmp(e->op->args + 1, op->args + 1,
+                (nb_args - 1) * sizeof(TCGArg))) {
+        TCGTemp *prev = arg_temp(e->op->args[0]);
+        bool match = ts_info(prev)->version == e->out_version;
+
+        for (i = 0; i < nb_iargs && match; i++) {
+            match = arg_info(op->args[1 + i])->version == e->in_version[i];
+        }
+        if (match) {
+            /* Some ops, e.g. extrl_i64_i32, change the type. */
+            ctx->type = prev->type;
+            return tcg_opt_gen_mov(ctx, op, op->args[0], temp_arg(prev));
+        }
+    }
+
+    /* Once the output is written, a value it was computed from is lost. */
+    for (i = 1; i <= nb_iargs; i++) {
+        if (op->args[i] == op->args[0]) {
+            return false;
+        }
+    }
+    ctx->cse_entry = e;
+    return false;
+}
+
 static bool fold_ctpop(OptContext *ctx, TCGOp *op)
 {
     if (fold_const1(ctx, op)) {
@@ -1975,8 +2093,57 @@ static bool fold_sub2(OptContext *ctx, TCGOp *op)
     return fold_addsub2(ctx, op, false);
 }
 
+/* Return the size of the memory accessed by ld/st @op. */
+static int tcg_ldst_size(TCGOp *op)
+{
+    switch (op->opc) {
+    CASE_OP_32_64(ld8s):
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(st8):
+        return 1;
+    CASE_OP_32_64(ld16s):
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(st16):
+        return 2;
+    case INDEX_op_ld32s_i64:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld_i32:
+    case INDEX_op_st32_i64:
+    case INDEX_op_st_i32:
+        return 4;
+    case INDEX_op_ld_i64:
+    case INDEX_op_st_i64:
+        return 8;
+    case INDEX_op_ld_vec:
+    case INDEX_op_dupm_vec:
+    case INDEX_op_st_vec:
+        return 8 << TCGOP_VECL(op);
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
 {
+    intptr_t ofs = op->args[2];
+    int size = tcg_ldst_size(op);
+    int i, j;
+
+    /* The stores to env that the load may read are not dead. */
+    if (arg_temp(op->args[1]) != tcgv_ptr_temp(cpu_env)) {
+        /* The pointer may well point into env. */
+        ctx->nb_env_st = 0;
+    }
+    for (i = j = 0; i < ctx->nb_env_st; i++) {
+        TCGOp *st = ctx->env_st[i];
+        intptr_t st_ofs = st->args[2];
+
+        if (st_ofs >= ofs + size || ofs >= st_ofs + tcg_ldst_size(st)) {
+            ctx->env_st[j++] = st;
+        }
+    }
+    ctx->nb_env_st = j;
+
     /* We can't do any folding with a load, but we can record bits. */
     switch (op->opc) {
     CASE_OP_32_64(ld8s):
@@ -2000,12 +2167,49 @@ static bool fold_tcg_ld(OptContext *ctx, TCGOp *op)
         ctx->z_mask = MAKE_64BIT_MASK(0, 32);
         ctx->s_mask = MAKE_64BIT_MASK(33, 31);
         break;
+    CASE_OP_32_64(ld):
+    case INDEX_op_ld_vec:
+    case INDEX_op_dupm_vec:
+        break;
     default:
         g_assert_not_reached();
     }
     return false;
 }
 
+static bool fold_tcg_st(OptContext *ctx, TCGOp *op)
+{
+    intptr_t ofs = op->args[2];
+    int size = tcg_ldst_size(op);
+    int i, j;
+
+    if (!tcg_optimize_cse || arg_temp(op->args[1]) != tcgv_ptr_temp(cpu_env)) {
+        return false;
+    }
+
+    /*
+     * Remove the stores to env that this one overwrites before anything
+     * reads them, e.g. of cc_op by consecutive insns.
+     */
+    for (i = j = 0; i < ctx->nb_env_st; i++) {
+        TCGOp *st = ctx->env_st[i];
+        intptr_t st_ofs = st->args[2];
+
+        if (st_ofs >= ofs && st_ofs + tcg_ldst_size(st) <= ofs + size) {
+            tcg_op_remove(ctx->tcg, st);
+        } else {
+            ctx->env_st[j++] = st;
+        }
+    }
+    if (j == MAX_ENV_ST) {
+        /* Forget the oldest store, which then stays */
+        memmove(ctx->env_st, ctx->env_st + 1, --j * sizeof(TCGOp *));
+    }
+    ctx->env_st[j] = op;
+    ctx->nb_env_st = j + 1;
+    return false;
+}
+
 static bool fold_xor(OptContext *ctx, TCGOp *op)
 {
     if (fold_const2_commutative(ctx, op) ||
@@ -2027,7 +2231,7 @@ void tcg_optimize(TCGContext *s)
 {
     int nb_temps, i;
     TCGOp *op, *op_next;
-    OptContext ctx = { .tcg = s };
+    OptContext ctx = { .tcg = s, .cse_gen = 1 };
 
     /* Array VALS has an element for each temp.
        If this temp holds a constant then its value is kept in VALS' element.
@@ -2063,6 +2267,15 @@ void tcg_optimize(TCGContext *s)
             ctx.type = TCG_TYPE_I32;
         }
 
+        /* Values are not numbered across BBs. */
+        if (def->flags & TCG_OPF_BB_END) {
+            ctx.cse_gen++;
+        }
+        /* Stores to env are visible once the TB exits, by any means. */
+        if (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS)) {
+            ctx.nb_env_st = 0;
+        }
+
         /* Assume all bits affected, no bits known zero, no sign reps. */
         ctx.a_mask = -1;
         ctx.z_mask = -1;
@@ -2148,6 +2361,9 @@ void tcg_optimize(TCGContext *s)
         CASE_OP_32_64(ld16u):
         case INDEX_op_ld32s_i64:
         case INDEX_op_ld32u_i64:
+        CASE_OP_32_64(ld):
+        case INDEX_op_ld_vec:
+        case INDEX_op_dupm_vec:
             done = fold_tcg_ld(&ctx, op);
             break;
         case INDEX_op_mb:
@@ -2217,6 +2433,12 @@ void tcg_optimize(TCGContext *s)
         CASE_OP_32_64(sextract):
             done = fold_sextract(&ctx, op);
             break;
+        CASE_OP_32_64(st8):
+        CASE_OP_32_64(st16):
+        case INDEX_op_st32_i64:
+        CASE_OP_32_64_VEC(st):
+            done = fold_tcg_st(&ctx, op);
+            break;
         CASE_OP_32_64(sub):
             done = fold_sub(&ctx, op);
             break;
@@ -2233,6 +2455,9 @@ void tcg_optimize(TCGContext *s)
             break;
         }
 
+        if (!done) {
+            done = fold_cse(&ctx, op);
+        }
         if (!done) {
             finish_folding(&ctx, op);
         }
@@ -61,6 +61,7 @@
 #include "exec/log.h"
 #include "tcg/tcg-ldst.h"
 #include "tcg-internal.h"
+#include "accel/tcg/perf.h"
 
 #ifdef CONFIG_TCG_INTERPRETER
 #include <ffi.h>
@@ -749,6 +750,7 @@ void tcg_prologue_init(TCGContext *s)
 #endif
 
     prologue_size = tcg_current_code_size(s);
+    perf_report_prologue(tcg_splitwx_to_rx(s->code_buf), prologue_size);
 
 #ifndef CONFIG_TCG_INTERPRETER
     flush_idcache_range((uintptr_t)tcg_splitwx_to_rx(s->code_buf),
@@ -819,6 +821,7 @@ void tcg_func_start(TCGContext *s)
     s->nb_ops = 0;
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+    s->host_ptr_consts = false;
 
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
@@ -1467,6 +1470,34 @@ bool tcg_op_supported(TCGOpcode op)
     }
 }
 
+/*
+ * Add to @sum the ops that the host supports and how vector ops are
+ * emitted.  Both depend on the host CPU features at run time, e.g. AVX2,
+ * and both decide which ops the front ends and tcg_gen_gvec_*() generate.
+ */
+void tcg_host_features_checksum(GChecksum *sum)
+{
+    TCGOpcode op;
+
+    for (op = 0; op < NB_OPS; op++) {
+        uint8_t supported = tcg_op_supported(op);
+        TCGType type;
+        unsigned vece;
+
+        g_checksum_update(sum, &supported, 1);
+        if (!supported || !(tcg_op_defs[op].flags & TCG_OPF_VECTOR)) {
+            continue;
+        }
+        for (type = TCG_TYPE_V64; type <= TCG_TYPE_V256; type++) {
+            for (vece = MO_8; vece <= MO_64; vece++) {
+                int8_t can = tcg_can_emit_vec_op(op, type, vece);
+
+                g_checksum_update(sum, (guchar *)&can, 1);
+            }
+        }
+    }
+}
+
 /* Note: we convert the 64 bit args to 32 bit and do some alignment
    and endian swap. Maybe it would be better to do the alignment
    and endian swap in tcg_reg_alloc_call(). */
@@ -2191,6 +2222,332 @@ TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *old_op, TCGOpcode opc)
     return new_op;
 }
 
+/*
+ * Serialized ops, see tcg_ops_save().  Values are in host byte order.
+ * Temps are recorded by index in s->temps[] plus one, leaving zero for
+ * TCG_CALL_DUMMY_ARG, labels by id and helpers by index in all_helpers[].
+ * The value of exit_tb is recorded relative to the TB, plus one, leaving
+ * zero for an exit without a TB.
+ */
+typedef struct TCGOpsSaveHeader {
+    uint32_t nb_globals;
+    uint32_t nb_temps;
+    uint32_t nb_labels;
+    uint32_t nb_ops;
+} TCGOpsSaveHeader;
+
+typedef struct TCGOpsSaveTemp {
+    uint8_t base_type;
+    uint8_t type;
+    uint8_t kind;
+    uint8_t allocated : 1;
+    uint8_t hashed : 1;         /* present in s->const_table */
+    int64_t val;
+} TCGOpsSaveTemp;
+
+typedef struct TCGOpsSaveLabel {
+    uint16_t refs;
+    uint16_t present;
+} TCGOpsSaveLabel;
+
+typedef struct TCGOpsSaveOp {
+    uint8_t opc;
+    uint8_t param1;
+    uint8_t param2;
+    uint8_t nb_args;
+    /* Followed by nb_args uint64_t arguments */
+} TCGOpsSaveOp;
+
+/*
+ * Return the number of serialized arguments of an op, and in
+ * @nb_targs the number of them that are temps.
+ */
+static int tcg_ops_save_nb_args(TCGOpcode opc, unsigned param1,
+                                unsigned param2, int *nb_targs)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+
+    if (opc == INDEX_op_call) {
+        /* The function pointer and the info are both saved as the info */
+        *nb_targs = param1 + param2;
+        return *nb_targs + 1;
+    }
+    *nb_targs = def->nb_oargs + def->nb_iargs;
+    return *nb_targs + def->nb_cargs;
+}
+
+/*
+ * Return the index of the label argument of an op, or -1 if it has none.
+ * As in tcg_op_remove(), the label is the last constant argument.
+ */
+static int tcg_op_label_arg(TCGOpcode opc)
+{
+    switch (opc) {
+    case INDEX_op_set_label:
+    case INDEX_op_br:
+        return 0;
+    case INDEX_op_brcond_i32:
+    case INDEX_op_brcond_i64:
+        return 3;
+    case INDEX_op_brcond2_i32:
+        return 5;
+    default:
+        return -1;
+    }
+}
+
+bool tcg_ops_save(TCGContext *s, const TranslationBlock *tb, GByteArray *buf)
+{
+    uintptr_t tb_rx = (uintptr_t)tcg_splitwx_to_rx((void *)tb);
+    TCGOpsSaveHeader hdr = {
+        .nb_globals = s->nb_globals,
+        .nb_temps = s->nb_temps,
+        .nb_labels = s->nb_labels,
+        .nb_ops = s->nb_ops,
+    };
+    TCGLabel *l;
+    TCGOp *op;
+    int i;
+
+    if (s->host_ptr_consts) {
+        return false;
+    }
+
+    g_byte_array_append(buf, (guint8 *)&hdr, sizeof(hdr));
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        GHashTable *h = s->const_table[ts->base_type];
+        TCGOpsSaveTemp st;
+
+        /* The padding ends up in the cache file as well */
+        memset(&st, 0, sizeof(st));
+        st.base_type = ts->base_type;
+        st.type = ts->type;
+        st.kind = ts->kind;
+        st.allocated = ts->temp_allocated;
+        st.hashed = (ts->kind == TEMP_CONST && h &&
+                     g_hash_table_lookup(h, &ts->val) == ts);
+        st.val = ts->val;
+
+        g_byte_array_append(buf, (guint8 *)&st, sizeof(st));
+    }
+
+    /* Labels are listed in order of allocation, i.e. of id */
+    QSIMPLEQ_FOREACH(l, &s->labels, next) {
+        TCGOpsSaveLabel sl = {
+            .refs = l->refs,
+            .present = l->present,
+        };
+
+        g_byte_array_append(buf, (guint8 *)&sl, sizeof(sl));
+    }
+
+    QTAILQ_FOREACH(op, &s->ops, link) {
+        TCGOpsSaveOp so = {
+            .opc = op->opc,
+            .param1 = op->param1,
+            .param2 = op->param2,
+        };
+        uint64_t args[MAX_OPC_PARAM];
+        int nb_targs, label_idx;
+
+        so.nb_args = tcg_ops_save_nb_args(op->opc, op->param1, op->param2,
+                                          &nb_targs);
+        for (i = 0; i < nb_targs; i++) {
+            TCGArg arg = op->args[i];
+
+            args[i] = (arg == TCG_CALL_DUMMY_ARG
+                       ? 0 : temp_idx(arg_temp(arg)) + 1);
+        }
+        for (; i < so.nb_args; i++) {
+            args[i] = op->args[i];
+        }
+
+        switch (op->opc) {
+        case INDEX_op_call:
+            {
+                const TCGHelperInfo *info = tcg_call_info(op);
+
+                /* Plugin callbacks use a helper info as a template */
+                if (tcg_call_func(op) != info->func) {
+                    return false;
+                }
+                args[nb_targs] = info - all_helpers;
+                tcg_debug_assert(args[nb_targs] < ARRAY_SIZE(all_helpers));
+            }
+            break;
+        case INDEX_op_exit_tb:
+            if (args[0]) {
+                args[0] -= tb_rx - 1;
+                tcg_debug_assert(args[0] <= TB_EXIT_REQUESTED + 1);
+            }
+            break;
+        case INDEX_op_plugin_cb_start:
+        case INDEX_op_plugin_cb_end:
+            return false;
+        default:
+            label_idx = tcg_op_label_arg(op->opc);
+            if (label_idx >= 0) {
+                args[label_idx] = arg_label(op->args[label_idx])->id;
+            }
+            break;
+        }
+
+        g_byte_array_append(buf, (guint8 *)&so, sizeof(so));
+        g_byte_array_append(buf, (guint8 *)args, so.nb_args * sizeof(args[0]));
+    }
+
+    return true;
+}
+
+bool tcg_ops_load(TCGContext *s, const TranslationBlock *tb,
+                  const void *data, size_t size)
+{
+    uintptr_t tb_rx = (uintptr_t)tcg_splitwx_to_rx((void *)tb);
+    const uint8_t *p = data, *end = p + size;
+    TCGOpsSaveHeader hdr;
+    TCGLabel **labels;
+    int i, j;
+
+    tcg_debug_assert(s->nb_temps == s->nb_globals && s->nb_ops == 0);
+
+    if (size < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+
+    if (hdr.nb_globals != s->nb_globals ||
+        hdr.nb_temps < hdr.nb_globals || hdr.nb_temps > TCG_MAX_TEMPS ||
+        (end - p) / sizeof(TCGOpsSaveTemp) < hdr.nb_temps - hdr.nb_globals) {
+        return false;
+    }
+    for (i = hdr.nb_globals; i < hdr.nb_temps; i++) {
+        TCGOpsSaveTemp st;
+        TCGTemp *ts;
+
+        memcpy(&st, p, sizeof(st));
+        p += sizeof(st);
+
+        if (st.base_type >= TCG_TYPE_COUNT || st.type >= TCG_TYPE_COUNT) {
+            return false;
+        }
+        switch (st.kind) {
+        case TEMP_NORMAL:
+        case TEMP_EBB:
+        case TEMP_LOCAL:
+        case TEMP_CONST:
+            break;
+        default:
+            return false;
+        }
+
+        ts = tcg_temp_alloc(s);
+        ts->base_type = st.base_type;
+        ts->type = st.type;
+        ts->kind = st.kind;
+        ts->temp_allocated = st.allocated;
+        ts->val = st.val;
+
+        if (st.hashed) {
+            GHashTable *h = s->const_table[st.base_type];
+
+            if (h == NULL) {
+                h = g_hash_table_new(g_int64_hash, g_int64_equal);
+                s->const_table[st.base_type] = h;
+            }
+            g_hash_table_insert(h, &ts->val, ts);
+        }
+    }
+
+    if ((end - p) / sizeof(TCGOpsSaveLabel) < hdr.nb_labels) {
+        return false;
+    }
+    labels = tcg_malloc(hdr.nb_labels * sizeof(TCGLabel *));
+    for (i = 0; i < hdr.nb_labels; i++) {
+        TCGOpsSaveLabel sl;
+
+        memcpy(&sl, p, sizeof(sl));
+        p += sizeof(sl);
+
+        labels[i] = gen_new_label();
+        labels[i]->refs = sl.refs;
+        labels[i]->present = sl.present;
+    }
+
+    for (i = 0; i < hdr.nb_ops; i++) {
+        uint64_t args[MAX_OPC_PARAM];
+        TCGOpsSaveOp so;
+        int nb_targs, label_idx;
+        TCGOp *op;
+
+        if (end - p < sizeof(so)) {
+            return false;
+        }
+        memcpy(&so, p, sizeof(so));
+        p += sizeof(so);
+
+        if (so.opc >= NB_OPS || so.nb_args > MAX_OPC_PARAM ||
+            so.nb_args != tcg_ops_save_nb_args(so.opc, so.param1, so.param2,
+                                               &nb_targs) ||
+            (end - p) / sizeof(args[0]) < so.nb_args) {
+            return false;
+        }
+        memcpy(args, p, so.nb_args * sizeof(args[0]));
+        p += so.nb_args * sizeof(args[0]);
+
+        op = tcg_emit_op(so.opc);
+        op->param1 = so.param1;
+        op->param2 = so.param2;
+
+        for (j = 0; j < nb_targs; j++) {
+            if (args[j] > hdr.nb_temps) {
+                return false;
+            }
+            op->args[j] = args[j] ? temp_arg(&s->temps[args[j] - 1])
+                                  : TCG_CALL_DUMMY_ARG;
+        }
+        for (; j < so.nb_args; j++) {
+            op->args[j] = args[j];
+        }
+
+        switch (so.opc) {
+        case INDEX_op_call:
+            {
+                const TCGHelperInfo *info;
+
+                if (args[nb_targs] >= ARRAY_SIZE(all_helpers)) {
+                    return false;
+                }
+                info = &all_helpers[args[nb_targs]];
+                op->args[nb_targs] = (uintptr_t)info->func;
+                op->args[nb_targs + 1] = (uintptr_t)info;
+            }
+            break;
+        case INDEX_op_exit_tb:
+            if (args[0]) {
+                op->args[0] = tb_rx + args[0] - 1;
+            }
+            break;
+        case INDEX_op_plugin_cb_start:
+        case INDEX_op_plugin_cb_end:
+            return false;
+        default:
+            label_idx = tcg_op_label_arg(so.opc);
+            if (label_idx >= 0) {
+                if (args[label_idx] >= hdr.nb_labels) {
+                    return false;
+                }
+                op->args[label_idx] = label_arg(labels[args[label_idx]]);
+            }
+            break;
+        }
+    }
+
+    return p == end;
+}
+
 /* Reachable analysis : remove unreachable code.  */
 static void reachable_code_pass(TCGContext *s)
 {
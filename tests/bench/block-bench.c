@@ -0,0 +1,586 @@
+/*
+ * Block layer I/O path benchmark
+ *
+ * Builds a graph of block nodes without a guest and drives it with a
+ * number of coroutines in one or more iothreads, measuring the overhead
+ * of the generic block layer and of the drivers in the graph.
+ *
+ * Example: two iothreads with 32 coroutines each, doing 4k random reads
+ * through copy-on-read and qcow2 on a tmpfs file, with per-layer numbers:
+ *
+ *   block-bench -t 2 -c 32 -g copy-on-read,qcow2,file -f /dev/shm/bb -L
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qom/object.h"
+#include "block/block.h"
+#include "block/aio-wait.h"
+#include "block/throttle-groups.h"
+#include "sysemu/block-backend.h"
+#include "iothread.h"
+
+#define MAX_LAYERS 16
+#define THROTTLE_GROUP_ID "block-bench-tg"
+
+/*
+ * Allocation counting. Interposing malloc() in the executable also catches
+ * allocations done by glib (g_malloc and friends) on glibc hosts.
+ */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define HAVE_ALLOC_COUNT
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static bool count_allocs;
+static uint64_t n_allocs;
+
+static inline void account_alloc(void)
+{
+    if (count_allocs) {
+        qatomic_inc(&n_allocs);
+    }
+}
+
+void *malloc(size_t size)
+{
+    account_alloc();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    account_alloc();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        account_alloc();
+    }
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *p;
+
+    if (!is_power_of_2(alignment) || alignment % sizeof(void *)) {
+        return EINVAL;
+    }
+    account_alloc();
+    p = __libc_memalign(alignment, size);
+    if (!p) {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+#endif
+
+typedef struct BenchStats {
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t lat_total_ns;
+    uint64_t lat_max_ns;
+} BenchStats;
+
+/* One independent graph, processed by one iothread (or the main loop) */
+typedef struct BenchJob {
+    IOThread *iothread;
+    AioContext *ctx;
+    BlockBackend *blk;
+    char *filename;
+    /* only touched from @ctx */
+    BenchStats stats;
+} BenchJob;
+
+typedef struct BenchCo {
+    BenchJob *job;
+    uint64_t seed;
+} BenchCo;
+
+static const char commands_string[] =
+    " -d = duration, in seconds\n"
+    " -t = number of iothreads, each with its own graph (0: main loop)\n"
+    " -c = number of coroutines per graph\n"
+    " -s = request size in bytes\n"
+    " -S = image size in bytes\n"
+    " -w = write rate (0 to 100)\n"
+    " -g = comma-separated list of nodes, from top to bottom, e.g.\n"
+    "      copy-on-read,throttle,raw,qcow2,file\n"
+    "      available: copy-on-read, throttle, raw, qcow2 (above file),\n"
+    "      null-co, null-aio, file\n"
+    " -f = image file name prefix, for graphs with a file node\n"
+    "      (put it on tmpfs to measure the block layer rather than the disk)\n"
+    " -p = qcow2 preallocation mode (off, metadata, falloc, full)\n"
+    " -L = measure each layer by adding the nodes one at a time, bottom up\n"
+    " -A = count allocations per request";
+
+static unsigned int duration = 5;
+static unsigned int n_iothreads = 1;
+static unsigned int n_coroutines = 16;
+static int64_t req_size = 4096;
+static int64_t image_size = 1 * GiB;
+static unsigned int write_rate;
+static const char *graph_str = "null-co";
+static const char *file_prefix = "/dev/shm/block-bench";
+static const char *qcow2_prealloc = "off";
+static bool per_layer;
+static bool alloc_stats;
+
+static bool test_stop;
+static unsigned int n_running;
+
+static void usage(FILE *f, char *argv[])
+{
+    fprintf(f, "Usage: %s [options]\n", argv[0]);
+    fprintf(f, "options:\n%s\n", commands_string);
+}
+
+static void usage_complete(int argc, char *argv[])
+{
+    usage(stderr, argv);
+    exit(-1);
+}
+
+/* See tests/bench/qht-bench.c */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static bool layer_is_protocol(const char *layer)
+{
+    return !strcmp(layer, "file") || !strcmp(layer, "null-co") ||
+           !strcmp(layer, "null-aio");
+}
+
+static bool layer_is_known(const char *layer)
+{
+    return layer_is_protocol(layer) || !strcmp(layer, "raw") ||
+           !strcmp(layer, "qcow2") || !strcmp(layer, "throttle") ||
+           !strcmp(layer, "copy-on-read");
+}
+
+/* Create the image files and return the options for @layers[0..n_layers) */
+static QDict *build_graph(char **layers, int n_layers, const char *filename,
+                          Error **errp)
+{
+    ERRP_GUARD();
+    QDict *opts = qdict_new();
+    g_autoptr(GString) prefix = g_string_new("");
+    g_autofree char *size_str = g_strdup_printf("%" PRId64, image_size);
+    int i;
+
+    for (i = 0; i < n_layers; i++) {
+        const char *layer = layers[i];
+        g_autofree char *key = g_strdup_printf("%sdriver", prefix->str);
+
+        qdict_put_str(opts, key, layer);
+
+        if (!strcmp(layer, "null-co") || !strcmp(layer, "null-aio")) {
+            g_autofree char *size_key = g_strdup_printf("%ssize", prefix->str);
+            g_autofree char *zeroes_key =
+                g_strdup_printf("%sread-zeroes", prefix->str);
+
+            qdict_put_str(opts, size_key, size_str);
+            qdict_put_str(opts, zeroes_key, "off");
+        } else if (!strcmp(layer, "file")) {
+            g_autofree char *fn_key =
+                g_strdup_printf("%sfilename", prefix->str);
+
+            qdict_put_str(opts, fn_key, filename);
+        } else if (!strcmp(layer, "throttle")) {
+            g_autofree char *tg_key =
+                g_strdup_printf("%sthrottle-group", prefix->str);
+
+            qdict_put_str(opts, tg_key, THROTTLE_GROUP_ID);
+        }
+
+        g_string_append(prefix, "file.");
+    }
+
+    if (!strcmp(layers[n_layers - 1], "file")) {
+        if (n_layers > 1 && !strcmp(layers[n_layers - 2], "qcow2")) {
+            g_autofree char *create_opts =
+                g_strdup_printf("preallocation=%s", qcow2_prealloc);
+
+            bdrv_img_create(filename, "qcow2", NULL, NULL, create_opts,
+                            image_size, 0, true, errp);
+        } else {
+            int fd = qemu_create(filename, O_RDWR | O_TRUNC, 0600, errp);
+
+            if (fd >= 0) {
+                if (ftruncate(fd, image_size) < 0) {
+                    error_setg_errno(errp, errno, "Could not resize '%s'",
+                                     filename);
+                }
+                qemu_close(fd);
+            }
+        }
+        if (*errp) {
+            qobject_unref(opts);
+            return NULL;
+        }
+    }
+
+    return opts;
+}
+
+static void coroutine_fn bench_co_entry(void *opaque)
+{
+    BenchCo *bco = opaque;
+    BenchJob *job = bco->job;
+    BlockBackend *blk = job->blk;
+    int64_t n_blocks = image_size / req_size;
+    uint64_t write_threshold = UINT64_MAX / 100 * write_rate;
+    void *buf = blk_blockalign(blk, req_size);
+    QEMUIOVector qiov;
+
+    memset(buf, 0xa5, req_size);
+    qemu_iovec_init_buf(&qiov, buf, req_size);
+
+    while (!qatomic_read(&test_stop)) {
+        int64_t offset;
+        int64_t start;
+        uint64_t lat;
+        bool is_write;
+        int ret;
+
+        bco->seed = xorshift64star(bco->seed);
+        offset = (bco->seed % n_blocks) * req_size;
+        bco->seed = xorshift64star(bco->seed);
+        is_write = bco->seed - 1 < write_threshold;
+
+        start = get_clock();
+        if (is_write) {
+            ret = blk_co_pwritev(blk, offset, req_size, &qiov, 0);
+        } else {
+            ret = blk_co_preadv(blk, offset, req_size, &qiov, 0);
+        }
+        lat = get_clock() - start;
+
+        if (ret < 0) {
+            job->stats.errors++;
+        } else {
+            job->stats.ops++;
+            job->stats.bytes += req_size;
+            job->stats.lat_total_ns += lat;
+            job->stats.lat_max_ns = MAX(job->stats.lat_max_ns, lat);
+        }
+
+        /*
+         * Requests may complete without yielding, e.g. with null-co, so
+         * let the other coroutines and stop_cb() run.
+         */
+        aio_co_schedule(job->ctx, qemu_coroutine_self());
+        qemu_coroutine_yield();
+    }
+
+    qemu_vfree(buf);
+    g_free(bco);
+
+    qatomic_dec(&n_running);
+    aio_wait_kick();
+}
+
+static void stop_cb(void *opaque)
+{
+    qatomic_set(&test_stop, true);
+}
+
+static void setup_job(BenchJob *job, int idx, char **layers, int n_layers)
+{
+    QDict *opts;
+
+    job->filename = g_strdup_printf("%s.%d", file_prefix, idx);
+    opts = build_graph(layers, n_layers, job->filename, &error_fatal);
+    job->blk = blk_new_open(NULL, NULL, opts, BDRV_O_RDWR, &error_fatal);
+    memset(&job->stats, 0, sizeof(job->stats));
+
+    if (n_iothreads) {
+        job->iothread = iothread_new();
+        job->ctx = iothread_get_aio_context(job->iothread);
+        blk_set_aio_context(job->blk, job->ctx, &error_fatal);
+    } else {
+        job->ctx = qemu_get_aio_context();
+    }
+}
+
+static void teardown_job(BenchJob *job, bool remove_file)
+{
+    if (job->iothread) {
+        aio_context_acquire(job->ctx);
+        blk_set_aio_context(job->blk, qemu_get_aio_context(), &error_abort);
+        aio_context_release(job->ctx);
+        iothread_join(job->iothread);
+        job->iothread = NULL;
+    }
+    blk_unref(job->blk);
+    job->blk = NULL;
+
+    if (remove_file) {
+        unlink(job->filename);
+    }
+    g_free(job->filename);
+    job->filename = NULL;
+}
+
+/* Run one measurement of @layers[0..n_layers) and fill in @total */
+static void run_test(char **layers, int n_layers, BenchStats *total,
+                     double *allocs_per_op)
+{
+    unsigned int n_jobs = MAX(n_iothreads, 1);
+    BenchJob *jobs = g_new0(BenchJob, n_jobs);
+    bool has_file = !strcmp(layers[n_layers - 1], "file");
+    QEMUTimer *timer;
+    uint64_t allocs = 0;
+    unsigned int i, j;
+
+    for (i = 0; i < n_jobs; i++) {
+        setup_job(&jobs[i], i, layers, n_layers);
+    }
+
+    qatomic_set(&test_stop, false);
+    qatomic_set(&n_running, n_jobs * n_coroutines);
+    timer = aio_timer_new(qemu_get_aio_context(), QEMU_CLOCK_REALTIME,
+                          SCALE_MS, stop_cb, NULL);
+    timer_mod(timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + duration * 1000);
+
+#ifdef HAVE_ALLOC_COUNT
+    qatomic_set(&n_allocs, 0);
+    qatomic_set(&count_allocs, alloc_stats);
+#endif
+
+    for (i = 0; i < n_jobs; i++) {
+        for (j = 0; j < n_coroutines; j++) {
+            BenchCo *bco = g_new(BenchCo, 1);
+            Coroutine *co;
+
+            bco->job = &jobs[i];
+            bco->seed = (uint64_t)i * n_coroutines + j + 1;
+            co = qemu_coroutine_create(bench_co_entry, bco);
+            aio_co_enter(jobs[i].ctx, co);
+        }
+    }
+
+    AIO_WAIT_WHILE(NULL, qatomic_read(&n_running) > 0);
+
+#ifdef HAVE_ALLOC_COUNT
+    qatomic_set(&count_allocs, false);
+    allocs = qatomic_read(&n_allocs);
+#endif
+
+    timer_free(timer);
+
+    memset(total, 0, sizeof(*total));
+    for (i = 0; i < n_jobs; i++) {
+        BenchStats *s = &jobs[i].stats;
+
+        total->ops += s->ops;
+        total->bytes += s->bytes;
+        total->errors += s->errors;
+        total->lat_total_ns += s->lat_total_ns;
+        total->lat_max_ns = MAX(total->lat_max_ns, s->lat_max_ns);
+        teardown_job(&jobs[i], has_file);
+    }
+    g_free(jobs);
+
+    *allocs_per_op = total->ops ? (double)allocs / total->ops : 0;
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" duration:       %u s\n", duration);
+    printf(" graph:          %s\n", graph_str);
+    printf(" iothreads:      %u%s\n", n_iothreads,
+           n_iothreads ? "" : " (main loop)");
+    printf(" coroutines:     %u per graph\n", n_coroutines);
+    printf(" request size:   %" PRId64 "\n", req_size);
+    printf(" image size:     %" PRId64 "\n", image_size);
+    printf(" write rate:     %u%%\n", write_rate);
+}
+
+static void pr_stats(const char *name, BenchStats *s, double allocs_per_op,
+                     double base_lat_us)
+{
+    double secs = duration;
+    double avg_us = s->ops ? (double)s->lat_total_ns / s->ops / 1000 : 0;
+
+    printf("%-14s %12.0f %10.1f %10.2f %10.2f", name, s->ops / secs,
+           s->bytes / secs / MiB, avg_us, s->lat_max_ns / 1000.0);
+    if (base_lat_us >= 0) {
+        printf(" %+10.2f", avg_us - base_lat_us);
+    }
+    if (alloc_stats) {
+#ifdef HAVE_ALLOC_COUNT
+        printf(" %10.2f", allocs_per_op);
+#else
+        printf(" %10s", "n/a");
+#endif
+    }
+    if (s->errors) {
+        printf("  (%" PRIu64 " errors)", s->errors);
+    }
+    printf("\n");
+}
+
+static void pr_header(void)
+{
+    printf("%-14s %12s %10s %10s %10s", "", "IOPS", "MiB/s", "avg us",
+           "max us");
+    if (per_layer) {
+        printf(" %10s", "layer us");
+    }
+    if (alloc_stats) {
+        printf(" %10s", "allocs/req");
+    }
+    printf("\n");
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "Ac:d:f:g:hLp:s:S:t:w:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'A':
+            alloc_stats = true;
+            break;
+        case 'c':
+            n_coroutines = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'f':
+            file_prefix = optarg;
+            break;
+        case 'g':
+            graph_str = optarg;
+            break;
+        case 'h':
+            usage(stdout, argv);
+            exit(0);
+        case 'L':
+            per_layer = true;
+            break;
+        case 'p':
+            qcow2_prealloc = optarg;
+            break;
+        case 's':
+            req_size = atoll(optarg);
+            break;
+        case 'S':
+            image_size = atoll(optarg);
+            break;
+        case 't':
+            n_iothreads = atoi(optarg);
+            break;
+        case 'w':
+            write_rate = MIN(atoi(optarg), 100);
+            break;
+        default:
+            usage_complete(argc, argv);
+        }
+    }
+
+    if (!duration || !n_coroutines || req_size <= 0 ||
+        !QEMU_IS_ALIGNED(req_size, BDRV_SECTOR_SIZE) ||
+        image_size < req_size) {
+        usage_complete(argc, argv);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_auto(GStrv) layers = NULL;
+    int n_layers;
+    int i;
+
+    parse_args(argc, argv);
+
+    layers = g_strsplit(graph_str, ",", MAX_LAYERS + 1);
+    n_layers = g_strv_length(layers);
+    if (n_layers == 0 || n_layers > MAX_LAYERS) {
+        fprintf(stderr, "Invalid graph '%s'\n", graph_str);
+        return 1;
+    }
+    for (i = 0; i < n_layers; i++) {
+        if (!layer_is_known(layers[i]) ||
+            layer_is_protocol(layers[i]) != (i == n_layers - 1) ||
+            (!strcmp(layers[i], "qcow2") &&
+             strcmp(layers[i + 1], "file"))) {
+            fprintf(stderr, "Invalid node '%s' at position %d in graph\n",
+                    layers[i], i);
+            return 1;
+        }
+    }
+
+    qemu_init_main_loop(&error_fatal);
+    bdrv_init();
+    module_call_init(MODULE_INIT_QOM);
+
+    if (strstr(graph_str, "throttle")) {
+        /* A group without limits: measures the cost of the throttle node */
+        object_new_with_props(TYPE_THROTTLE_GROUP, object_get_objects_root(),
+                              THROTTLE_GROUP_ID, &error_fatal, NULL);
+    }
+
+    pr_params();
+    printf("Results:\n");
+    pr_header();
+
+    if (per_layer) {
+        /* Start from the protocol node and add one layer at a time on top */
+        double prev_lat_us = 0;
+
+        for (i = n_layers - 1; i >= 0; i--) {
+            BenchStats stats;
+            double allocs_per_op;
+
+            if (!strcmp(layers[i], "file") && i > 0 &&
+                !strcmp(layers[i - 1], "qcow2")) {
+                /* Measure qcow2 together with the file it was created on */
+                continue;
+            }
+
+            run_test(&layers[i], n_layers - i, &stats, &allocs_per_op);
+            pr_stats(layers[i], &stats, allocs_per_op, prev_lat_us);
+            prev_lat_us = stats.ops ?
+                (double)stats.lat_total_ns / stats.ops / 1000 : 0;
+        }
+    } else {
+        BenchStats stats;
+        double allocs_per_op;
+
+        run_test(layers, n_layers, &stats, &allocs_per_op);
+        pr_stats("total", &stats, allocs_per_op, -1);
+    }
+
+    return 0;
+}
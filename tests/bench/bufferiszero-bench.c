@@ -0,0 +1,208 @@
+/*
+ * buffer_is_zero() benchmark
+ *
+ * Measures the throughput of buffer_is_zero() for every accelerator
+ * available on the host, across buffer sizes and ratios of zero buffers.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/memalign.h"
+#include "qemu/timer.h"
+
+#define NR_BUFS 64
+
+static unsigned int duration_ms = 200;
+static bool fill_random;
+static GArray *sizes;
+static GArray *ratios;
+
+static const char commands_string[] =
+    " -d = duration of each test in milliseconds (default: 200)\n"
+    " -s = comma-separated list of buffer sizes in bytes\n"
+    "      (default: 64,512,4096,65536,1048576)\n"
+    " -z = comma-separated list of zero buffer percentages\n"
+    "      (default: 0,50,90,100)\n"
+    " -f = fill non-zero buffers with random data instead of a single\n"
+    "      non-zero byte at a random offset";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/*
+ * Fill @bufs so that @ratio percent of the NR_BUFS buffers are zero, with
+ * the non-zero ones spread evenly among them.
+ */
+static void prepare_bufs(uint8_t *bufs, size_t size, unsigned int ratio)
+{
+    uint64_t r = 0x9e3779b97f4a7c15ULL ^ size;
+    unsigned int nonzero = NR_BUFS - NR_BUFS * ratio / 100;
+    unsigned int i;
+    size_t j;
+
+    memset(bufs, 0, size * NR_BUFS);
+    for (i = 0; i < nonzero; i++) {
+        uint8_t *buf = bufs + (size_t)(i * NR_BUFS / nonzero) * size;
+
+        r = xorshift64star(r);
+        if (fill_random) {
+            for (j = 0; j < size; j++) {
+                r = xorshift64star(r);
+                buf[j] = r | 1;
+            }
+        } else {
+            buf[r % size] = 1;
+        }
+    }
+}
+
+static void run_test(const char *accel, uint8_t *bufs, size_t size,
+                     unsigned int ratio)
+{
+    int64_t start, now, deadline;
+    uint64_t calls = 0, zero = 0;
+    unsigned int i;
+
+    prepare_bufs(bufs, size, ratio);
+
+    start = get_clock();
+    deadline = start + duration_ms * SCALE_MS;
+    do {
+        for (i = 0; i < NR_BUFS; i++) {
+            zero += buffer_is_zero(bufs + (size_t)i * size, size);
+        }
+        calls += NR_BUFS;
+        now = get_clock();
+    } while (now < deadline);
+
+    g_assert(zero == calls / NR_BUFS * (NR_BUFS * ratio / 100));
+
+    printf("%-8s %10zu %5u%% %12.2f %10.2f\n", accel, size, ratio,
+           (double)calls * size / (now - start),
+           (double)(now - start) / calls);
+}
+
+static void parse_list(GArray *list, const char *arg)
+{
+    g_auto(GStrv) elems = g_strsplit(arg, ",", -1);
+    int i;
+
+    g_array_set_size(list, 0);
+    for (i = 0; elems[i]; i++) {
+        uint64_t val;
+
+        if (qemu_strtou64(elems[i], NULL, 0, &val) < 0) {
+            fprintf(stderr, "Invalid number '%s'\n", elems[i]);
+            exit(1);
+        }
+        g_array_append_val(list, val);
+    }
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    static const uint64_t default_sizes[] = { 64, 512, 4096, 65536, 1048576 };
+    static const uint64_t default_ratios[] = { 0, 50, 90, 100 };
+    unsigned int i;
+    int c;
+
+    sizes = g_array_new(false, false, sizeof(uint64_t));
+    ratios = g_array_new(false, false, sizeof(uint64_t));
+    g_array_append_vals(sizes, default_sizes, ARRAY_SIZE(default_sizes));
+    g_array_append_vals(ratios, default_ratios, ARRAY_SIZE(default_ratios));
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:s:z:f");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration_ms = atoi(optarg);
+            break;
+        case 's':
+            parse_list(sizes, optarg);
+            break;
+        case 'z':
+            parse_list(ratios, optarg);
+            break;
+        case 'f':
+            fill_random = true;
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < sizes->len; i++) {
+        if (g_array_index(sizes, uint64_t, i) == 0) {
+            fprintf(stderr, "Buffer sizes must be non-zero\n");
+            exit(1);
+        }
+    }
+    for (i = 0; i < ratios->len; i++) {
+        if (g_array_index(ratios, uint64_t, i) > 100) {
+            fprintf(stderr, "Zero buffer percentages must not exceed 100\n");
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t max_size = 0;
+    uint8_t *bufs;
+    unsigned int i, j;
+    int accel = 0;
+
+    parse_args(argc, argv);
+
+    for (i = 0; i < sizes->len; i++) {
+        max_size = MAX(max_size, g_array_index(sizes, uint64_t, i));
+    }
+    bufs = qemu_memalign(64, max_size * NR_BUFS);
+
+    /*
+     * Accelerators are numbered from the best one the host supports (0)
+     * down to the plain integer implementation.
+     */
+    printf("%-8s %10s %6s %12s %10s\n",
+           "accel", "size", "zero", "GB/s", "ns/call");
+    do {
+        g_autofree char *name = g_strdup_printf("#%d", accel++);
+
+        for (i = 0; i < sizes->len; i++) {
+            for (j = 0; j < ratios->len; j++) {
+                run_test(name, bufs, g_array_index(sizes, uint64_t, i),
+                         g_array_index(ratios, uint64_t, j));
+            }
+        }
+    } while (test_buffer_is_zero_next_accel());
+
+    qemu_vfree(bufs);
+    g_array_free(sizes, true);
+    g_array_free(ratios, true);
+    return 0;
+}
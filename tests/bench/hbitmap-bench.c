@@ -0,0 +1,247 @@
+/*
+ * HBitmap benchmark
+ *
+ * Measures the bitmap operations used by incremental backup and dirty
+ * bitmap migration (merge, dirty area scan, serialization, set and reset
+ * of large ranges) on large bitmaps, for every word kernel available on
+ * the host.
+ *
+ * Example: a 1 TiB disk tracked at 64 KiB granularity is 2^24 bits, or
+ * 2^34 bits at 64 bytes:
+ *
+ *   hbitmap-bench -b 34 -z 1,10,50
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/hbitmap.h"
+#include "qemu/timer.h"
+
+/* Dirty bits are set in runs of this many bits */
+#define RUN_BITS 4096
+
+static unsigned int duration_ms = 500;
+static unsigned int log_size = 30;
+static GArray *densities;
+
+static const char commands_string[] =
+    " -d = duration of each test in milliseconds (default: 500)\n"
+    " -b = log2 of the bitmap size in bits (default: 30)\n"
+    " -z = comma-separated list of dirty bit percentages\n"
+    "      (default: 1,10,50,100)";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/* See tests/bench/qht-bench.c */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/*
+ * Dirty about @density percent of @hb in runs of RUN_BITS, at random
+ * positions so that both bitmaps of a merge have groups of words that
+ * are set in one of them only.
+ */
+static void fill_bitmap(HBitmap *hb, uint64_t size, unsigned int density,
+                        uint64_t seed)
+{
+    uint64_t runs = size / RUN_BITS;
+    uint64_t i;
+
+    hbitmap_reset_all(hb);
+    if (density >= 100) {
+        hbitmap_set(hb, 0, size);
+        return;
+    }
+    for (i = 0; i < runs; i++) {
+        seed = xorshift64star(seed);
+        if (seed % 100 < density) {
+            hbitmap_set(hb, i * RUN_BITS, RUN_BITS);
+        }
+    }
+}
+
+typedef struct BenchState {
+    HBitmap *a, *b, *result;
+    uint64_t size;
+    uint8_t *buf;
+} BenchState;
+
+static void do_merge(BenchState *s)
+{
+    hbitmap_merge(s->a, s->b, s->result);
+}
+
+static void do_merge_into(BenchState *s)
+{
+    hbitmap_merge(s->result, s->b, s->result);
+}
+
+static void do_scan(BenchState *s)
+{
+    int64_t offset, count;
+
+    for (offset = 0;
+         hbitmap_next_dirty_area(s->a, offset, s->size, INT64_MAX,
+                                 &offset, &count);
+         offset += count) {
+        /* nothing */
+    }
+}
+
+static void do_serialize(BenchState *s)
+{
+    hbitmap_serialize_part(s->a, s->buf, 0, s->size);
+}
+
+static void do_deserialize(BenchState *s)
+{
+    hbitmap_deserialize_part(s->result, s->buf, 0, s->size, true);
+}
+
+static void do_set_reset(BenchState *s)
+{
+    hbitmap_set(s->result, 0, s->size);
+    hbitmap_reset(s->result, 0, s->size);
+}
+
+static const struct {
+    const char *name;
+    void (*fn)(BenchState *s);
+} tests[] = {
+    { "merge", do_merge },
+    { "merge-into", do_merge_into },
+    { "scan", do_scan },
+    { "serialize", do_serialize },
+    { "deserialize", do_deserialize },
+    { "set-reset", do_set_reset },
+};
+
+static void run_test(const char *accel, BenchState *s, unsigned int density,
+                     int i)
+{
+    int64_t start, now, deadline;
+    uint64_t calls = 0;
+
+    start = get_clock();
+    deadline = start + duration_ms * SCALE_MS;
+    do {
+        tests[i].fn(s);
+        calls++;
+        now = get_clock();
+    } while (now < deadline);
+
+    printf("%-8s %-12s %5u%% %12.3f %12.2f\n", accel, tests[i].name, density,
+           (double)(now - start) / calls / SCALE_MS,
+           (double)s->size / 8 * calls / (now - start));
+}
+
+static void parse_list(GArray *list, const char *arg)
+{
+    g_auto(GStrv) elems = g_strsplit(arg, ",", -1);
+    int i;
+
+    g_array_set_size(list, 0);
+    for (i = 0; elems[i]; i++) {
+        uint64_t val;
+
+        if (qemu_strtou64(elems[i], NULL, 0, &val) < 0 || val > 100) {
+            fprintf(stderr, "Invalid percentage '%s'\n", elems[i]);
+            exit(1);
+        }
+        g_array_append_val(list, val);
+    }
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    static const uint64_t default_densities[] = { 1, 10, 50, 100 };
+    int c;
+
+    densities = g_array_new(false, false, sizeof(uint64_t));
+    g_array_append_vals(densities, default_densities,
+                        ARRAY_SIZE(default_densities));
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:b:z:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration_ms = atoi(optarg);
+            break;
+        case 'b':
+            log_size = atoi(optarg);
+            break;
+        case 'z':
+            parse_list(densities, optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+
+    if (log_size < 12 || log_size > HBITMAP_LOG_MAX_SIZE) {
+        fprintf(stderr, "Bitmap size must be between 2^12 and 2^%d bits\n",
+                HBITMAP_LOG_MAX_SIZE);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchState s;
+    unsigned int i, j;
+    int accel = 0;
+
+    parse_args(argc, argv);
+
+    s.size = UINT64_C(1) << log_size;
+    s.a = hbitmap_alloc(s.size, 0);
+    s.b = hbitmap_alloc(s.size, 0);
+    s.result = hbitmap_alloc(s.size, 0);
+    s.buf = g_malloc(hbitmap_serialization_size(s.a, 0, s.size));
+
+    /*
+     * Kernels are numbered from the best one the host supports (0) down
+     * to the plain integer implementation.
+     */
+    printf("%-8s %-12s %6s %12s %12s\n",
+           "accel", "test", "dirty", "ms/call", "GB/s");
+    do {
+        g_autofree char *name = g_strdup_printf("#%d", accel++);
+
+        for (i = 0; i < densities->len; i++) {
+            unsigned int density = g_array_index(densities, uint64_t, i);
+
+            fill_bitmap(s.a, s.size, density, 1);
+            fill_bitmap(s.b, s.size, density, 2);
+            for (j = 0; j < ARRAY_SIZE(tests); j++) {
+                hbitmap_reset_all(s.result);
+                run_test(name, &s, density, j);
+            }
+        }
+    } while (test_hbitmap_next_accel());
+
+    g_free(s.buf);
+    hbitmap_free(s.a);
+    hbitmap_free(s.b);
+    hbitmap_free(s.result);
+    g_array_free(densities, true);
+    return 0;
+}
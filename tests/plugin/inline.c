@@ -0,0 +1,223 @@
+/*
+ * Cross-check the counts of inline ops against the ones of callbacks.
+ *
+ * Every TB, instruction and memory access is counted three ways: by a
+ * callback, by a per-vCPU inline op and by a legacy inline op on a
+ * single counter.  Conditional callbacks fire every cond_limit
+ * executions, as tracked by a per-vCPU inline op, and STORE_U64 records
+ * the running TB for the instruction callbacks to check.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include <inttypes.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint64_t tb_cb;
+    uint64_t tb_inline;
+    uint64_t insn_cb;
+    uint64_t insn_inline;
+    uint64_t mem_cb;
+    uint64_t mem_inline;
+    uint64_t tb_cond_track;
+    uint64_t tb_cond_hits;
+    uint64_t insn_cond_track;
+    uint64_t insn_cond_hits;
+    uint64_t tb_vaddr;
+} CPUCount;
+
+static const uint64_t cond_limit = 100;
+
+/* Each vCPU only updates its own entry, so no locking is needed */
+static struct qemu_plugin_scoreboard *counts;
+static qemu_plugin_u64 tb_cb;
+static qemu_plugin_u64 tb_inline;
+static qemu_plugin_u64 insn_cb;
+static qemu_plugin_u64 insn_inline;
+static qemu_plugin_u64 mem_cb;
+static qemu_plugin_u64 mem_inline;
+static qemu_plugin_u64 tb_cond_track;
+static qemu_plugin_u64 tb_cond_hits;
+static qemu_plugin_u64 insn_cond_track;
+static qemu_plugin_u64 insn_cond_hits;
+static qemu_plugin_u64 tb_vaddr;
+
+/* Legacy inline ops, only exact with a single vCPU */
+static uint64_t global_tb;
+static uint64_t global_insn;
+static uint64_t global_mem;
+
+static void check_cond(qemu_plugin_u64 track, qemu_plugin_u64 hits,
+                       unsigned int cpu_index, uint64_t total)
+{
+    uint64_t left = qemu_plugin_u64_get(track, cpu_index);
+
+    g_assert_cmpuint(left, <=, cond_limit);
+    g_assert_cmpuint(qemu_plugin_u64_get(hits, cpu_index) * cond_limit + left,
+                     ==, total);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    int num_vcpus = qemu_plugin_num_vcpus();
+    g_autoptr(GString) report = g_string_new("");
+    int i;
+
+    for (i = 0; i < num_vcpus; i++) {
+        uint64_t tbs = qemu_plugin_u64_get(tb_inline, i);
+        uint64_t insns = qemu_plugin_u64_get(insn_inline, i);
+
+        g_string_append_printf(report, "cpu %d: tb (%" PRIu64 ", %" PRIu64
+                               ") | insn (%" PRIu64 ", %" PRIu64
+                               ") | mem (%" PRIu64 ", %" PRIu64 ")\n", i,
+                               qemu_plugin_u64_get(tb_cb, i), tbs,
+                               qemu_plugin_u64_get(insn_cb, i), insns,
+                               qemu_plugin_u64_get(mem_cb, i),
+                               qemu_plugin_u64_get(mem_inline, i));
+        g_assert_cmpuint(qemu_plugin_u64_get(tb_cb, i), ==, tbs);
+        g_assert_cmpuint(qemu_plugin_u64_get(insn_cb, i), ==, insns);
+        g_assert_cmpuint(qemu_plugin_u64_get(mem_cb, i), ==,
+                         qemu_plugin_u64_get(mem_inline, i));
+        check_cond(tb_cond_track, tb_cond_hits, i, tbs);
+        check_cond(insn_cond_track, insn_cond_hits, i, insns);
+    }
+
+    g_string_append_printf(report, "global: tb %" PRIu64 " | insn %" PRIu64
+                           " | mem %" PRIu64 "\n",
+                           global_tb, global_insn, global_mem);
+    if (num_vcpus == 1) {
+        g_assert_cmpuint(global_tb, ==, qemu_plugin_u64_sum(tb_inline));
+        g_assert_cmpuint(global_insn, ==, qemu_plugin_u64_sum(insn_inline));
+        g_assert_cmpuint(global_mem, ==, qemu_plugin_u64_sum(mem_inline));
+    }
+    qemu_plugin_outs(report->str);
+
+    qemu_plugin_scoreboard_free(counts);
+}
+
+static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
+{
+    qemu_plugin_u64_add(tb_cb, cpu_index, 1);
+}
+
+static void vcpu_tb_cond_exec(unsigned int cpu_index, void *udata)
+{
+    g_assert_cmpuint(qemu_plugin_u64_get(tb_cond_track, cpu_index), ==,
+                     cond_limit);
+    qemu_plugin_u64_set(tb_cond_track, cpu_index, 0);
+    qemu_plugin_u64_add(tb_cond_hits, cpu_index, 1);
+}
+
+static void vcpu_insn_exec(unsigned int cpu_index, void *udata)
+{
+    /* Stored by the TB of the instruction before any of it runs */
+    g_assert_cmpuint(qemu_plugin_u64_get(tb_vaddr, cpu_index), ==,
+                     (uintptr_t)udata);
+    qemu_plugin_u64_add(insn_cb, cpu_index, 1);
+}
+
+static void vcpu_insn_cond_exec(unsigned int cpu_index, void *udata)
+{
+    g_assert_cmpuint(qemu_plugin_u64_get(insn_cond_track, cpu_index), ==,
+                     cond_limit);
+    qemu_plugin_u64_set(insn_cond_track, cpu_index, 0);
+    qemu_plugin_u64_add(insn_cond_hits, cpu_index, 1);
+}
+
+static void vcpu_mem_access(unsigned int cpu_index,
+                            qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    qemu_plugin_u64_add(mem_cb, cpu_index, 1);
+}
+
+static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
+{
+    uintptr_t vaddr = qemu_plugin_tb_vaddr(tb);
+    size_t n_insns = qemu_plugin_tb_n_insns(tb);
+    size_t i;
+
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_STORE_U64, tb_vaddr, vaddr);
+
+    qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
+                                         QEMU_PLUGIN_CB_NO_REGS, NULL);
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_inline, 1);
+    qemu_plugin_register_vcpu_tb_exec_inline(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, &global_tb, 1);
+
+    qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+        tb, QEMU_PLUGIN_INLINE_ADD_U64, tb_cond_track, 1);
+    qemu_plugin_register_vcpu_tb_exec_cond_cb(
+        tb, vcpu_tb_cond_exec, QEMU_PLUGIN_CB_NO_REGS,
+        QEMU_PLUGIN_COND_EQ, tb_cond_track, cond_limit, NULL);
+
+    for (i = 0; i < n_insns; i++) {
+        struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
+
+        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                               QEMU_PLUGIN_CB_NO_REGS,
+                                               (void *)vaddr);
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_inline, 1);
+        qemu_plugin_register_vcpu_insn_exec_inline(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, &global_insn, 1);
+
+        qemu_plugin_register_vcpu_insn_exec_inline_per_vcpu(
+            insn, QEMU_PLUGIN_INLINE_ADD_U64, insn_cond_track, 1);
+        qemu_plugin_register_vcpu_insn_exec_cond_cb(
+            insn, vcpu_insn_cond_exec, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_EQ, insn_cond_track, cond_limit, NULL);
+
+        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         QEMU_PLUGIN_MEM_RW, NULL);
+        qemu_plugin_register_vcpu_mem_inline_per_vcpu(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            mem_inline, 1);
+        qemu_plugin_register_vcpu_mem_inline(
+            insn, QEMU_PLUGIN_MEM_RW, QEMU_PLUGIN_INLINE_ADD_U64,
+            &global_mem, 1);
+    }
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
+                                           const qemu_info_t *info,
+                                           int argc, char **argv)
+{
+    counts = qemu_plugin_scoreboard_new(sizeof(CPUCount));
+    tb_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, tb_cb);
+    tb_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                     tb_inline);
+    insn_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, insn_cb);
+    insn_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                       insn_inline);
+    mem_cb = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, mem_cb);
+    mem_inline = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                      mem_inline);
+    tb_cond_track = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                         tb_cond_track);
+    tb_cond_hits = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                        tb_cond_hits);
+    insn_cond_track = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                           insn_cond_track);
+    insn_cond_hits = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                          insn_cond_hits);
+    tb_vaddr = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount,
+                                                    tb_vaddr);
+
+    qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
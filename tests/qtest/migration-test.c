@@ -1715,6 +1715,134 @@ static void test_migrate_fd_proto(void)
 }
 #endif /* _WIN32 */
 
+/*
+ * A file is only read back once the source has written all of it, so
+ * the destination starts its incoming migration after the source is
+ * done.
+ */
+static void test_file_common(MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/migfile", tmpfs);
+    QTestState *from, *to;
+    void *data_hook = NULL;
+    QDict *rsp;
+
+    if (test_migrate_start(&from, &to, "defer", &args->start)) {
+        return;
+    }
+
+    migrate_ensure_non_converge(from);
+
+    if (args->start_hook) {
+        data_hook = args->start_hook(from, to);
+    }
+
+    /* Wait for the first serial output from the source */
+    if (args->result == MIG_TEST_SUCCEED) {
+        wait_for_serial("src_serial");
+    }
+
+    migrate_qmp(from, uri, "{}");
+
+    if (args->result != MIG_TEST_SUCCEED) {
+        wait_for_migration_fail(from, false);
+    } else {
+        wait_for_migration_pass(from);
+        migrate_ensure_converge(from);
+        wait_for_migration_complete(from);
+
+        if (!got_stop) {
+            qtest_qmp_eventwait(from, "STOP");
+        }
+
+        rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                               "  'arguments': { 'uri': %s }}", uri);
+        qobject_unref(rsp);
+
+        qtest_qmp_eventwait(to, "RESUME");
+
+        wait_for_serial("dest_serial");
+    }
+
+    if (args->finish_hook) {
+        args->finish_hook(from, to, data_hook);
+    }
+
+    test_migrate_end(from, to, args->result == MIG_TEST_SUCCEED);
+    cleanup("migfile");
+}
+
+static void *
+test_migrate_file_mapped_ram_start(QTestState *from,
+                                   QTestState *to)
+{
+    migrate_set_capability(from, "mapped-ram", true);
+    migrate_set_capability(to, "mapped-ram", true);
+
+    return NULL;
+}
+
+static void *
+test_migrate_file_multifd_start(QTestState *from,
+                                QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return NULL;
+}
+
+static void *
+test_migrate_file_mapped_ram_multifd_start(QTestState *from,
+                                           QTestState *to)
+{
+    test_migrate_file_multifd_start(from, to);
+
+    return test_migrate_file_mapped_ram_start(from, to);
+}
+
+static void test_precopy_file(void)
+{
+    MigrateCommon args = { };
+
+    test_file_common(&args);
+}
+
+static void test_precopy_file_mapped_ram(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_migrate_file_mapped_ram_start,
+    };
+
+    test_file_common(&args);
+}
+
+static void test_multifd_file_mapped_ram(void)
+{
+    MigrateCommon args = {
+        .start_hook = test_migrate_file_mapped_ram_multifd_start,
+    };
+
+    test_file_common(&args);
+}
+
+/* Only mapped-ram lets multifd channels write to the file */
+static void test_multifd_file_no_mapped_ram(void)
+{
+    MigrateCommon args = {
+        .start = {
+            .hide_stderr = true,
+        },
+        .start_hook = test_migrate_file_multifd_start,
+        .result = MIG_TEST_FAIL,
+    };
+
+    test_file_common(&args);
+}
+
 static void do_test_validate_uuid(MigrateStart *args, bool should_fail)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -1887,6 +2015,16 @@ test_migrate_precopy_tcp_multifd_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_zero_page_start(QTestState *from,
+                                                 QTestState *to)
+{
+    migrate_set_capability(from, "multifd-zero-page", true);
+    migrate_set_capability(to, "multifd-zero-page", true);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -1912,6 +2050,15 @@ static void test_multifd_tcp_none(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_zero_page(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_zero_page_start,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
@@ -2562,6 +2709,13 @@ int main(int argc, char **argv)
 #ifndef _WIN32
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
 #endif
+    qtest_add_func("/migration/precopy/file", test_precopy_file);
+    qtest_add_func("/migration/precopy/file/mapped-ram",
+                   test_precopy_file_mapped_ram);
+    qtest_add_func("/migration/multifd/file/mapped-ram",
+                   test_multifd_file_mapped_ram);
+    qtest_add_func("/migration/multifd/file/no-mapped-ram",
+                   test_multifd_file_no_mapped_ram);
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
     qtest_add_func("/migration/validate_uuid_error", test_validate_uuid_error);
     qtest_add_func("/migration/validate_uuid_src_not_set",
@@ -2572,6 +2726,8 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/auto_converge", test_migrate_auto_converge);
     qtest_add_func("/migration/multifd/tcp/plain/none",
                    test_multifd_tcp_none);
+    qtest_add_func("/migration/multifd/tcp/plain/zero-page",
+                   test_multifd_tcp_zero_page);
     qtest_add_func("/migration/multifd/tcp/plain/cancel",
                    test_multifd_tcp_cancel);
     qtest_add_func("/migration/multifd/tcp/plain/zlib",
@@ -0,0 +1,405 @@
+/*
+ * Allocation status cache tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "block/snapshot.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+
+#define CLUSTER_SIZE    (64 * KiB)
+#define NB_CLUSTERS     16
+#define IMAGE_SIZE      (NB_CLUSTERS * CLUSTER_SIZE)
+
+typedef struct BDRVAscTestState {
+    bool allocated[NB_CLUSTERS];
+    bool snapshot[NB_CLUSTERS];
+    int block_status_calls;
+    /* Allocate the queried cluster after answering, like a racing write */
+    bool racing_write;
+} BDRVAscTestState;
+
+static int bdrv_asc_test_open(BlockDriverState *bs, QDict *options, int flags,
+                              Error **errp)
+{
+    bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
+    return 0;
+}
+
+static int coroutine_fn bdrv_asc_test_co_preadv(BlockDriverState *bs,
+                                                int64_t offset, int64_t bytes,
+                                                QEMUIOVector *qiov,
+                                                BdrvRequestFlags flags)
+{
+    qemu_iovec_memset(qiov, 0, 0, bytes);
+    return 0;
+}
+
+static int coroutine_fn bdrv_asc_test_co_pwritev(BlockDriverState *bs,
+                                                 int64_t offset, int64_t bytes,
+                                                 QEMUIOVector *qiov,
+                                                 BdrvRequestFlags flags)
+{
+    BDRVAscTestState *s = bs->opaque;
+    int64_t i;
+
+    for (i = offset / CLUSTER_SIZE; i * CLUSTER_SIZE < offset + bytes; i++) {
+        s->allocated[i] = true;
+    }
+    return 0;
+}
+
+static int coroutine_fn bdrv_asc_test_co_truncate(BlockDriverState *bs,
+                                                  int64_t offset, bool exact,
+                                                  PreallocMode prealloc,
+                                                  BdrvRequestFlags flags,
+                                                  Error **errp)
+{
+    BDRVAscTestState *s = bs->opaque;
+    int64_t old_size = bs->total_sectors * BDRV_SECTOR_SIZE;
+    int64_t i;
+
+    g_assert_cmpint(offset, <=, IMAGE_SIZE);
+
+    /* New clusters are allocated as zeroes if the backing file has data */
+    for (i = DIV_ROUND_UP(MIN(offset, old_size), CLUSTER_SIZE);
+         i < NB_CLUSTERS; i++) {
+        s->allocated[i] = i * CLUSTER_SIZE < offset &&
+                          (flags & BDRV_REQ_ZERO_WRITE);
+    }
+    return 0;
+}
+
+static int coroutine_fn
+bdrv_asc_test_co_block_status(BlockDriverState *bs, bool want_zero,
+                              int64_t offset, int64_t bytes, int64_t *pnum,
+                              int64_t *map, BlockDriverState **file)
+{
+    BDRVAscTestState *s = bs->opaque;
+    int64_t cluster = offset / CLUSTER_SIZE;
+    int64_t end = (cluster + 1) * CLUSTER_SIZE;
+    bool allocated = s->allocated[cluster];
+
+    s->block_status_calls++;
+
+    while (end < offset + bytes &&
+           s->allocated[end / CLUSTER_SIZE] == allocated) {
+        end += CLUSTER_SIZE;
+    }
+    *pnum = MIN(end, offset + bytes) - offset;
+    *map = 0;
+    *file = NULL;
+
+    if (s->racing_write) {
+        s->racing_write = false;
+        s->allocated[cluster] = true;
+        qatomic_inc(&bs->write_gen);
+        bdrv_asc_invalidate_range(bs, cluster * CLUSTER_SIZE, CLUSTER_SIZE);
+    }
+
+    return allocated ? BDRV_BLOCK_DATA : 0;
+}
+
+static int bdrv_asc_test_snapshot_goto(BlockDriverState *bs,
+                                       const char *snapshot_id)
+{
+    BDRVAscTestState *s = bs->opaque;
+
+    memcpy(s->allocated, s->snapshot, sizeof(s->allocated));
+    return 0;
+}
+
+static int bdrv_asc_test_change_backing_file(BlockDriverState *bs,
+                                             const char *backing_file,
+                                             const char *backing_fmt)
+{
+    return 0;
+}
+
+static BlockDriver bdrv_asc_test = {
+    .format_name            = "asc-test",
+    .instance_size          = sizeof(BDRVAscTestState),
+    .supports_backing       = true,
+
+    .bdrv_open              = bdrv_asc_test_open,
+    .bdrv_co_preadv         = bdrv_asc_test_co_preadv,
+    .bdrv_co_pwritev        = bdrv_asc_test_co_pwritev,
+    .bdrv_co_truncate       = bdrv_asc_test_co_truncate,
+    .bdrv_co_block_status   = bdrv_asc_test_co_block_status,
+    .bdrv_snapshot_goto     = bdrv_asc_test_snapshot_goto,
+
+    .bdrv_child_perm        = bdrv_default_perms,
+
+    .bdrv_change_backing_file = bdrv_asc_test_change_backing_file,
+};
+
+typedef struct AscTestChain {
+    BlockBackend *blk;
+    BlockDriverState *bs;
+    BlockDriverState *backing;
+    BDRVAscTestState *s;
+} AscTestChain;
+
+static void asc_test_chain_open(AscTestChain *c)
+{
+    c->blk = blk_new(qemu_get_aio_context(), BLK_PERM_ALL, BLK_PERM_ALL);
+    c->bs = bdrv_new_open_driver(&bdrv_asc_test, "top", BDRV_O_RDWR,
+                                 &error_abort);
+    c->bs->total_sectors = IMAGE_SIZE >> BDRV_SECTOR_BITS;
+    c->s = c->bs->opaque;
+    blk_insert_bs(c->blk, c->bs, &error_abort);
+
+    c->backing = bdrv_new_open_driver(&bdrv_asc_test, "base", 0,
+                                      &error_abort);
+    c->backing->total_sectors = IMAGE_SIZE >> BDRV_SECTOR_BITS;
+    bdrv_set_backing_hd(c->bs, c->backing, &error_abort);
+}
+
+static void asc_test_chain_close(AscTestChain *c)
+{
+    bdrv_unref(c->backing);
+    bdrv_unref(c->bs);
+    blk_unref(c->blk);
+}
+
+/* Query the allocation status of the top node from @offset to the end */
+static int is_allocated(AscTestChain *c, int64_t offset, int64_t *pnum)
+{
+    int64_t len = c->bs->total_sectors * BDRV_SECTOR_SIZE;
+    int ret;
+
+    ret = bdrv_is_allocated(c->bs, offset, len - offset, pnum);
+    g_assert_cmpint(ret, >=, 0);
+    return ret;
+}
+
+static void test_lookup(void)
+{
+    BlockDriverState *bs;
+    BlockDriverState *file;
+    int64_t pnum, map;
+    int status;
+    int i;
+
+    bs = bdrv_new_open_driver(&bdrv_asc_test, "node", BDRV_O_RDWR,
+                              &error_abort);
+
+    g_assert(!bdrv_asc_lookup(bs, 0, &status, &pnum, &map, &file));
+
+    bdrv_asc_fill(bs, bs->write_gen, 0, 64 * KiB,
+                  BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID, 1 * MiB, bs);
+    bdrv_asc_fill(bs, bs->write_gen, 128 * KiB, 128 * KiB, 0, 0, NULL);
+
+    /* The answer reaches the end of the extent, and map follows offset */
+    g_assert(bdrv_asc_lookup(bs, 16 * KiB, &status, &pnum, &map, &file));
+    g_assert_cmpint(status, ==, BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID);
+    g_assert_cmpint(pnum, ==, 48 * KiB);
+    g_assert_cmpint(map, ==, 1 * MiB + 16 * KiB);
+    g_assert(file == bs);
+
+    g_assert(!bdrv_asc_lookup(bs, 64 * KiB, &status, &pnum, &map, &file));
+
+    g_assert(bdrv_asc_lookup(bs, 192 * KiB, &status, &pnum, &map, &file));
+    g_assert_cmpint(status, ==, 0);
+    g_assert_cmpint(pnum, ==, 64 * KiB);
+    g_assert_cmpint(map, ==, 0);
+    g_assert(file == NULL);
+
+    /* Invalidation drops whole extents that overlap the range */
+    bdrv_asc_invalidate_range(bs, 64 * KiB, 65 * KiB);
+    g_assert(!bdrv_asc_lookup(bs, 255 * KiB, &status, &pnum, &map, &file));
+    g_assert(bdrv_asc_lookup(bs, 0, &status, &pnum, &map, &file));
+    g_assert_cmpint(pnum, ==, 64 * KiB);
+
+    /* So does filling an overlapping extent */
+    bdrv_asc_fill(bs, bs->write_gen, 0, 32 * KiB, 0, 0, NULL);
+    g_assert(bdrv_asc_lookup(bs, 16 * KiB, &status, &pnum, &map, &file));
+    g_assert_cmpint(status, ==, 0);
+    g_assert_cmpint(pnum, ==, 16 * KiB);
+    g_assert(!bdrv_asc_lookup(bs, 48 * KiB, &status, &pnum, &map, &file));
+
+    /* An answer that a write may have made stale is not cached */
+    bdrv_asc_fill(bs, bs->write_gen - 1, 512 * KiB, 64 * KiB, 0, 0, NULL);
+    g_assert(!bdrv_asc_lookup(bs, 512 * KiB, &status, &pnum, &map, &file));
+
+    /* With all extents used, the oldest is replaced first */
+    for (i = 0; i < BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        bdrv_asc_fill(bs, bs->write_gen, (i + 1) * 64 * KiB, 64 * KiB,
+                      0, 0, NULL);
+    }
+    g_assert(!bdrv_asc_lookup(bs, 0, &status, &pnum, &map, &file));
+    for (i = 0; i < BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        g_assert(bdrv_asc_lookup(bs, (i + 1) * 64 * KiB, &status, &pnum, &map,
+                                 &file));
+    }
+    bdrv_asc_fill(bs, bs->write_gen, 0, 64 * KiB, 0, 0, NULL);
+    g_assert(bdrv_asc_lookup(bs, 0, &status, &pnum, &map, &file));
+    g_assert(!bdrv_asc_lookup(bs, 64 * KiB, &status, &pnum, &map, &file));
+
+    bdrv_asc_clear(bs);
+    for (i = 0; i <= BDRV_ALLOC_STATUS_CACHE_EXTENTS; i++) {
+        g_assert(!bdrv_asc_lookup(bs, i * 64 * KiB, &status, &pnum, &map,
+                                  &file));
+    }
+
+    bdrv_unref(bs);
+}
+
+static void test_write(void)
+{
+    AscTestChain c;
+    uint8_t buf[4 * KiB] = { 0 };
+    int64_t pnum;
+    int ret;
+
+    asc_test_chain_open(&c);
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE);
+    g_assert_cmpint(c.s->block_status_calls, ==, 1);
+
+    /* Answered from the cache */
+    g_assert_cmpint(is_allocated(&c, 256 * KiB, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE - 256 * KiB);
+    g_assert_cmpint(c.s->block_status_calls, ==, 1);
+
+    ret = blk_pwrite(c.blk, 256 * KiB, sizeof(buf), buf, 0);
+    g_assert_cmpint(ret, >=, 0);
+
+    g_assert_cmpint(is_allocated(&c, 256 * KiB, &pnum), ==, 1);
+    g_assert_cmpint(pnum, ==, 64 * KiB);
+    g_assert_cmpint(c.s->block_status_calls, ==, 2);
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, 256 * KiB);
+    g_assert_cmpint(c.s->block_status_calls, ==, 3);
+
+    g_assert_cmpint(is_allocated(&c, 64 * KiB, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, 192 * KiB);
+    g_assert_cmpint(c.s->block_status_calls, ==, 3);
+
+    asc_test_chain_close(&c);
+}
+
+static void test_truncate(void)
+{
+    AscTestChain c;
+    int64_t pnum;
+    int ret;
+
+    asc_test_chain_open(&c);
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE);
+
+    /* Growing over the backing file allocates the new area as zeroes */
+    ret = blk_truncate(c.blk, IMAGE_SIZE / 2, false, PREALLOC_MODE_OFF, 0,
+                       &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+    ret = blk_truncate(c.blk, IMAGE_SIZE, false, PREALLOC_MODE_OFF, 0,
+                       &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+
+    g_assert_cmpint(is_allocated(&c, IMAGE_SIZE / 2, &pnum), ==, 1);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE / 2);
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE / 2);
+    g_assert_cmpint(c.s->block_status_calls, ==, 3);
+
+    asc_test_chain_close(&c);
+}
+
+static void test_backing_change(void)
+{
+    AscTestChain c;
+    int64_t pnum;
+
+    asc_test_chain_open(&c);
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(c.s->block_status_calls, ==, 1);
+
+    /* Detaching the backing file drops the cache */
+    bdrv_set_backing_hd(c.bs, NULL, &error_abort);
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(c.s->block_status_calls, ==, 2);
+
+    /* And so does attaching one */
+    bdrv_set_backing_hd(c.bs, c.backing, &error_abort);
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(c.s->block_status_calls, ==, 3);
+
+    asc_test_chain_close(&c);
+}
+
+static void test_snapshot_goto(void)
+{
+    AscTestChain c;
+    int64_t pnum;
+    int ret;
+
+    asc_test_chain_open(&c);
+    c.s->snapshot[2] = true;
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE);
+
+    ret = bdrv_snapshot_goto(c.bs, "snap", &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+
+    g_assert_cmpint(is_allocated(&c, 128 * KiB, &pnum), ==, 1);
+    g_assert_cmpint(pnum, ==, 64 * KiB);
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, 128 * KiB);
+
+    asc_test_chain_close(&c);
+}
+
+/*
+ * A write that completes while the driver is being asked must not let its
+ * outdated answer into the cache.
+ */
+static void test_racing_write(void)
+{
+    AscTestChain c;
+    int64_t pnum;
+
+    asc_test_chain_open(&c);
+    c.s->racing_write = true;
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 0);
+    g_assert_cmpint(pnum, ==, IMAGE_SIZE);
+
+    g_assert_cmpint(is_allocated(&c, 0, &pnum), ==, 1);
+    g_assert_cmpint(pnum, ==, 64 * KiB);
+    g_assert_cmpint(c.s->block_status_calls, ==, 2);
+
+    asc_test_chain_close(&c);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/bdrv-alloc-status-cache/lookup", test_lookup);
+    g_test_add_func("/bdrv-alloc-status-cache/write", test_write);
+    g_test_add_func("/bdrv-alloc-status-cache/truncate", test_truncate);
+    g_test_add_func("/bdrv-alloc-status-cache/backing-change",
+                    test_backing_change);
+    g_test_add_func("/bdrv-alloc-status-cache/snapshot-goto",
+                    test_snapshot_goto);
+    g_test_add_func("/bdrv-alloc-status-cache/racing-write",
+                    test_racing_write);
+
+    return g_test_run();
+}
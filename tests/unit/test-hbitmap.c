@@ -793,6 +793,30 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+static void test_hbitmap_serialize_unfinished(TestHBitmapData *data,
+                                              const void *unused)
+{
+    hbitmap_test_init(data, L3, 0);
+
+    /* Resetting between two parts must see the bits of the first one */
+    hbitmap_deserialize_ones(data->hb, 0, 2 * L2, false);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, 2 * L2);
+    hbitmap_reset(data->hb, 0, 2 * L2);
+    hbitmap_deserialize_zeroes(data->hb, 2 * L2, L3 - 2 * L2, false);
+    hbitmap_deserialize_finish(data->hb);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, 0);
+    g_assert_cmpint(hbitmap_next_dirty(data->hb, 0, L3), ==, -1);
+
+    /* Likewise for setting */
+    hbitmap_set(data->hb, 0, L3);
+    hbitmap_deserialize_zeroes(data->hb, 0, 2 * L2, false);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, L3 - 2 * L2);
+    hbitmap_set(data->hb, 0, L3);
+    hbitmap_deserialize_finish(data->hb);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, L3);
+    g_assert_cmpint(hbitmap_next_zero(data->hb, 0, L3), ==, -1);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -1042,6 +1066,38 @@ static void test_hbitmap_next_dirty_area_after_truncate(TestHBitmapData *data,
     test_hbitmap_next_dirty_area_check(data, 0, INT64_MAX);
 }
 
+/* Merge with groups of words that are set in either, both or neither of
+ * the two bitmaps, once for each set of word kernels.
+ */
+static void test_hbitmap_merge(TestHBitmapData *data, const void *unused)
+{
+    HBitmap *other;
+
+    do {
+        hbitmap_test_init(data, L3, 0);
+        other = hbitmap_alloc(L3, 0);
+
+        hbitmap_test_set(data, 0, L2 + 7);
+        hbitmap_test_set(data, L2 * 3 + 5, L1 * 3);
+        hbitmap_set(other, L2 * 3, L2);
+        hbitmap_set(other, L2 * 10 + 1, 1);
+
+        hbitmap_merge(data->hb, other, data->hb);
+        bitmap_set(data->bits, L2 * 3, L2);
+        bitmap_set(data->bits, L2 * 10 + 1, 1);
+        hbitmap_test_check(data, 0);
+        g_assert_cmpint(hbitmap_next_zero(data->hb, 0, L3), ==, L2 + 7);
+
+        /* Merging into the other operand gives the same bitmap */
+        hbitmap_merge(data->hb, other, other);
+        g_assert_cmpint(hbitmap_count(other), ==, hbitmap_count(data->hb));
+        g_assert_cmpint(hbitmap_next_zero(other, L2 * 3, L3), ==, L2 * 4);
+
+        hbitmap_free(other);
+        hbitmap_test_teardown(data, NULL);
+    } while (test_hbitmap_next_accel());
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1093,6 +1149,8 @@ int main(int argc, char **argv)
                      test_hbitmap_serialize_part);
     hbitmap_test_add("/hbitmap/serialize/zeroes",
                      test_hbitmap_serialize_zeroes);
+    hbitmap_test_add("/hbitmap/serialize/unfinished",
+                     test_hbitmap_serialize_unfinished);
 
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
@@ -1113,6 +1171,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_dirty_area/next_dirty_area_after_truncate",
                      test_hbitmap_next_dirty_area_after_truncate);
 
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
+
     g_test_run();
 
     return 0;
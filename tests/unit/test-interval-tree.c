@@ -0,0 +1,129 @@
+/*
+ * Interval tree unit-tests.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define NR_NODES    512
+#define NR_QUERIES  64
+#define MAX_VALUE   4096
+
+static IntervalTreeNode nodes[NR_NODES];
+static bool inserted[NR_NODES];
+
+static bool overlaps(IntervalTreeNode *node, uint64_t start, uint64_t last)
+{
+    return node->start <= last && start <= node->last;
+}
+
+/* Check the tree against a linear scan of the inserted nodes */
+static void check_query(IntervalTreeRoot *root, uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *node;
+    uint64_t prev_start = 0;
+    int expected = 0, found = 0;
+    int i;
+
+    for (i = 0; i < NR_NODES; i++) {
+        if (inserted[i] && overlaps(&nodes[i], start, last)) {
+            expected++;
+        }
+    }
+
+    for (node = interval_tree_iter_first(root, start, last); node;
+         node = interval_tree_iter_next(node, start, last)) {
+        g_assert(inserted[node - nodes]);
+        g_assert(overlaps(node, start, last));
+        g_assert_cmpuint(node->start, >=, prev_start);
+        prev_start = node->start;
+        found++;
+    }
+
+    g_assert_cmpint(found, ==, expected);
+}
+
+static void random_interval(IntervalTreeNode *node)
+{
+    node->start = g_test_rand_int_range(0, MAX_VALUE);
+    node->last = node->start + g_test_rand_int_range(0, MAX_VALUE / 16);
+}
+
+static void test_interval_tree_random(void)
+{
+    IntervalTreeRoot root = { };
+    int i, j;
+
+    memset(inserted, 0, sizeof(inserted));
+
+    for (i = 0; i < NR_NODES * 8; i++) {
+        j = g_test_rand_int_range(0, NR_NODES);
+        if (inserted[j]) {
+            interval_tree_remove(&nodes[j], &root);
+            inserted[j] = false;
+        } else {
+            random_interval(&nodes[j]);
+            interval_tree_insert(&nodes[j], &root);
+            inserted[j] = true;
+        }
+
+        if (i % (NR_NODES / 4) == 0) {
+            for (j = 0; j < NR_QUERIES; j++) {
+                IntervalTreeNode query;
+
+                random_interval(&query);
+                check_query(&root, query.start, query.last);
+            }
+        }
+    }
+
+    for (j = 0; j < NR_NODES; j++) {
+        if (inserted[j]) {
+            interval_tree_remove(&nodes[j], &root);
+            inserted[j] = false;
+        }
+    }
+    g_assert(root.node == NULL);
+}
+
+static void test_interval_tree_same_interval(void)
+{
+    IntervalTreeRoot root = { };
+    int i;
+
+    memset(inserted, 0, sizeof(inserted));
+
+    for (i = 0; i < 16; i++) {
+        nodes[i].start = 100;
+        nodes[i].last = 199;
+        interval_tree_insert(&nodes[i], &root);
+        inserted[i] = true;
+    }
+
+    check_query(&root, 0, 99);
+    check_query(&root, 199, 199);
+    check_query(&root, 150, 1000);
+    check_query(&root, 200, 1000);
+
+    for (i = 0; i < 16; i += 2) {
+        interval_tree_remove(&nodes[i], &root);
+        inserted[i] = false;
+    }
+    check_query(&root, 0, 1000);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/interval-tree/random", test_interval_tree_random);
+    g_test_add_func("/interval-tree/same-interval",
+                    test_interval_tree_same_interval);
+
+    g_test_run();
+
+    return 0;
+}
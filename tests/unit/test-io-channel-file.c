@@ -101,6 +101,51 @@ static void test_io_channel_fd(void)
     object_unref(OBJECT(ioc));
 }
 
+#ifdef CONFIG_PREADV
+static void test_io_channel_file_pwritev(void)
+{
+    QIOChannel *ioc;
+    char wbuf[2][16];
+    char rbuf[2][16];
+    struct iovec wiov[2] = {
+        { .iov_base = wbuf[0], .iov_len = sizeof(wbuf[0]) },
+        { .iov_base = wbuf[1], .iov_len = sizeof(wbuf[1]) },
+    };
+    struct iovec riov[2] = {
+        { .iov_base = rbuf[0], .iov_len = sizeof(rbuf[0]) },
+        { .iov_base = rbuf[1], .iov_len = sizeof(rbuf[1]) },
+    };
+    int ret;
+
+    unlink(TEST_FILE);
+    ioc = QIO_CHANNEL(qio_channel_file_new_path(
+                          TEST_FILE,
+                          O_RDWR | O_CREAT | O_TRUNC | O_BINARY, TEST_MASK,
+                          &error_abort));
+    g_assert(qio_channel_has_feature(ioc, QIO_CHANNEL_FEATURE_SEEKABLE));
+
+    memset(wbuf[0], 'a', sizeof(wbuf[0]));
+    memset(wbuf[1], 'b', sizeof(wbuf[1]));
+    ret = qio_channel_pwritev_all(ioc, wiov, 2, 4096, &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+
+    /* The current I/O position must not have moved */
+    g_assert_cmpint(qio_channel_io_seek(ioc, 0, SEEK_CUR, &error_abort),
+                    ==, 0);
+
+    ret = qio_channel_preadv_all(ioc, riov, 2, 4096, &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(memcmp(wbuf, rbuf, sizeof(wbuf)) == 0);
+
+    /* Reading beyond the end of the file is an error */
+    ret = qio_channel_preadv_all(ioc, riov, 2, 4096 + 16, NULL);
+    g_assert_cmpint(ret, ==, -1);
+
+    unlink(TEST_FILE);
+    object_unref(OBJECT(ioc));
+}
+#endif /* CONFIG_PREADV */
+
 
 #ifndef _WIN32
 static void test_io_channel_pipe(bool async)
@@ -147,6 +192,9 @@ int main(int argc, char **argv)
     g_test_add_func("/io/channel/file", test_io_channel_file);
     g_test_add_func("/io/channel/file/rdwr", test_io_channel_file_rdwr);
     g_test_add_func("/io/channel/file/fd", test_io_channel_fd);
+#ifdef CONFIG_PREADV
+    g_test_add_func("/io/channel/file/pwritev", test_io_channel_file_pwritev);
+#endif
 #ifndef _WIN32
     g_test_add_func("/io/channel/pipe/sync", test_io_channel_pipe_sync);
     g_test_add_func("/io/channel/pipe/async", test_io_channel_pipe_async);
@@ -39,6 +39,7 @@ struct AioHandler {
     int64_t poll_idle_timeout; /* when to stop userspace polling */
     bool poll_ready; /* has polling detected an event? */
     bool is_external;
+    bool is_event_notifier; /* registered with aio_set_event_notifier()? */
 };
 
 /* Add a handler to a ready list */
@@ -275,6 +275,7 @@ static void __attribute__((constructor)) init_cpuid_cache(void)
     unsigned max = __get_cpuid_max(0, NULL);
     int a, b, c, d;
     unsigned cache = 0;
+    unsigned avx;
 
     if (max >= 1) {
         __cpuid(1, a, b, c, d);
@@ -284,24 +285,14 @@ static void __attribute__((constructor)) init_cpuid_cache(void)
         if (c & bit_SSE4_1) {
             cache |= CACHE_SSE4;
         }
+    }
 
-        /* We must check that AVX is not just available, but usable.  */
-        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
-            int bv;
-            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
-            __cpuid_count(7, 0, a, b, c, d);
-            if ((bv & 0x6) == 0x6 && (b & bit_AVX2)) {
-                cache |= CACHE_AVX2;
-            }
-            /* 0xe6:
-            *  XCR0[7:5] = 111b (OPMASK state, upper 256-bit of ZMM0-ZMM15
-            *                    and ZMM16-ZMM31 state are enabled by OS)
-            *  XCR0[2:1] = 11b (XMM state and YMM state are enabled by OS)
-            */
-            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512F)) {
-                cache |= CACHE_AVX512F;
-            }
-        }
+    avx = cpuid_usable_avx();
+    if (avx & bit_AVX2) {
+        cache |= CACHE_AVX2;
+    }
+    if (avx & bit_AVX512F) {
+        cache |= CACHE_AVX512F;
     }
     cpuid_cache = cache;
     init_accel(cache);
@@ -329,6 +320,60 @@ static bool select_accel_fn(const void *buf, size_t len)
     return buffer_zero_int(buf, len);
 }
 
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+/* Note that this function requires len >= 64.  */
+
+static bool
+buffer_zero_neon(const void *buf, size_t len)
+{
+    uint32x4_t t = vld1q_u32(buf);
+    const uint32x4_t *p = (uint32x4_t *)(((uintptr_t)buf + 5 * 16) & -16);
+    const uint32x4_t *e = (uint32x4_t *)(((uintptr_t)buf + len) & -16);
+
+    /* Loop over 16-byte aligned blocks of 64.  */
+    while (likely(p <= e)) {
+        __builtin_prefetch(p);
+        /* UMAXV is only zero if all input bytes are zero.  */
+        if (unlikely(vmaxvq_u32(t) != 0)) {
+            return false;
+        }
+        t = p[-4] | p[-3] | p[-2] | p[-1];
+        p += 4;
+    }
+
+    /* Finish the aligned tail.  */
+    t |= e[-3];
+    t |= e[-2];
+    t |= e[-1];
+
+    /* Finish the unaligned tail.  */
+    t |= vld1q_u32(buf + len - 16);
+
+    return vmaxvq_u32(t) == 0;
+}
+
+/* NEON is part of the base aarch64 ISA, so there is nothing to probe.  */
+static bool use_neon = true;
+
+bool test_buffer_is_zero_next_accel(void)
+{
+    if (!use_neon) {
+        return false;
+    }
+    use_neon = false;
+    return true;
+}
+
+static bool select_accel_fn(const void *buf, size_t len)
+{
+    if (likely(len >= 64) && use_neon) {
+        return buffer_zero_neon(buf, len);
+    }
+    return buffer_zero_int(buf, len);
+}
+
 #else
 #define select_accel_fn  buffer_zero_int
 bool test_buffer_is_zero_next_accel(void)
@@ -349,6 +394,18 @@ bool buffer_is_zero(const void *buf, size_t len)
     /* Fetch the beginning of the buffer while we select the accelerator.  */
     __builtin_prefetch(buf);
 
+    /*
+     * Most callers (migration, qemu-img convert, mirror) mostly see buffers
+     * that are not zero.  Probe the head, middle and tail before committing
+     * to a full scan; the probed bytes are cheap to re-read if they are zero.
+     */
+    if (likely(len >= 64)) {
+        if (ldq_he_p(buf) | ldq_he_p(buf + len / 2 - 4) |
+            ldq_he_p(buf + len - 8)) {
+            return false;
+        }
+    }
+
     /* Use an optimized zero check if possible.  Note that this also
        includes a check for an unrolled loop over 64-bit integers.  */
     return select_accel_fn(buf, len);
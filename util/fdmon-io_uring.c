@@ -19,13 +19,21 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Other users in the AioContext's home thread, such as block/io_uring.c, can
+ * queue their own requests on the same ring with aio_io_uring_add_sqe().  An
+ * IOThread that handles both virtqueue ioeventfds and disk I/O then submits
+ * requests and waits for events and completions in a single syscall.  Their
+ * cqes are tagged and dispatched from aio_poll() via a private AioHandler,
+ * fdmon_io_uring_cqe_node, rather than from within fdmon_io_uring_wait().
  *
  * File descriptor monitoring is implemented using the following operations:
  *
  * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ *    EventNotifier handlers use multishot polls that stay armed across events
+ *    when the host supports them; they always clear the notifier, so the
+ *    edge-triggered semantics of multishot polls are fine.  Other handlers
+ *    may rely on level-triggered semantics and use one-shot polls that are
+ *    re-armed after each event.
  * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
  *    the poll mask changes for a file descriptor it is first removed and then
  *    re-added with the new poll mask, so this operation is also used as part
@@ -34,6 +42,12 @@
  *    for events.  This operation self-cancels if another event completes
  *    before the timeout.
  *
+ * While external clients are disabled, one-shot polls of external handlers
+ * are not re-armed after they fire.  Once external clients are enabled again
+ * (ctx->external_enable_gen changes), they are re-armed and handlers with
+ * multishot polls are dispatched once in case an event was dropped meanwhile.
+ * Spurious dispatch is harmless for EventNotifier handlers.
+ *
  * io_uring calls the submission queue the "sq ring" and the completion queue
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
@@ -55,8 +69,12 @@ enum {
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
     FDMON_IO_URING_REMOVE   = (1 << 2),
+    FDMON_IO_URING_ARMED    = (1 << 3), /* a poll request is in the ring */
 };
 
+/* Tags the user_data of aio_io_uring_add_sqe() requests */
+#define FDMON_IO_URING_CQE_HANDLER_TAG 1
+
 static inline int poll_events_from_pfd(int pfd_events)
 {
     return (pfd_events & G_IO_IN ? POLLIN : 0) |
@@ -171,8 +189,16 @@ static void add_poll_add_sqe(AioContext *ctx, AioHandler *node)
     struct io_uring_sqe *sqe = get_sqe(ctx);
     int events = poll_events_from_pfd(node->pfd.events);
 
-    io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (node->is_event_notifier && ctx->fdmon_io_uring_multishot) {
+        io_uring_prep_poll_multishot(sqe, node->pfd.fd, events);
+    } else
+#endif
+    {
+        io_uring_prep_poll_add(sqe, node->pfd.fd, events);
+    }
     io_uring_sqe_set_data(sqe, node);
+    qatomic_or(&node->flags, FDMON_IO_URING_ARMED);
 }
 
 static void add_poll_remove_sqe(AioContext *ctx, AioHandler *node)
@@ -214,39 +240,134 @@ static void fill_sq_ring(AioContext *ctx)
             add_poll_add_sqe(ctx, node);
         }
         if (flags & FDMON_IO_URING_REMOVE) {
-            add_poll_remove_sqe(ctx, node);
+            if (qatomic_read(&node->flags) & FDMON_IO_URING_ARMED) {
+                add_poll_remove_sqe(ctx, node);
+            } else {
+                /* Not re-armed while external clients were disabled */
+                qatomic_and(&node->flags, ~FDMON_IO_URING_REMOVE);
+                QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                      node_deleted);
+            }
         }
     }
 }
 
+/*
+ * Called once external clients have been enabled again.  Returns the number
+ * of handlers added to @ready_list.
+ */
+static int rearm_external(AioContext *ctx, AioHandlerList *ready_list)
+{
+    AioHandler *node;
+    int num_ready = 0;
+
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        unsigned flags;
+
+        if (!node->is_external || QLIST_IS_INSERTED(node, node_deleted)) {
+            continue;
+        }
+
+        flags = qatomic_read(&node->flags);
+        if (flags & FDMON_IO_URING_REMOVE) {
+            continue;
+        }
+
+        if (!(flags & FDMON_IO_URING_ARMED)) {
+            add_poll_add_sqe(ctx, node);
+        } else if (node->is_event_notifier) {
+            /* A multishot poll event may have been dropped by dispatch */
+            aio_add_ready_handler(ready_list, node, G_IO_IN);
+            num_ready++;
+        }
+    }
+    return num_ready;
+}
+
+/* AioHandler::io_read() for fdmon_io_uring_cqe_node */
+static void dispatch_cqe_handlers(void *opaque)
+{
+    AioContext *ctx = opaque;
+    AioUringCqeHandler *handler;
+
+    /* Handlers may run a nested aio_poll(), so dequeue one at a time */
+    while ((handler = QSIMPLEQ_FIRST(&ctx->fdmon_io_uring_cqe_handlers))) {
+        QSIMPLEQ_REMOVE_HEAD(&ctx->fdmon_io_uring_cqe_handlers, next);
+        handler->cb(handler);
+    }
+}
+
 /* Returns true if a handler became ready */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
                         struct io_uring_cqe *cqe)
 {
-    AioHandler *node = io_uring_cqe_get_data(cqe);
+    void *data = io_uring_cqe_get_data(cqe);
+    AioHandler *node;
     unsigned flags;
+    bool more = false;
 
     /* poll_timeout and poll_remove have a zero user_data field */
-    if (!node) {
+    if (!data) {
         return false;
     }
 
+    if ((uintptr_t)data & FDMON_IO_URING_CQE_HANDLER_TAG) {
+        AioUringCqeHandler *handler =
+            (void *)((uintptr_t)data & ~FDMON_IO_URING_CQE_HANDLER_TAG);
+
+        handler->cqe_res = cqe->res;
+        QSIMPLEQ_INSERT_TAIL(&ctx->fdmon_io_uring_cqe_handlers, handler, next);
+        aio_add_ready_handler(ready_list, ctx->fdmon_io_uring_cqe_node,
+                              G_IO_IN);
+        return true;
+    }
+
+    node = data;
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    /* Multishot polls stay armed until a cqe without IORING_CQE_F_MORE */
+    more = cqe->flags & IORING_CQE_F_MORE;
+#endif
+
     /*
-     * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
-     * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
-     * bit before IORING_OP_POLL_REMOVE is submitted.
+     * Deletion can only happen when the poll request completes for good.  If
+     * we race with enqueue() here then we can safely clear the
+     * FDMON_IO_URING_REMOVE bit before IORING_OP_POLL_REMOVE is submitted.
      */
-    flags = qatomic_fetch_and(&node->flags, ~FDMON_IO_URING_REMOVE);
+    if (more) {
+        flags = qatomic_read(&node->flags);
+    } else {
+        flags = qatomic_fetch_and(&node->flags, ~(FDMON_IO_URING_REMOVE |
+                                                  FDMON_IO_URING_ARMED));
+    }
     if (flags & FDMON_IO_URING_REMOVE) {
-        QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node, node_deleted);
+        if (!more) {
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+        }
         return false;
     }
 
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    if (cqe->res == -EINVAL && node->is_event_notifier &&
+        ctx->fdmon_io_uring_multishot) {
+        /* The kernel does not support multishot poll, use one-shot instead */
+        ctx->fdmon_io_uring_multishot = false;
+        add_poll_add_sqe(ctx, node);
+        return false;
+    }
+#endif
+
     aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
 
-    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
-    add_poll_add_sqe(ctx, node);
+    /*
+     * One-shot polls must be re-armed.  Don't re-arm external handlers while
+     * external clients are disabled, they would complete again and again
+     * without being dispatched.  rearm_external() takes care of them.
+     */
+    if (!more && aio_node_check(ctx, node->is_external)) {
+        add_poll_add_sqe(ctx, node);
+    }
     return true;
 }
 
@@ -274,14 +395,16 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
                                int64_t timeout)
 {
     unsigned wait_nr = 1; /* block until at least one cqe is ready */
+    unsigned external_enable_gen = qatomic_read(&ctx->external_enable_gen);
+    int num_ready = 0;
     int ret;
 
-    /* Fall back while external clients are disabled */
-    if (qatomic_read(&ctx->external_disable_cnt)) {
-        return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+    if (external_enable_gen != ctx->fdmon_io_uring_external_enable_gen) {
+        ctx->fdmon_io_uring_external_enable_gen = external_enable_gen;
+        num_ready = rearm_external(ctx, ready_list);
     }
 
-    if (timeout == 0) {
+    if (timeout == 0 || num_ready > 0) {
         wait_nr = 0; /* non-blocking */
     } else if (timeout > 0) {
         add_timeout_sqe(ctx, timeout);
@@ -295,7 +418,7 @@ static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
 
     assert(ret >= 0);
 
-    return process_cq_ring(ctx, ready_list);
+    return num_ready + process_cq_ring(ctx, ready_list);
 }
 
 static bool fdmon_io_uring_need_wait(AioContext *ctx)
@@ -315,8 +438,9 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
         return true;
     }
 
-    /* Are we falling back to fdmon-poll? */
-    return qatomic_read(&ctx->external_disable_cnt);
+    /* Do external handlers need to be re-armed? */
+    return qatomic_read(&ctx->external_enable_gen) !=
+           ctx->fdmon_io_uring_external_enable_gen;
 }
 
 static const FDMonOps fdmon_io_uring_ops = {
@@ -325,8 +449,29 @@ static const FDMonOps fdmon_io_uring_ops = {
     .need_wait = fdmon_io_uring_need_wait,
 };
 
+bool aio_io_uring_add_sqe(AioContext *ctx, const struct io_uring_sqe *sqe,
+                          AioUringCqeHandler *handler)
+{
+    struct io_uring_sqe *new_sqe;
+
+    if (ctx->fdmon_ops != &fdmon_io_uring_ops ||
+        qemu_get_current_aio_context() != ctx) {
+        return false;
+    }
+
+    /* The tag bit must be free */
+    QEMU_BUILD_BUG_ON(__alignof__(AioUringCqeHandler) < 2);
+
+    new_sqe = get_sqe(ctx);
+    *new_sqe = *sqe;
+    io_uring_sqe_set_data(new_sqe, (void *)((uintptr_t)handler |
+                                            FDMON_IO_URING_CQE_HANDLER_TAG));
+    return true;
+}
+
 bool fdmon_io_uring_setup(AioContext *ctx)
 {
+    AioHandler *node;
     int ret;
 
     ret = io_uring_queue_init(FDMON_IO_URING_ENTRIES, &ctx->fdmon_io_uring, 0);
@@ -334,6 +479,19 @@ bool fdmon_io_uring_setup(AioContext *ctx)
         return false;
     }
 
+    node = g_new0(AioHandler, 1);
+    node->pfd.fd = -1;
+    node->pfd.events = G_IO_IN;
+    node->io_read = dispatch_cqe_handlers;
+    node->opaque = ctx;
+    ctx->fdmon_io_uring_cqe_node = node;
+    QSIMPLEQ_INIT(&ctx->fdmon_io_uring_cqe_handlers);
+
+#ifdef HAVE_IO_URING_PREP_POLL_MULTISHOT
+    ctx->fdmon_io_uring_multishot = true;
+#endif
+    ctx->fdmon_io_uring_external_enable_gen =
+        qatomic_read(&ctx->external_enable_gen);
     QSLIST_INIT(&ctx->submit_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
@@ -360,6 +518,10 @@ void fdmon_io_uring_destroy(AioContext *ctx)
             QSLIST_REMOVE_HEAD_RCU(&ctx->submit_list, node_submitted);
         }
 
+        assert(QSIMPLEQ_EMPTY(&ctx->fdmon_io_uring_cqe_handlers));
+        g_free(ctx->fdmon_io_uring_cqe_node);
+        ctx->fdmon_io_uring_cqe_node = NULL;
+
         ctx->fdmon_ops = &fdmon_poll_ops;
     }
 }
@@ -99,8 +99,199 @@ struct HBitmap {
 
     /* The length of each levels[] array. */
     uint64_t sizes[HBITMAP_LEVELS];
+
+    /* Number of set bits in each group of BITS_PER_LONG words of the last
+     * level, i.e. under each bit of the 2nd-last level.  This lets counting
+     * and filling skip whole groups, and merging reuse the counts of groups
+     * that are empty in one of the operands.
+     */
+    uint32_t *group_count;
 };
 
+/* Number of bits covered by one entry of group_count */
+#define HB_GROUP_BITS (BITS_PER_LONG * BITS_PER_LONG)
+
+/* The word array kernels below are used for the last level, which is
+ * where merge, count and (de)serialization spend their time on large
+ * bitmaps.  hb_or_words() stores a | b in dst and returns the number of
+ * bits set in the result, hb_count_words() returns the number of bits set.
+ */
+static uint64_t hb_or_words_int(unsigned long *dst, const unsigned long *a,
+                                const unsigned long *b, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        dst[i] = a[i] | b[i];
+        count += ctpopl(dst[i]);
+    }
+    return count;
+}
+
+static uint64_t hb_count_words_int(const unsigned long *p, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(p[i]);
+    }
+    return count;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* Population count of each byte, using a nibble lookup table.  Without
+ * AVX512-VPOPCNTDQ this is faster than popcnt on each word.
+ */
+static inline __m256i hb_popcnt8_avx2(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                           _mm256_shuffle_epi8(lut, hi));
+}
+
+/* Accumulate the byte counts of v into the four 64-bit lanes of acc */
+static inline __m256i hb_popcnt_acc_avx2(__m256i acc, __m256i v)
+{
+    return _mm256_add_epi64(acc, _mm256_sad_epu8(hb_popcnt8_avx2(v),
+                                                 _mm256_setzero_si256()));
+}
+
+static inline uint64_t hb_popcnt_sum_avx2(__m256i acc)
+{
+    uint64_t lanes[4];
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+#define HB_WORDS_PER_YMM (sizeof(__m256i) / sizeof(unsigned long))
+
+static uint64_t hb_or_words_avx2(unsigned long *dst, const unsigned long *a,
+                                 const unsigned long *b, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + HB_WORDS_PER_YMM <= n; i += HB_WORDS_PER_YMM) {
+        __m256i v = _mm256_or_si256(_mm256_loadu_si256((__m256i *)&a[i]),
+                                    _mm256_loadu_si256((__m256i *)&b[i]));
+
+        _mm256_storeu_si256((__m256i *)&dst[i], v);
+        acc = hb_popcnt_acc_avx2(acc, v);
+    }
+    return hb_popcnt_sum_avx2(acc) +
+           hb_or_words_int(&dst[i], &a[i], &b[i], n - i);
+}
+
+static uint64_t hb_count_words_avx2(const unsigned long *p, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + HB_WORDS_PER_YMM <= n; i += HB_WORDS_PER_YMM) {
+        acc = hb_popcnt_acc_avx2(acc, _mm256_loadu_si256((__m256i *)&p[i]));
+    }
+    return hb_popcnt_sum_avx2(acc) + hb_count_words_int(&p[i], n - i);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+
+#define HB_WORDS_PER_Q (sizeof(uint64x2_t) / sizeof(unsigned long))
+
+/* Sum the byte counts of v into the two 64-bit lanes of acc */
+static inline uint64x2_t hb_popcnt_acc_neon(uint64x2_t acc, uint8x16_t v)
+{
+    return vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(vcntq_u8(v))));
+}
+
+static uint64_t hb_or_words_neon(unsigned long *dst, const unsigned long *a,
+                                 const unsigned long *b, size_t n)
+{
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i;
+
+    for (i = 0; i + HB_WORDS_PER_Q <= n; i += HB_WORDS_PER_Q) {
+        uint8x16_t v = vorrq_u8(vld1q_u8((const uint8_t *)&a[i]),
+                                vld1q_u8((const uint8_t *)&b[i]));
+
+        vst1q_u8((uint8_t *)&dst[i], v);
+        acc = hb_popcnt_acc_neon(acc, v);
+    }
+    return vaddvq_u64(acc) + hb_or_words_int(&dst[i], &a[i], &b[i], n - i);
+}
+
+static uint64_t hb_count_words_neon(const unsigned long *p, size_t n)
+{
+    uint64x2_t acc = vdupq_n_u64(0);
+    size_t i;
+
+    for (i = 0; i + HB_WORDS_PER_Q <= n; i += HB_WORDS_PER_Q) {
+        acc = hb_popcnt_acc_neon(acc, vld1q_u8((const uint8_t *)&p[i]));
+    }
+    return vaddvq_u64(acc) + hb_count_words_int(&p[i], n - i);
+}
+
+/* NEON is part of the base aarch64 ISA, so there is nothing to probe.  */
+# define HB_ACCEL_AVAILABLE true
+# define HB_OR_WORDS_ACCEL hb_or_words_neon
+# define HB_COUNT_WORDS_ACCEL hb_count_words_neon
+#elif defined(CONFIG_AVX2_OPT)
+#include "qemu/cpuid.h"
+
+# define HB_ACCEL_AVAILABLE ((cpuid_usable_avx() & bit_AVX2) != 0)
+# define HB_OR_WORDS_ACCEL hb_or_words_avx2
+# define HB_COUNT_WORDS_ACCEL hb_count_words_avx2
+#endif
+
+static uint64_t (*hb_or_words)(unsigned long *dst, const unsigned long *a,
+                               const unsigned long *b, size_t n) =
+    hb_or_words_int;
+static uint64_t (*hb_count_words)(const unsigned long *p, size_t n) =
+    hb_count_words_int;
+
+#ifdef HB_ACCEL_AVAILABLE
+static bool hb_accel;
+
+static void __attribute__((constructor)) hbitmap_init_accel(void)
+{
+    hb_accel = HB_ACCEL_AVAILABLE;
+    if (hb_accel) {
+        hb_or_words = HB_OR_WORDS_ACCEL;
+        hb_count_words = HB_COUNT_WORDS_ACCEL;
+    }
+}
+#endif
+
+bool test_hbitmap_next_accel(void)
+{
+#ifdef HB_ACCEL_AVAILABLE
+    /* Fall back from the vector kernels to the integer ones, once.  */
+    if (hb_accel) {
+        hb_accel = false;
+        hb_or_words = hb_or_words_int;
+        hb_count_words = hb_count_words_int;
+        return true;
+    }
+#endif
+    return false;
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -247,6 +438,11 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     if (cur == (unsigned long)-1) {
         do {
             pos++;
+            /* Skip whole groups of words that are known to be all ones */
+            while (!(pos & (BITS_PER_LONG - 1)) && pos + BITS_PER_LONG <= sz &&
+                   hb->group_count[pos >> BITS_PER_LEVEL] == HB_GROUP_BITS) {
+                pos += BITS_PER_LONG;
+            }
         } while (pos < sz && last_lev[pos] == (unsigned long)-1);
 
         if (pos >= sz) {
@@ -349,63 +545,105 @@ uint64_t hbitmap_count(const HBitmap *hb)
     return hb->count << hb->granularity;
 }
 
-/**
- * hbitmap_iter_next_word:
- * @hbi: HBitmapIter to operate on.
- * @p_cur: Location where to store the next non-zero word.
- *
- * Return the index of the next nonzero word that is set in @hbi's
- * associated HBitmap, and set *p_cur to the content of that word
- * (bits before the index that was passed to hbitmap_iter_init are
- * trimmed on the first call).  Return -1, and set *p_cur to zero,
- * if all remaining words are zero.
- */
-static size_t hbitmap_iter_next_word(HBitmapIter *hbi, unsigned long *p_cur)
+/* Count the number of set bits in words [pos, end) of the last level */
+static uint64_t hb_count_words_between(const HBitmap *hb, size_t pos,
+                                       size_t end)
 {
-    unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1];
+    const unsigned long *words = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t count = 0;
 
-    if (cur == 0) {
-        cur = hbitmap_iter_skip_words(hbi);
-        if (cur == 0) {
-            *p_cur = 0;
-            return -1;
+    while (pos < end) {
+        size_t next = MIN(end, (pos | (BITS_PER_LONG - 1)) + 1);
+
+        if (next - pos == BITS_PER_LONG) {
+            count += hb->group_count[pos >> BITS_PER_LEVEL];
+        } else {
+            count += hb_count_words(&words[pos], next - pos);
         }
+        pos = next;
     }
+    return count;
+}
+
+/* Recompute the population counts from the last level */
+static void hb_recount(HBitmap *hb)
+{
+    const unsigned long *words = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t size = hb->sizes[HBITMAP_LEVELS - 1];
+    uint64_t group;
+
+    hb->count = 0;
+    for (group = 0; group < hb->sizes[HBITMAP_LEVELS - 2]; group++) {
+        uint64_t pos = group << BITS_PER_LEVEL;
+        uint64_t n = MIN(size - pos, BITS_PER_LONG);
 
-    /* The next call will resume work from the next word.  */
-    hbi->cur[HBITMAP_LEVELS - 1] = 0;
-    *p_cur = cur;
-    return hbi->pos;
+        hb->group_count[group] = hb_count_words(&words[pos], n);
+        hb->count += hb->group_count[group];
+    }
 }
 
-/* Count the number of set bits between start and end, not accounting for
- * the granularity.  Also an example of how to use hbitmap_iter_next_word.
+/* Recompute the counts of the groups covering words [pos, end) of the
+ * last level, after they were written directly
  */
-static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
+static void hb_recount_words(HBitmap *hb, uint64_t pos, uint64_t end)
 {
-    HBitmapIter hbi;
-    uint64_t count = 0;
-    uint64_t end = last + 1;
-    unsigned long cur;
-    size_t pos;
+    const unsigned long *words = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t size = hb->sizes[HBITMAP_LEVELS - 1];
+    uint64_t group;
+
+    for (group = pos >> BITS_PER_LEVEL;
+         group < DIV_ROUND_UP(end, BITS_PER_LONG); group++) {
+        uint64_t first = group << BITS_PER_LEVEL;
+        uint64_t n = MIN(size - first, BITS_PER_LONG);
+
+        hb->count -= hb->group_count[group];
+        hb->group_count[group] = hb_count_words(&words[first], n);
+        hb->count += hb->group_count[group];
+    }
+}
 
-    hbitmap_iter_init(&hbi, hb, start << hb->granularity);
-    for (;;) {
-        pos = hbitmap_iter_next_word(&hbi, &cur);
-        if (pos >= (end >> BITS_PER_LEVEL)) {
-            break;
+/* Word @pos of the last level changed from @old, update the counts */
+static inline void hb_account_word(HBitmap *hb, size_t pos, unsigned long old)
+{
+    int delta = ctpopl(hb->levels[HBITMAP_LEVELS - 1][pos]) - ctpopl(old);
+
+    hb->count += delta;
+    hb->group_count[pos >> BITS_PER_LEVEL] += delta;
+}
+
+/* Fill words [pos, end) of @level with @val, which is either all zeroes
+ * or all ones.  Returns true if any word changed.
+ */
+static bool hb_fill_words(HBitmap *hb, int level, size_t pos, size_t end,
+                          unsigned long val)
+{
+    unsigned long *words = hb->levels[level];
+    bool changed = false;
+
+    if (level < HBITMAP_LEVELS - 1) {
+        for (; pos < end; pos++) {
+            changed |= (words[pos] != val);
+            words[pos] = val;
         }
-        count += ctpopl(cur);
+        return changed;
     }
 
-    if (pos == (end >> BITS_PER_LEVEL)) {
-        /* Drop bits representing the END-th and subsequent items.  */
-        int bit = end & (BITS_PER_LONG - 1);
-        cur &= (1UL << bit) - 1;
-        count += ctpopl(cur);
+    /* On the last level, go one group at a time and keep the counts */
+    while (pos < end) {
+        size_t next = MIN(end, (pos | (BITS_PER_LONG - 1)) + 1);
+        uint64_t old_count = hb_count_words_between(hb, pos, next);
+        uint64_t new_count = val ? (next - pos) * BITS_PER_LONG : 0;
+
+        if (old_count != new_count) {
+            memset(&words[pos], val ? 0xff : 0,
+                   (next - pos) * sizeof(unsigned long));
+            hb->count += new_count - old_count;
+            hb->group_count[pos >> BITS_PER_LEVEL] += new_count - old_count;
+            changed = true;
+        }
+        pos = next;
     }
-
-    return count;
+    return changed;
 }
 
 /* Setting starts at the last layer and propagates up if an element
@@ -433,24 +671,28 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
+    bool account = level == HBITMAP_LEVELS - 1;
+    unsigned long old;
     bool changed = false;
     size_t i;
 
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
+        old = hb->levels[level][i];
         changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+        if (account) {
+            hb_account_word(hb, i, old);
         }
+        changed |= hb_fill_words(hb, level, i + 1, lastpos, ~0UL);
+        i = lastpos;
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
+    old = hb->levels[level][i];
     changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    if (account) {
+        hb_account_word(hb, i, old);
+    }
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -464,7 +706,7 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 {
     /* Compute range in the last layer.  */
-    uint64_t first, n;
+    uint64_t first;
     uint64_t last = start + count - 1;
 
     if (count == 0) {
@@ -477,9 +719,7 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     first = start >> hb->granularity;
     last >>= hb->granularity;
     assert(last < hb->size);
-    n = last - first + 1;
 
-    hb->count += n - hb_count_between(hb, first, last);
     if (hb_set_between(hb, HBITMAP_LEVELS - 1, first, last) &&
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
@@ -511,6 +751,8 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
+    bool account = level == HBITMAP_LEVELS - 1;
+    unsigned long old;
     bool changed = false;
     size_t i;
 
@@ -523,29 +765,31 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
+        old = hb->levels[level][i];
         if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
             changed = true;
         } else {
             pos++;
         }
-
-        for (;;) {
-            start = next;
-            next += BITS_PER_LONG;
-            if (++i == lastpos) {
-                break;
-            }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+        if (account) {
+            hb_account_word(hb, i, old);
         }
+
+        changed |= hb_fill_words(hb, level, i + 1, lastpos, 0UL);
+        i = lastpos;
+        start = (uint64_t)lastpos << BITS_PER_LEVEL;
     }
 
     /* Same as above, this time for lastpos.  */
+    old = hb->levels[level][i];
     if (hb_reset_elem(&hb->levels[level][i], start, last)) {
         changed = true;
     } else {
         lastpos--;
     }
+    if (account) {
+        hb_account_word(hb, i, old);
+    }
 
     if (level > 0 && changed) {
         hb_reset_between(hb, level - 1, pos, lastpos);
@@ -576,7 +820,6 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     last >>= hb->granularity;
     assert(last < hb->size);
 
-    hb->count -= hb_count_between(hb, first, last);
     if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
@@ -591,6 +834,8 @@ void hbitmap_reset_all(HBitmap *hb)
     for (i = HBITMAP_LEVELS; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
+    memset(hb->group_count, 0,
+           hb->sizes[HBITMAP_LEVELS - 2] * sizeof(*hb->group_count));
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
     hb->count = 0;
@@ -682,6 +927,11 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(buf, cur, el_count * sizeof(unsigned long));
+        return;
+    }
+
     while (cur != end) {
         unsigned long el =
             (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
@@ -692,6 +942,23 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     }
 }
 
+/* @el_count words at @first of the last level were deserialized.  The
+ * other levels wait for hbitmap_deserialize_finish(), but the counts must
+ * stay exact in the meantime: hb_fill_words() relies on them to skip
+ * groups, so a set or reset between two parts would otherwise miss words.
+ */
+static void hb_deserialize_done(HBitmap *hb, unsigned long *first,
+                                uint64_t el_count, bool finish)
+{
+    if (finish) {
+        hbitmap_deserialize_finish(hb);
+    } else {
+        uint64_t pos = first - hb->levels[HBITMAP_LEVELS - 1];
+
+        hb_recount_words(hb, pos, pos + el_count);
+    }
+}
+
 void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               uint64_t start, uint64_t count,
                               bool finish)
@@ -705,21 +972,23 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     serialization_chunk(hb, start, count, &cur, &el_count);
     end = cur + el_count;
 
-    while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+    if (!HOST_BIG_ENDIAN) {
+        memcpy(cur, buf, el_count * sizeof(unsigned long));
+    } else {
+        while (cur != end) {
+            memcpy(cur, buf, sizeof(*cur));
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
-        }
+            if (BITS_PER_LONG == 32) {
+                le32_to_cpus((uint32_t *)cur);
+            } else {
+                le64_to_cpus((uint64_t *)cur);
+            }
 
-        buf += sizeof(unsigned long);
-        cur++;
-    }
-    if (finish) {
-        hbitmap_deserialize_finish(hb);
+            buf += sizeof(unsigned long);
+            cur++;
+        }
     }
+    hb_deserialize_done(hb, end - el_count, el_count, finish);
 }
 
 void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
@@ -734,9 +1003,7 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0, el_count * sizeof(unsigned long));
-    if (finish) {
-        hbitmap_deserialize_finish(hb);
-    }
+    hb_deserialize_done(hb, first, el_count, finish);
 }
 
 void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
@@ -751,9 +1018,7 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0xff, el_count * sizeof(unsigned long));
-    if (finish) {
-        hbitmap_deserialize_finish(hb);
-    }
+    hb_deserialize_done(hb, first, el_count, finish);
 }
 
 void hbitmap_deserialize_finish(HBitmap *bitmap)
@@ -778,7 +1043,7 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
-    bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
+    hb_recount(bitmap);
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -788,6 +1053,7 @@ void hbitmap_free(HBitmap *hb)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
+    g_free(hb->group_count);
     g_free(hb);
 }
 
@@ -810,6 +1076,7 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
         hb->sizes[i] = size;
         hb->levels[i] = g_new0(unsigned long, size);
     }
+    hb->group_count = g_new0(uint32_t, hb->sizes[HBITMAP_LEVELS - 2]);
 
     /* We necessarily have free bits in level 0 due to the definition
      * of HBITMAP_LEVELS, so use one for a sentinel.  This speeds up
@@ -825,7 +1092,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
     bool shrink;
     unsigned i;
     uint64_t num_elements = size;
-    uint64_t old;
+    uint64_t old, old_groups;
 
     assert(size <= INT64_MAX);
     hb->orig_size = size;
@@ -855,6 +1122,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
     }
 
     hb->size = size;
+    old_groups = hb->sizes[HBITMAP_LEVELS - 2];
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX(BITS_TO_LONGS(size), 1);
         if (hb->sizes[i] == size) {
@@ -868,6 +1136,14 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
                    (size - old) * sizeof(*hb->levels[i]));
         }
     }
+    if (hb->sizes[HBITMAP_LEVELS - 2] != old_groups) {
+        size = hb->sizes[HBITMAP_LEVELS - 2];
+        hb->group_count = g_renew(uint32_t, hb->group_count, size);
+        if (!shrink) {
+            memset(&hb->group_count[old_groups], 0,
+                   (size - old_groups) * sizeof(*hb->group_count));
+        }
+    }
     if (hb->meta) {
         hbitmap_truncate(hb->meta, hb->size << hb->granularity);
     }
@@ -892,6 +1168,53 @@ static void hbitmap_sparse_merge(HBitmap *dst, const HBitmap *src)
     }
 }
 
+/**
+ * hb_merge_last_level: performs result = a | b on the last level, one
+ * group of BITS_PER_LONG words at a time, and updates the counts.
+ * Groups that are empty in one operand are copied (or left alone if
+ * result is an alias of the other operand) and keep their cached count.
+ * Must run before the upper levels of result are updated.
+ */
+static void hb_merge_last_level(const HBitmap *a, const HBitmap *b,
+                                HBitmap *result)
+{
+    const unsigned long *up_a = a->levels[HBITMAP_LEVELS - 2];
+    const unsigned long *up_b = b->levels[HBITMAP_LEVELS - 2];
+    const unsigned long *words_a = a->levels[HBITMAP_LEVELS - 1];
+    const unsigned long *words_b = b->levels[HBITMAP_LEVELS - 1];
+    unsigned long *words = result->levels[HBITMAP_LEVELS - 1];
+    uint64_t size = result->sizes[HBITMAP_LEVELS - 1];
+    uint64_t group;
+
+    result->count = 0;
+    for (group = 0; group < result->sizes[HBITMAP_LEVELS - 2]; group++) {
+        uint64_t pos = group << BITS_PER_LEVEL;
+        uint64_t n = MIN(size - pos, BITS_PER_LONG);
+        uint32_t count;
+
+        if (up_a[group] && up_b[group]) {
+            count = hb_or_words(&words[pos], &words_a[pos], &words_b[pos], n);
+        } else if (up_a[group]) {
+            count = a->group_count[group];
+            if (result != a) {
+                memcpy(&words[pos], &words_a[pos], n * sizeof(unsigned long));
+            }
+        } else if (up_b[group]) {
+            count = b->group_count[group];
+            if (result != b) {
+                memcpy(&words[pos], &words_b[pos], n * sizeof(unsigned long));
+            }
+        } else {
+            count = 0;
+            if (result != a && result != b) {
+                memset(&words[pos], 0, n * sizeof(unsigned long));
+            }
+        }
+        result->group_count[group] = count;
+        result->count += count;
+    }
+}
+
 /**
  * Given HBitmaps A and B, let R := A (BITOR) B.
  * Bitmaps A and B will not be modified,
@@ -929,19 +1252,17 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant,
+     * but groups of words that are empty in either bitmap are only copied,
+     * so that merging a sparse bitmap into a dense one is cheap.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    hb_merge_last_level(a, b, result);
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
-
-    /* Recompute the dirty count */
-    result->count = hb_count_between(result, 0, result->size - 1);
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
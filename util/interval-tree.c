@@ -0,0 +1,182 @@
+/*
+ * Intrusive interval tree
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+#include "qemu/xxhash.h"
+
+static void interval_tree_update(IntervalTreeNode *node)
+{
+    uint64_t last = node->last;
+
+    if (node->left) {
+        last = MAX(last, node->left->subtree_last);
+    }
+    if (node->right) {
+        last = MAX(last, node->right->subtree_last);
+    }
+    node->subtree_last = last;
+}
+
+static void interval_tree_replace_child(IntervalTreeRoot *root,
+                                        IntervalTreeNode *parent,
+                                        IntervalTreeNode *old,
+                                        IntervalTreeNode *new)
+{
+    if (!parent) {
+        root->node = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+/* Rotate @node above its parent.  Ancestors do not need an update. */
+static void interval_tree_rotate_up(IntervalTreeNode *node,
+                                    IntervalTreeRoot *root)
+{
+    IntervalTreeNode *parent = node->parent;
+    IntervalTreeNode *grandparent = parent->parent;
+
+    if (parent->left == node) {
+        parent->left = node->right;
+        if (node->right) {
+            node->right->parent = parent;
+        }
+        node->right = parent;
+    } else {
+        parent->right = node->left;
+        if (node->left) {
+            node->left->parent = parent;
+        }
+        node->left = parent;
+    }
+    parent->parent = node;
+    node->parent = grandparent;
+    interval_tree_replace_child(root, grandparent, parent, node);
+
+    interval_tree_update(parent);
+    interval_tree_update(node);
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode **link = &root->node;
+    IntervalTreeNode *parent = NULL;
+
+    node->left = NULL;
+    node->right = NULL;
+    node->subtree_last = node->last;
+    node->priority = qemu_xxhash4((uintptr_t)node, node->start);
+
+    while (*link) {
+        parent = *link;
+        parent->subtree_last = MAX(parent->subtree_last, node->last);
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+    node->parent = parent;
+    *link = node;
+
+    while (node->parent && node->parent->priority < node->priority) {
+        interval_tree_rotate_up(node, root);
+    }
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *parent, *child;
+
+    /* Push @node down until it has at most one child */
+    while (node->left && node->right) {
+        child = node->left->priority > node->right->priority ?
+                node->left : node->right;
+        interval_tree_rotate_up(child, root);
+    }
+
+    parent = node->parent;
+    child = node->left ? node->left : node->right;
+    if (child) {
+        child->parent = parent;
+    }
+    interval_tree_replace_child(root, parent, node, child);
+
+    for (; parent; parent = parent->parent) {
+        uint64_t old_last = parent->subtree_last;
+
+        interval_tree_update(parent);
+        if (parent->subtree_last == old_last) {
+            break;
+        }
+    }
+}
+
+/*
+ * Return the leftmost node of the subtree rooted at @node that overlaps
+ * [@start, @last].  @node->subtree_last must be >= @start.
+ */
+static IntervalTreeNode *interval_tree_subtree_search(IntervalTreeNode *node,
+                                                      uint64_t start,
+                                                      uint64_t last)
+{
+    for (;;) {
+        if (node->left && start <= node->left->subtree_last) {
+            node = node->left;
+            continue;
+        }
+        if (node->start <= last) {
+            if (start <= node->last) {
+                return node;
+            }
+            if (node->right) {
+                node = node->right;
+                if (start <= node->subtree_last) {
+                    continue;
+                }
+            }
+        }
+        return NULL;
+    }
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    if (!root->node || start > root->node->subtree_last) {
+        return NULL;
+    }
+    return interval_tree_subtree_search(root->node, start, last);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *right = node->right, *prev;
+
+    for (;;) {
+        /* Invariant: node->start <= last, right == node->right */
+        if (right && start <= right->subtree_last) {
+            return interval_tree_subtree_search(right, start, last);
+        }
+
+        /* Move up until we come from the left child of a node */
+        do {
+            prev = node;
+            node = node->parent;
+            if (!node) {
+                return NULL;
+            }
+            right = node->right;
+        } while (prev == right);
+
+        if (last < node->start) {
+            return NULL;
+        }
+        if (start <= node->last) {
+            return node;
+        }
+    }
+}
@@ -24,6 +24,14 @@
 
 static void do_spawn_thread(ThreadPool *pool);
 
+/*
+ * Requests are spread over several submission queues, each with its own
+ * lock.  Every worker has a home queue and steals from the others when its
+ * own is empty, so the submitting thread and the workers rarely contend on
+ * the same lock.
+ */
+#define THREAD_POOL_NR_QUEUES 8
+
 typedef struct ThreadPoolElement ThreadPoolElement;
 
 enum ThreadState {
@@ -32,24 +40,36 @@ enum ThreadState {
     THREAD_DONE,
 };
 
+typedef struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* Written under lock, read atomically to skip empty queues.  */
+    int len;
+} QEMU_ALIGNED(64) ThreadPoolQueue;
+
 struct ThreadPoolElement {
     BlockAIOCB common;
     ThreadPool *pool;
     ThreadPoolFunc *func;
     void *arg;
+    ThreadPoolQueue *queue;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by queue->lock.  After
+     * that, only the worker thread can write to it.  ret is written before
+     * the element is added to the completion list.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Access to this list is protected by queue->lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
-    /* Access to this list is protected by the global mutex.  */
+    /* Lock-free list of completed requests, see completion_list.  */
+    QSLIST_ENTRY(ThreadPoolElement) next_done;
+
+    /* Access to these lists is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
+    QSIMPLEQ_ENTRY(ThreadPoolElement) completed;
 };
 
 struct ThreadPool {
@@ -60,37 +80,111 @@ struct ThreadPool {
     QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
+    ThreadPoolQueue queues[THREAD_POOL_NR_QUEUES];
+    /* Next queue for submission, only accessed from one AioContext.  */
+    unsigned next_queue;
+    /* Number of requests waiting in the queues, accessed atomically.  */
+    int queued;
+
+    /*
+     * Requests completed by the workers.  Workers push to it atomically,
+     * completion_bh moves the whole list at once to completed.
+     */
+    QSLIST_HEAD(, ThreadPoolElement) completion_list;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* The following variables are protected by lock.  idle_threads,
+     * cur_threads and max_threads are also read atomically without it.
+     */
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+    unsigned next_home;  /* home queue of the next worker thread */
 };
 
+/* Take the oldest request of @q, if any */
+static ThreadPoolElement *thread_pool_queue_pop(ThreadPool *pool,
+                                                ThreadPoolQueue *q)
+{
+    ThreadPoolElement *req;
+
+    if (!qatomic_read(&q->len)) {
+        /* A stale value is fine, the caller looks at all queues again */
+        return NULL;
+    }
+
+    qemu_mutex_lock(&q->lock);
+    req = QTAILQ_FIRST(&q->request_list);
+    if (req) {
+        QTAILQ_REMOVE(&q->request_list, req, reqs);
+        qatomic_set(&q->len, q->len - 1);
+        req->state = THREAD_ACTIVE;
+        qatomic_dec(&pool->queued);
+    }
+    qemu_mutex_unlock(&q->lock);
+    return req;
+}
+
+/* Take a request from the home queue, or steal one from another queue */
+static ThreadPoolElement *thread_pool_get_request(ThreadPool *pool,
+                                                  unsigned home)
+{
+    ThreadPoolElement *req;
+    unsigned i;
+
+    for (i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        req = thread_pool_queue_pop(pool,
+                &pool->queues[(home + i) % THREAD_POOL_NR_QUEUES]);
+        if (req) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static void thread_pool_complete_request(ThreadPool *pool,
+                                         ThreadPoolElement *req)
+{
+    req->state = THREAD_DONE;
+
+    /* The cmpxchg orders the writes to ret and state before the insertion */
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->completion_list, req, next_done);
+
+    /*
+     * Scheduling an already scheduled BH is cheap and does not notify the
+     * AioContext again, so a burst of completions is handled in one batch.
+     */
+    qemu_bh_schedule(pool->completion_bh);
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    unsigned home;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    home = pool->next_home++ % THREAD_POOL_NR_QUEUES;
     do_spawn_thread(pool);
 
     while (pool->cur_threads <= pool->max_threads) {
         ThreadPoolElement *req;
         int ret;
 
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
+        qatomic_set(&pool->idle_threads, pool->idle_threads + 1);
+        /* Pairs with smp_mb() in thread_pool_submit_aio() */
+        smp_mb();
+        if (!qatomic_read(&pool->queued)) {
             ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
+            qatomic_set(&pool->idle_threads, pool->idle_threads - 1);
             if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
+                !qatomic_read(&pool->queued) &&
                 pool->cur_threads > pool->min_threads) {
                 /* Timed out + no work to do + no need for warm threads = exit.  */
                 break;
@@ -101,24 +195,24 @@ static void *worker_thread(void *opaque)
              */
             continue;
         }
-
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
+        qatomic_set(&pool->idle_threads, pool->idle_threads - 1);
         qemu_mutex_unlock(&pool->lock);
 
-        ret = req->func(req->arg);
+        /* Run requests without taking the pool lock until the queues drain */
+        while ((req = thread_pool_get_request(pool, home))) {
+            req->ret = req->func(req->arg);
+            thread_pool_complete_request(pool, req);
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+            if (qatomic_read(&pool->cur_threads) >
+                qatomic_read(&pool->max_threads)) {
+                break;
+            }
+        }
 
-        qemu_bh_schedule(pool->completion_bh);
         qemu_mutex_lock(&pool->lock);
     }
 
-    pool->cur_threads--;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - 1);
     qemu_cond_signal(&pool->worker_stopped);
     qemu_mutex_unlock(&pool->lock);
 
@@ -156,7 +250,7 @@ static void spawn_thread_bh_fn(void *opaque)
 
 static void spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    qatomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -170,26 +264,48 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/*
+ * Move requests completed by the workers to pool->completed, in the order
+ * in which they completed.  Callbacks are not run in submission order;
+ * nothing relies on that, requests are independent of each other.
+ */
+static void thread_pool_collect_completions(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) done;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) batch =
+        QSIMPLEQ_HEAD_INITIALIZER(batch);
+    ThreadPoolElement *elem;
+
+    QSLIST_MOVE_ATOMIC(&done, &pool->completion_list);
+
+    /* The list is in LIFO order, reverse it */
+    while ((elem = QSLIST_FIRST(&done))) {
+        QSLIST_REMOVE_HEAD(&done, next_done);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, completed);
+    }
+    QSIMPLEQ_CONCAT(&pool->completed, &batch);
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
+    for (;;) {
+        thread_pool_collect_completions(pool);
+
+        elem = QSIMPLEQ_FIRST(&pool->completed);
+        if (!elem) {
+            break;
         }
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed);
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
@@ -200,16 +316,12 @@ restart:
             aio_context_acquire(pool->ctx);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we look at the
+             * completion list again before returning.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
     aio_context_release(pool->ctx);
 }
@@ -218,18 +330,22 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
     ThreadPool *pool = elem->pool;
+    ThreadPoolQueue *q = elem->queue;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    qemu_mutex_lock(&q->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        QTAILQ_REMOVE(&q->request_list, elem, reqs);
+        qatomic_set(&q->len, q->len - 1);
+        qatomic_dec(&pool->queued);
+        qemu_mutex_unlock(&q->lock);
 
-        elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_complete_request(pool, elem);
+        return;
     }
-
+    qemu_mutex_unlock(&q->lock);
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -250,24 +366,47 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolQueue *q;
+    int queued, idle;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->queue = q = &pool->queues[pool->next_queue++ % THREAD_POOL_NR_QUEUES];
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    qemu_mutex_lock(&q->lock);
+    QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    qatomic_set(&q->len, q->len + 1);
+    qemu_mutex_unlock(&q->lock);
+
+    queued = qatomic_fetch_inc(&pool->queued) + 1;
+    /* Pairs with smp_mb() in worker_thread() */
+    smp_mb();
+    idle = qatomic_read(&pool->idle_threads);
+
+    /*
+     * Busy workers pick up the request on their own, so the pool lock is
+     * only needed to wake up an idle worker, or to add a thread when the
+     * queue depth exceeds the number of idle ones.
+     */
+    if (idle || qatomic_read(&pool->cur_threads) <
+                qatomic_read(&pool->max_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->idle_threads) {
+            qemu_cond_signal(&pool->request_cond);
+        }
+        if (pool->idle_threads < queued &&
+            pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -304,7 +443,7 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
 
     /*
      * We either have to:
@@ -340,8 +479,14 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_cond_init(&pool->request_cond);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
+    for (int i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        qemu_mutex_init(&pool->queues[i].lock);
+        QTAILQ_INIT(&pool->queues[i].request_list);
+    }
+    QSLIST_INIT(&pool->completion_list);
+
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QSIMPLEQ_INIT(&pool->completed);
 
     thread_pool_update_params(pool, ctx);
 }
@@ -365,11 +510,11 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_set(&pool->cur_threads, pool->cur_threads - pool->new_threads);
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
+    qatomic_set(&pool->max_threads, 0);
     qemu_cond_broadcast(&pool->request_cond);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
@@ -378,6 +523,10 @@ void thread_pool_free(ThreadPool *pool)
     qemu_mutex_unlock(&pool->lock);
 
     qemu_bh_delete(pool->completion_bh);
+    for (int i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        assert(QTAILQ_EMPTY(&pool->queues[i].request_list));
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);